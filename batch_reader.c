@@ -0,0 +1,227 @@
+#define _GNU_SOURCE // memrchr
+#include "batch_reader.h"
+#include <assert.h>
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BATCH_BLOCK_SIZE (1 << 20)
+#define MIN_BATCH_LINES 4096
+
+/* Type: function batch_alloc
+ * ----------------------------------
+ * Returns a batch from the reader's spare list, or a newly allocated
+ * one when every batch is still held by the consumer. Called with the
+ * reader's lock held.
+ */
+static line_batch *batch_alloc(batch_reader *r)
+{
+    line_batch *b = r->spare;
+    if (b != NULL) {
+        r->spare = b->next;
+        return b;
+    }
+    b = malloc(sizeof(line_batch));
+    assert(b);
+    b->data_cap = BATCH_BLOCK_SIZE;
+    b->data = malloc(b->data_cap + 1);
+    b->lines_cap = MIN_BATCH_LINES;
+    b->lines = malloc(sizeof(line_view) * b->lines_cap);
+    assert(b->data && b->lines);
+    return b;
+}
+
+/* Type: function split_lines
+ * ----------------------------------
+ * Fills b->lines with views of the first len bytes of b->data, which
+ * hold whole lines only (the last may lack a newline at EOF). Newlines
+ * become null terminators.
+ */
+static void split_lines(line_batch *b, size_t len)
+{
+    b->nlines = 0;
+    char *p = b->data, *end = b->data + len;
+    while (p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        if (nl == NULL) nl = end; // Unterminated final line; data_cap + 1 leaves room
+        *nl = '\0';
+        if (b->nlines == b->lines_cap) {
+            b->lines_cap *= 2;
+            b->lines = realloc(b->lines, sizeof(line_view) * b->lines_cap);
+            assert(b->lines);
+        }
+        b->lines[b->nlines].ptr = p;
+        b->lines[b->nlines].len = nl - p;
+        b->nlines++;
+        p = nl + 1;
+    }
+}
+
+/* Type: function read_ahead
+ * ----------------------------------
+ * Producer thread. Fills a block starting with the partial line left
+ * over from the previous one, cuts it after its last newline, splits
+ * it into lines and queues it, waiting only while BATCH_QUEUE_DEPTH
+ * batches are already queued. A line longer than a block doubles the
+ * block until the line fits.
+ */
+static void *read_ahead(void *arg)
+{
+    batch_reader *r = arg;
+    char *carry = NULL;
+    size_t carry_len = 0, carry_cap = 0;
+    bool eof = false;
+    while (!eof) {
+        pthread_mutex_lock(&r->lock);
+        while (r->count == BATCH_QUEUE_DEPTH && !r->stopping) pthread_cond_wait(&r->cond, &r->lock);
+        if (r->stopping) {
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+        line_batch *b = batch_alloc(r);
+        pthread_mutex_unlock(&r->lock);
+
+        size_t len = carry_len;
+        if (len > b->data_cap) {
+            while (len > b->data_cap) b->data_cap *= 2;
+            b->data = realloc(b->data, b->data_cap + 1);
+            assert(b->data);
+        }
+        memcpy(b->data, carry, carry_len);
+        size_t cut = 0; // One past the last newline in the block
+        while (true) {
+            if (len == b->data_cap) { // No newline in a full block: grow it
+                b->data_cap *= 2;
+                b->data = realloc(b->data, b->data_cap + 1);
+                assert(b->data);
+            }
+            ssize_t n = read(r->fd, b->data + len, b->data_cap - len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) error(1, errno, "read error");
+            if (n == 0) {
+                eof = true;
+                cut = len;
+                break;
+            }
+            char *nl = memrchr(b->data + len, '\n', n);
+            len += n;
+            if (nl != NULL) cut = nl - b->data + 1;
+            if (cut != 0 && len > b->data_cap / 2) break; // Enough for one batch
+        }
+        carry_len = len - cut;
+        if (carry_len > carry_cap) {
+            carry_cap = carry_len;
+            carry = realloc(carry, carry_cap);
+            assert(carry);
+        }
+        memcpy(carry, b->data + cut, carry_len);
+        split_lines(b, cut);
+
+        pthread_mutex_lock(&r->lock);
+        r->ready[(r->head + r->count) % BATCH_QUEUE_DEPTH] = b;
+        r->count++;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+    free(carry);
+    pthread_mutex_lock(&r->lock);
+    r->done = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+/* Type: function batch_reader_init
+ * ----------------------------------
+ * Takes a reader and the stream to read from, and starts the read-ahead
+ * thread on the stream's file descriptor. fp should not be read through
+ * stdio while the reader is in use.
+ */
+void batch_reader_init(batch_reader *r, FILE *fp)
+{
+    r->fd = fileno(fp);
+    r->head = r->count = 0;
+    r->spare = NULL;
+    r->done = r->stopping = false;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    if (pthread_create(&r->thread, NULL, read_ahead, r) != 0) error(1, 0, "cannot create read-ahead thread");
+}
+
+/* Type: function batch_reader_next
+ * ----------------------------------
+ * Returns the next batch of lines, blocking until the read-ahead thread
+ * has one ready, or NULL at end of input. Batches are never empty. The
+ * caller either hands the batch back with batch_reader_release or keeps
+ * it and later frees it with batch_free.
+ */
+line_batch *batch_reader_next(batch_reader *r)
+{
+    line_batch *b = NULL;
+    pthread_mutex_lock(&r->lock);
+    while (true) {
+        while (r->count == 0 && !r->done) pthread_cond_wait(&r->cond, &r->lock);
+        if (r->count == 0) break; // Done and drained
+        b = r->ready[r->head];
+        r->head = (r->head + 1) % BATCH_QUEUE_DEPTH;
+        r->count--;
+        pthread_cond_broadcast(&r->cond);
+        if (b->nlines != 0) break;
+        b->next = r->spare; // Empty input still yields one empty batch
+        r->spare = b;
+        b = NULL;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return b;
+}
+
+/* Type: function batch_reader_release
+ * ----------------------------------
+ * Hands a batch back to the reader for reuse. Views into it become
+ * invalid.
+ */
+void batch_reader_release(batch_reader *r, line_batch *b)
+{
+    pthread_mutex_lock(&r->lock);
+    b->next = r->spare;
+    r->spare = b;
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* Type: function batch_free
+ * ----------------------------------
+ * Frees a batch the caller kept instead of releasing.
+ */
+void batch_free(line_batch *b)
+{
+    free(b->data);
+    free(b->lines);
+    free(b);
+}
+
+/* Type: function batch_reader_dispose
+ * ----------------------------------
+ * Stops the read-ahead thread and frees every batch still owned by the
+ * reader. Batches the caller kept are unaffected.
+ */
+void batch_reader_dispose(batch_reader *r)
+{
+    pthread_mutex_lock(&r->lock);
+    r->stopping = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+    for (; r->count > 0; r->count--) {
+        batch_free(r->ready[r->head]);
+        r->head = (r->head + 1) % BATCH_QUEUE_DEPTH;
+    }
+    while (r->spare != NULL) {
+        line_batch *next = r->spare->next;
+        batch_free(r->spare);
+        r->spare = next;
+    }
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+}
@@ -0,0 +1,45 @@
+#ifndef BATCH_READER_H
+#define BATCH_READER_H
+
+#include "read_line.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define BATCH_QUEUE_DEPTH 2 // Blocks read ahead of the consumer
+
+// One block of input split into lines. Every view points into data and
+// is null terminated in place. A batch stays valid until it is handed
+// back with batch_reader_release or freed with batch_free.
+typedef struct line_batch {
+    char *data;
+    size_t data_cap;
+    line_view *lines;
+    size_t nlines;
+    size_t lines_cap;
+    struct line_batch *next; // Link in the reader's spare list
+} line_batch;
+
+// Reads a stream in large blocks on a background thread, so the next
+// block is being read and split while the consumer works on the current
+// one. Ready batches are handed over through a small ring.
+typedef struct {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    line_batch *ready[BATCH_QUEUE_DEPTH];
+    size_t head, count;
+    line_batch *spare;
+    bool done;      // Producer has queued its last batch
+    bool stopping;  // Consumer is disposing of the reader early
+} batch_reader;
+
+void batch_reader_init(batch_reader *r, FILE *fp);
+line_batch *batch_reader_next(batch_reader *r);
+void batch_reader_release(batch_reader *r, line_batch *b);
+void batch_reader_dispose(batch_reader *r);
+void batch_free(line_batch *b);
+
+#endif
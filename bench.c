@@ -0,0 +1,1267 @@
+#define _GNU_SOURCE // sched_setaffinity and CPU_SET for the pinned myls runs
+#include "samples/prototypes.h"
+#include "batch_reader.h"
+#include "eytzinger.h"
+#include "filters.h"
+#include "line_sort.h"
+#include "oset.h"
+#include "rand64.h"
+#include "read_line.h"
+#include "sat_batch.h"
+#include "scan_token.h"
+#include "utf16.h"
+#include "utf8_decode.h"
+#ifdef BENCH_ALLOCATOR
+#include "allocator.h"
+#endif
+#ifdef BENCH_SLAB
+#include "slab.h"
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+ * bench times the tools and the library kernels under them on
+ * generated datasets and prints the results as JSON. Library cases run
+ * in process and link against read_line.o, batch_reader.o, scan_token.o,
+ * line_sort.o, filters.o, writer.o, binsert.o, oset.o, eytzinger.o,
+ * utf16.o, utf8_decode.o and sat_batch.o. The scalar baselines to_utf8 and sat_add come from utf8.o
+ * and sat.o, which must be compiled with -Dmain=utf8_main
+ * -Dconvert_arg=utf8_convert_arg and -Dmain=sat_main
+ * -Dconvert_arg=sat_convert_arg so they can share one binary.
+ * Defining BENCH_ALLOCATOR and linking implicit.o or explicit.o adds
+ * the allocator case; also defining BENCH_SLAB and linking slab.o adds
+ * the same churn through the slab layer. Tool cases run the built binaries from -b DIR.
+ */
+
+#define MAX_TRIALS 1000
+#define MAX_TOOL_ARGS 8
+#define MAX_NAME_ARGS 256 // Names passed on the command line in the mywhich/args case
+#define GEN_BUF_SIZE (1 << 20)
+
+typedef enum {
+    DATA_NONE,
+    DATA_LINES,    // Text lines with controlled length, cardinality and duplication
+    DATA_NUMBERS,  // One decimal integer per line
+    DATA_UTF16,    // Mixed-script UTF-16 text
+    DATA_PAIRS,    // Whitespace-separated operand pairs for sat
+    DATA_PAIRS_BIN,// The same pairs as raw int64
+    DATA_TREE,     // Deep directory tree
+    DATA_NAMES,    // Command names, some of them on the generated PATH
+    NDATASETS
+} dataset_id;
+
+static const char *const dataset_names[NDATASETS] = {
+    NULL, "lines.txt", "numbers.txt", "text.utf16", "pairs.txt", "pairs.bin", "tree", "names.txt"
+};
+
+// Shape of a generated line file.
+typedef struct {
+    size_t nlines;
+    size_t min_len, max_len;
+    size_t cardinality; // Distinct lines to draw from
+    unsigned dup_pct;   // Chance in percent that a line repeats the one before it
+} line_spec;
+
+typedef struct {
+    int depth, fanout, files; // files per directory
+} tree_spec;
+
+typedef struct {
+    int trials, warmup;
+    double scale;
+    const char *bindir;
+    char workdir[PATH_MAX / 2]; // Leaves room for dataset names below it
+    bool made[NDATASETS];
+    size_t data_size[NDATASETS]; // Bytes, or entries for the tree
+    char searchpath[PATH_MAX * 4]; // Generated PATH for mywhich
+} bench_ctx;
+
+// Timings of one case.
+typedef struct {
+    double times[MAX_TRIALS]; // Seconds per trial
+    int ntimes;
+    double work;              // Units processed per trial
+    long peak_rss_kb;
+    const char *failure;      // Why the case produced no timings, or NULL
+} case_result;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Type: function convert_arg
+ * ----------------------------------
+ * Converts a numeric command-line argument, exiting with an error if it
+ * is not a non-negative integer.
+ */
+long convert_arg(const char *str)
+{
+    char *end;
+    long n = strtol(str, &end, 0);
+    if (*end != '\0' || n < 0) error(1, 0, "Invalid number '%s'", str);
+    return n;
+}
+
+/* Type: function scaled
+ * ----------------------------------
+ * Applies the -s scale factor to a base count, never going below one.
+ */
+static size_t scaled(const bench_ctx *ctx, size_t base)
+{
+    double n = base * ctx->scale;
+    return n < 1 ? 1 : (size_t)n;
+}
+
+static FILE *open_output(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) error(1, errno, "cannot create '%s'", path);
+    setvbuf(fp, NULL, _IOFBF, GEN_BUF_SIZE);
+    return fp;
+}
+
+/* Type: function gen_lines
+ * ----------------------------------
+ * Writes spec->nlines lines to path. Lines are drawn from a pool of
+ * spec->cardinality random strings with lengths in [min_len, max_len],
+ * and each one repeats its predecessor with probability dup_pct, which
+ * sets how much adjacent duplication myuniq sees.
+ */
+static size_t gen_lines(const char *path, const line_spec *spec, uint64_t seed)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 _-.";
+    size_t width = spec->max_len + 1;
+    char *pool = malloc(spec->cardinality * width);
+    assert(pool);
+    for (size_t i = 0; i < spec->cardinality; i++) {
+        char *s = pool + i * width;
+        size_t len = spec->min_len + next_rand(&seed) % (spec->max_len - spec->min_len + 1);
+        for (size_t k = 0; k < len; k++) s[k] = alphabet[next_rand(&seed) % (sizeof(alphabet) - 1)];
+        s[len] = '\0';
+    }
+    FILE *fp = open_output(path);
+    size_t bytes = 0;
+    const char *prev = pool;
+    for (size_t i = 0; i < spec->nlines; i++) {
+        const char *line = prev;
+        if (i == 0 || next_rand(&seed) % 100 >= spec->dup_pct) line = pool + (next_rand(&seed) % spec->cardinality) * width;
+        bytes += fprintf(fp, "%s\n", line);
+        prev = line;
+    }
+    fclose(fp);
+    free(pool);
+    return bytes;
+}
+
+/* Type: function gen_numbers
+ * ----------------------------------
+ * Writes n lines holding signed integers of varying magnitude, for the
+ * numeric sort.
+ */
+static size_t gen_numbers(const char *path, size_t n, uint64_t seed)
+{
+    FILE *fp = open_output(path);
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = next_rand(&seed);
+        long value = (long)(r >> (33 + r % 24)) * ((r & 1) ? -1 : 1);
+        bytes += fprintf(fp, "%ld\n", value);
+    }
+    fclose(fp);
+    return bytes;
+}
+
+/* Type: function gen_utf16
+ * ----------------------------------
+ * Fills units with n UTF-16 units of mixed text: mostly ASCII, some
+ * Latin/Cyrillic, CJK and astral characters, in runs so the vector
+ * kernels see both uniform and mixed blocks.
+ */
+static void gen_utf16(uint16_t *units, size_t n, uint64_t seed)
+{
+    size_t i = 0;
+    while (i < n) {
+        uint64_t r = next_rand(&seed);
+        size_t run = 1 + r % 64;
+        int script = (r >> 8) % 10;
+        for (size_t k = 0; k < run && i < n; k++) {
+            uint32_t cp;
+            uint64_t c = next_rand(&seed);
+            if (script < 6) cp = 0x20 + c % 0x5F;
+            else if (script < 8) cp = 0xC0 + c % 0x3C0;
+            else if (script < 9) cp = 0x4E00 + c % 0x5000;
+            else cp = 0x1F300 + c % 0x300;
+            if (cp >= 0x10000) {
+                if (i + 2 > n) break;
+                cp -= 0x10000;
+                units[i++] = 0xD800 | (cp >> 10);
+                units[i++] = 0xDC00 | (cp & 0x3FF);
+            } else {
+                units[i++] = cp;
+            }
+        }
+        if (i < n && i > 0 && units[i - 1] >= 0xD800 && units[i - 1] < 0xDC00) units[i++] = 'x'; // Never leave a pair open
+    }
+}
+
+/* Type: function gen_pairs
+ * ----------------------------------
+ * Fills a with n operands for 32-bit saturating arithmetic, a quarter
+ * of them near the limits so that saturation actually happens.
+ */
+static void gen_pairs(long *a, size_t n, uint64_t seed)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint64_t r = next_rand(&seed);
+        long v = (int32_t)r;
+        if (r >> 62 == 0) v = (r & (1ULL << 40)) ? INT32_MAX - (long)(r % 1000) : INT32_MIN + (long)(r % 1000);
+        a[i] = v;
+    }
+}
+
+/* Type: function gen_tree
+ * ----------------------------------
+ * Creates a directory tree under dir with spec->depth levels of
+ * spec->fanout subdirectories and spec->files empty files in every
+ * directory. Names mix case and punctuation so myls sorting does real
+ * work. Returns the number of entries created.
+ */
+static size_t gen_tree(const char *dir, const tree_spec *spec, int level, uint64_t *seed)
+{
+    static const char *const stems[] = {"Alpha", "beta", "Gamma_", "delta", "eps.ilon", "Zeta", "eta-", "theta"};
+    char path[PATH_MAX];
+    size_t count = 0;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) error(1, errno, "cannot create '%s'", dir);
+    for (int i = 0; i < spec->files; i++) {
+        snprintf(path, sizeof(path), "%s/%s%llu.dat", dir, stems[next_rand(seed) % 8], (unsigned long long)(next_rand(seed) % 100000));
+        int fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) error(1, errno, "cannot create '%s'", path);
+        close(fd);
+        count++;
+    }
+    if (level == spec->depth) return count;
+    for (int i = 0; i < spec->fanout; i++) {
+        snprintf(path, sizeof(path), "%s/%s%d", dir, stems[next_rand(seed) % 8], i);
+        count += 1 + gen_tree(path, spec, level + 1, seed);
+    }
+    return count;
+}
+
+/* Type: function gen_path
+ * ----------------------------------
+ * Creates ndirs directories of nfiles executables under dir, stores
+ * the matching PATH in searchpath, and writes nnames command names to
+ * names_path, about 70% of which exist somewhere on that PATH.
+ */
+static size_t gen_path(const char *dir, int ndirs, int nfiles, size_t nnames, const char *names_path,
+                       char *searchpath, size_t pathcap, uint64_t seed)
+{
+    char path[PATH_MAX];
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) error(1, errno, "cannot create '%s'", dir);
+    searchpath[0] = '\0';
+    size_t used = 0;
+    for (int d = 0; d < ndirs; d++) {
+        snprintf(path, sizeof(path), "%s/bin%03d", dir, d);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) error(1, errno, "cannot create '%s'", path);
+        used += snprintf(searchpath + used, pathcap - used, "%s%s", d ? ":" : "", path);
+        if (used >= pathcap) error(1, 0, "generated PATH too long");
+        for (int f = 0; f < nfiles; f++) {
+            snprintf(path, sizeof(path), "%s/bin%03d/cmd%05d", dir, d, (d * 7919 + f * 104729) % 100000);
+            int fd = open(path, O_WRONLY | O_CREAT, 0755);
+            if (fd < 0) error(1, errno, "cannot create '%s'", path);
+            close(fd);
+        }
+    }
+    FILE *fp = open_output(names_path);
+    size_t bytes = 0;
+    for (size_t i = 0; i < nnames; i++) {
+        uint64_t r = next_rand(&seed);
+        if (r % 10 < 7) {
+            int d = r / 10 % ndirs, f = r / 1000 % nfiles;
+            bytes += fprintf(fp, "cmd%05d\n", (d * 7919 + f * 104729) % 100000);
+        } else {
+            bytes += fprintf(fp, "missing%llu\n", (unsigned long long)(r % 1000000));
+        }
+    }
+    fclose(fp);
+    return bytes;
+}
+
+static void dataset_path(const bench_ctx *ctx, dataset_id id, char *path)
+{
+    snprintf(path, PATH_MAX, "%s/%s", ctx->workdir, dataset_names[id]);
+}
+
+/* Type: function write_file
+ * ----------------------------------
+ * Writes len bytes to a new file at path.
+ */
+static void write_file(const char *path, const void *data, size_t len)
+{
+    FILE *fp = open_output(path);
+    if (fwrite(data, 1, len, fp) != len) error(1, errno, "cannot write '%s'", path);
+    fclose(fp);
+}
+
+/* Type: function ensure_dataset
+ * ----------------------------------
+ * Generates dataset id in the work directory the first time a case
+ * needs it, and returns its size in bytes (entries for the tree).
+ */
+static size_t ensure_dataset(bench_ctx *ctx, dataset_id id)
+{
+    if (id == DATA_NONE || ctx->made[id]) return ctx->data_size[id];
+    char path[PATH_MAX];
+    dataset_path(ctx, id, path);
+    size_t size = 0;
+    if (id == DATA_LINES) {
+        line_spec spec = {scaled(ctx, 1000000), 8, 64, scaled(ctx, 100000), 20};
+        size = gen_lines(path, &spec, 1);
+    } else if (id == DATA_NUMBERS) {
+        size = gen_numbers(path, scaled(ctx, 1000000), 2);
+    } else if (id == DATA_UTF16) {
+        size_t n = scaled(ctx, 1 << 24);
+        uint16_t *units = malloc(n * sizeof(uint16_t));
+        assert(units);
+        gen_utf16(units, n, 3);
+        write_file(path, units, n * sizeof(uint16_t));
+        free(units);
+        size = n * sizeof(uint16_t);
+    } else if (id == DATA_PAIRS || id == DATA_PAIRS_BIN) {
+        size_t n = 2 * scaled(ctx, 2000000);
+        long *ops = malloc(n * sizeof(long));
+        assert(ops);
+        gen_pairs(ops, n, 4);
+        if (id == DATA_PAIRS_BIN) {
+            write_file(path, ops, n * sizeof(long));
+            size = n * sizeof(long);
+        } else {
+            FILE *fp = open_output(path);
+            for (size_t i = 0; i < n; i += 2) size += fprintf(fp, "%ld %ld\n", ops[i], ops[i + 1]);
+            fclose(fp);
+        }
+        free(ops);
+    } else if (id == DATA_TREE) {
+        tree_spec spec = {5, 5, (int)scaled(ctx, 10)};
+        uint64_t seed = 5;
+        size = gen_tree(path, &spec, 0, &seed);
+    } else if (id == DATA_NAMES) {
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s/path", ctx->workdir);
+        size = gen_path(dir, 64, (int)scaled(ctx, 200), 2000, path, ctx->searchpath, sizeof(ctx->searchpath), 6);
+    }
+    ctx->made[id] = true;
+    ctx->data_size[id] = size;
+    return size;
+}
+
+/* Type: function read_whole
+ * ----------------------------------
+ * Reads a dataset into a null-terminated heap buffer.
+ */
+static char *read_whole(bench_ctx *ctx, dataset_id id, size_t *len)
+{
+    char path[PATH_MAX];
+    *len = ensure_dataset(ctx, id);
+    dataset_path(ctx, id, path);
+    char *buf = malloc(*len + 1);
+    assert(buf);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL || fread(buf, 1, *len, fp) != *len) error(1, errno, "cannot read '%s'", path);
+    fclose(fp);
+    buf[*len] = '\0';
+    return buf;
+}
+
+// ------- Library cases -------
+
+// State shared by the library cases; each setup fills in what it needs.
+typedef struct {
+    bench_ctx *ctx;
+    size_t param;
+    dataset_id data;
+    char path[PATH_MAX];
+    char *text;
+    size_t len;
+    void *in, *out, *extra;
+    size_t n;
+    volatile size_t sink; // Keeps results live so loops are not optimized away
+} lib_state;
+
+typedef struct {
+    const char *name;
+    size_t param; // Size or width the case is run at
+    dataset_id data; // File the setup reads, made before the case forks; DATA_NONE if none
+    double (*setup)(lib_state *s); // Returns units of work per trial
+    void (*run)(lib_state *s);
+    const char *unit;
+} lib_case;
+
+static double setup_lines_file(lib_state *s)
+{
+    dataset_path(s->ctx, s->data, s->path);
+    return ensure_dataset(s->ctx, s->data);
+}
+
+static FILE *open_input(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) error(1, errno, "cannot open '%s'", path);
+    return fp;
+}
+
+static void run_read_line(lib_state *s)
+{
+    FILE *fp = open_input(s->path);
+    char *line;
+    size_t n = 0;
+    while ((line = read_line(fp)) != NULL) {
+        n++;
+        free(line);
+    }
+    fclose(fp);
+    s->sink = n;
+}
+
+static void run_line_reader(lib_state *s)
+{
+    FILE *fp = open_input(s->path);
+    line_reader r;
+    line_view view;
+    size_t n = 0;
+    reader_init(&r, fp);
+    while (reader_next(&r, &view)) n += view.len;
+    reader_dispose(&r);
+    fclose(fp);
+    s->sink = n;
+}
+
+static void run_batch_reader(lib_state *s)
+{
+    FILE *fp = open_input(s->path);
+    batch_reader r;
+    line_batch *b;
+    size_t n = 0;
+    batch_reader_init(&r, fp);
+    while ((b = batch_reader_next(&r)) != NULL) {
+        for (size_t i = 0; i < b->nlines; i++) n += b->lines[i].len;
+        batch_reader_release(&r, b);
+    }
+    batch_reader_dispose(&r);
+    fclose(fp);
+    s->sink = n;
+}
+
+static double setup_text(lib_state *s)
+{
+    s->text = read_whole(s->ctx, s->data, &s->len);
+    return s->len;
+}
+
+static void run_scan_token(lib_state *s)
+{
+    const char *p = s->text;
+    char buf[128];
+    size_t n = 0;
+    while (scan_token(&p, " \n", buf, sizeof(buf))) n++;
+    s->sink = n;
+}
+
+static void run_next_token(lib_state *s)
+{
+    const char *p = s->text;
+    delim_set set;
+    token_view token;
+    size_t n = 0;
+    delim_set_init(&set, " \n");
+    while (next_token(&p, &set, &token)) n += token.len;
+    s->sink = n;
+}
+
+static void run_tokenize_all(lib_state *s)
+{
+    delim_set set;
+    delim_set_init(&set, " \n");
+    if (s->out == NULL) { // First call sizes the token array
+        s->n = tokenize_all(s->text, &set, NULL, 0);
+        s->out = malloc((s->n + 1) * sizeof(token_view));
+        assert(s->out);
+    }
+    s->sink = tokenize_all(s->text, &set, s->out, s->n);
+}
+
+static int cmp_long(const void *p, const void *q)
+{
+    long a = *(const long *)p, b = *(const long *)q;
+    return (a > b) - (a < b);
+}
+
+/* Type: function setup_keys
+ * ----------------------------------
+ * param random long keys for the set cases, plus the same keys sorted
+ * for bsearch and bulk loading.
+ */
+static double setup_keys(lib_state *s)
+{
+    uint64_t seed = 7;
+    s->n = s->param;
+    long *keys = malloc(s->n * sizeof(long));
+    long *sorted = malloc(s->n * sizeof(long));
+    assert(keys && sorted);
+    for (size_t i = 0; i < s->n; i++) keys[i] = sorted[i] = next_rand(&seed) >> 2;
+    qsort(sorted, s->n, sizeof(long), cmp_long);
+    s->in = keys;
+    s->out = sorted;
+    return s->n;
+}
+
+/* Type: function setup_eytz_keys
+ * ----------------------------------
+ * setup_keys, with the sorted keys also frozen into Eytzinger order.
+ * Kept apart so the large insert cases don't hold a third copy.
+ */
+static double setup_eytz_keys(lib_state *s)
+{
+    setup_keys(s);
+    eytz_set *e = malloc(sizeof(eytz_set));
+    assert(e);
+    eytz_freeze(e, s->out, s->n, sizeof(long));
+    s->extra = e;
+    return s->n;
+}
+
+static void run_binsert(lib_state *s)
+{
+    long *arr = malloc(s->n * sizeof(long));
+    assert(arr);
+    size_t nelem = 0;
+    const long *keys = s->in;
+    for (size_t i = 0; i < s->n; i++) binsert(&keys[i], arr, &nelem, sizeof(long), cmp_long);
+    s->sink = nelem;
+    free(arr);
+}
+
+static void run_oset_insert(lib_state *s)
+{
+    oset set;
+    oset_init(&set, sizeof(long), cmp_long);
+    const long *keys = s->in;
+    for (size_t i = 0; i < s->n; i++) oset_insert(&set, &keys[i], NULL);
+    s->sink = set.nelem;
+    oset_dispose(&set);
+}
+
+static void run_oset_bulk_load(lib_state *s)
+{
+    oset set;
+    oset_init(&set, sizeof(long), cmp_long);
+    oset_bulk_load(&set, s->out, s->n);
+    s->sink = set.nelem;
+    oset_dispose(&set);
+}
+
+static void run_bsearch(lib_state *s)
+{
+    const long *keys = s->in;
+    size_t hits = 0;
+    for (size_t i = 0; i < s->n; i++) hits += bsearch(&keys[i], s->out, s->n, sizeof(long), cmp_long) != NULL;
+    s->sink = hits;
+}
+
+static void run_eytz_find(lib_state *s)
+{
+    const long *keys = s->in;
+    size_t hits = 0;
+    for (size_t i = 0; i < s->n; i++) hits += eytz_find_long(s->extra, keys[i]) != NULL;
+    s->sink = hits;
+}
+
+/* Type: function setup_sort
+ * ----------------------------------
+ * Splits the line dataset, or the number dataset for the numeric
+ * order, into an array of lines; param is the sort_order. Each trial
+ * sorts a fresh copy of the array.
+ */
+static double setup_sort(lib_state *s)
+{
+    s->text = read_whole(s->ctx, s->data, &s->len);
+    size_t cap = 1024;
+    line_view *lines = malloc(cap * sizeof(line_view));
+    assert(lines);
+    for (char *p = s->text, *nl; (nl = memchr(p, '\n', s->text + s->len - p)) != NULL; p = nl + 1) {
+        if (s->n == cap) {
+            cap *= 2;
+            lines = realloc(lines, cap * sizeof(line_view));
+            assert(lines);
+        }
+        *nl = '\0';
+        lines[s->n++] = (line_view){p, nl - p};
+    }
+    s->in = lines;
+    s->out = malloc(s->n * sizeof(line_view) + 1);
+    assert(s->out);
+    return s->n;
+}
+
+static void run_sort_qsort(lib_state *s)
+{
+    static int (*const cmps[NSORT_ORDERS])(const void *, const void *) = {cmp_pstr, cmp_pstr_len, cmp_pstr_numeric};
+    memcpy(s->out, s->in, s->n * sizeof(line_view));
+    qsort(s->out, s->n, sizeof(line_view), cmps[s->param]);
+    s->sink = (size_t)((line_view *)s->out)[0].ptr;
+}
+
+static void run_line_sort(lib_state *s)
+{
+    memcpy(s->out, s->in, s->n * sizeof(line_view));
+    line_sort(s->out, s->n, s->param);
+    s->sink = (size_t)((line_view *)s->out)[0].ptr;
+}
+
+/* Type: function run_fused_top
+ * ----------------------------------
+ * The in-process counterpart of the pipeline/shell case: reads the
+ * line file, sorts it, counts runs and writes the param most frequent
+ * lines to /dev/null, all through the filter library.
+ */
+static void run_fused_top(lib_state *s)
+{
+    FILE *fp = open_input(s->path);
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0) error(1, errno, "cannot open /dev/null");
+    line_set set;
+    writer out;
+    line_set_read(&set, fp);
+    writer_init(&out, fd);
+    filter_sort_count_top(set.lines, set.nlines, s->param, writer_count_sink(&out));
+    writer_flush(&out);
+    writer_dispose(&out);
+    s->sink = set.nlines;
+    line_set_dispose(&set);
+    close(fd);
+    fclose(fp);
+}
+
+static double setup_utf16(lib_state *s)
+{
+    s->n = scaled(s->ctx, 1 << 24);
+    s->in = malloc(s->n * sizeof(uint16_t));
+    s->out = malloc(UTF8_MAX_FROM_UTF16(s->n) + 4);
+    assert(s->in && s->out);
+    gen_utf16(s->in, s->n, 3);
+    return s->n * sizeof(uint16_t);
+}
+
+/* Type: function run_to_utf8_loop
+ * ----------------------------------
+ * Baseline: one to_utf8 call per unit. to_utf8 has no surrogate
+ * handling, so pairs are encoded unit by unit; only speed matters here.
+ */
+static void run_to_utf8_loop(lib_state *s)
+{
+    const uint16_t *units = s->in;
+    unsigned char *out = s->out;
+    size_t len = 0;
+    for (size_t i = 0; i < s->n; i++) len += to_utf8(units[i], out + len);
+    s->sink = len;
+}
+
+static void run_utf16_scalar(lib_state *s)
+{
+    s->sink = utf16_to_utf8_scalar(s->in, s->n, s->out).nwritten;
+}
+
+static void run_utf16(lib_state *s)
+{
+    s->sink = utf16_to_utf8(s->in, s->n, s->out).nwritten;
+}
+
+static double setup_utf8(lib_state *s)
+{
+    setup_utf16(s);
+    unsigned char *bytes = s->out;
+    s->len = utf16_to_utf8(s->in, s->n, bytes).nwritten;
+    free(s->in);
+    s->in = bytes;
+    s->out = malloc(s->len * sizeof(uint32_t));
+    assert(s->out);
+    return s->len;
+}
+
+static void run_utf8_validate_scalar(lib_state *s)
+{
+    int status;
+    s->sink = utf8_validate_scalar(s->in, s->len, &status);
+}
+
+static void run_utf8_validate(lib_state *s)
+{
+    int status;
+    s->sink = utf8_validate(s->in, s->len, &status);
+}
+
+static void run_utf8_decode(lib_state *s)
+{
+    s->sink = utf8_decode(s->in, s->len, s->out).nwritten;
+}
+
+/* Type: function setup_sat
+ * ----------------------------------
+ * Two operand arrays of longs for 32-bit saturating arithmetic, an
+ * output array, and starting accumulators for the multiply-accumulate
+ * cases, plus narrowed int16_t copies of all of it for the fixed-width
+ * kernels.
+ */
+static double setup_sat(lib_state *s)
+{
+    s->n = scaled(s->ctx, 4000000);
+    long *ops = malloc(4 * s->n * sizeof(long));
+    int16_t *narrow = malloc(4 * s->n * sizeof(int16_t));
+    assert(ops && narrow);
+    gen_pairs(ops, 2 * s->n, 4);
+    gen_pairs(ops + 3 * s->n, s->n, 5);
+    for (size_t i = 0; i < 4 * s->n; i++) narrow[i] = ops[i] >> 16; // The output quarter is overwritten anyway
+    s->in = ops;
+    s->extra = narrow;
+    return s->n;
+}
+
+static void run_sat_add_loop(lib_state *s)
+{
+    long *a = s->in, *b = a + s->n, *out = b + s->n;
+    for (size_t i = 0; i < s->n; i++) out[i] = sat_add(a[i], b[i], s->param);
+    s->sink = out[s->n - 1];
+}
+
+static void run_sat_add_long(lib_state *s)
+{
+    long *a = s->in, *b = a + s->n, *out = b + s->n;
+    sat_add_long(a, b, out, s->n, s->param);
+    s->sink = out[s->n - 1];
+}
+
+/* Type: function run_sat_mac_long
+ * ----------------------------------
+ * Copies in the starting accumulators first, so every trial does the
+ * same work instead of running on lanes earlier trials saturated. The
+ * copy is timed with it.
+ */
+static void run_sat_mac_long(lib_state *s)
+{
+    long *a = s->in, *b = a + s->n, *acc = b + s->n;
+    memcpy(acc, acc + s->n, s->n * sizeof(long));
+    sat_mac_long(acc, a, b, s->n, s->param);
+    s->sink = acc[s->n - 1];
+}
+
+static void run_sat_add_i16(lib_state *s)
+{
+    int16_t *a = s->extra, *b = a + s->n, *out = b + s->n;
+    sat_add_i16(a, b, out, s->n);
+    s->sink = out[s->n - 1];
+}
+
+static void run_sat_mac_i16(lib_state *s)
+{
+    int16_t *a = s->extra, *b = a + s->n, *acc = b + s->n;
+    memcpy(acc, acc + s->n, s->n * sizeof(int16_t)); // Fresh accumulators, as in run_sat_mac_long
+    sat_mac_i16(acc, a, b, s->n);
+    s->sink = acc[s->n - 1];
+}
+
+#ifdef BENCH_ALLOCATOR
+#define ALLOC_HEAP_SIZE (1L << 30)
+#define ALLOC_LIVE 4096 // Slots in the working set of live blocks
+
+/* Type: function churn
+ * ----------------------------------
+ * Replays a fixed random mix of malloc, free and realloc over a
+ * working set of live blocks, mostly small with an occasional large
+ * one. A failed realloc leaves the block where it was.
+ */
+static void churn(lib_state *s, void *(*alloc)(size_t), void (*release)(void *),
+                  void *(*resize)(void *, size_t))
+{
+    void *live[ALLOC_LIVE] = {NULL};
+    uint64_t seed = 8;
+    for (size_t i = 0; i < s->n; i++) {
+        uint64_t r = next_rand(&seed);
+        size_t slot = r % ALLOC_LIVE;
+        size_t size = (r >> 20) % 100 < 95 ? 8 + (r >> 32) % 120 : 1024 + (r >> 32) % 16384;
+        if (live[slot] == NULL) live[slot] = alloc(size);
+        else if ((r >> 12) % 4 == 0) {
+            void *p = resize(live[slot], size);
+            if (p != NULL) live[slot] = p;
+        } else {
+            release(live[slot]);
+            live[slot] = NULL;
+        }
+    }
+    s->sink = (size_t)live[0];
+}
+
+static void run_alloc_churn(lib_state *s)
+{
+    if (!myinit(s->in, ALLOC_HEAP_SIZE)) error(1, 0, "myinit failed");
+    churn(s, mymalloc, myfree, myrealloc);
+}
+
+#ifdef BENCH_SLAB
+static void run_slab_churn(lib_state *s)
+{
+    if (!myinit(s->in, ALLOC_HEAP_SIZE) || !slab_init(s->in, ALLOC_HEAP_SIZE)) error(1, 0, "myinit failed");
+    churn(s, slab_malloc, slab_free, slab_realloc);
+}
+#endif
+
+static double setup_alloc(lib_state *s)
+{
+    s->n = scaled(s->ctx, 2000000);
+    s->in = malloc(ALLOC_HEAP_SIZE);
+    assert(s->in);
+    return s->n;
+}
+#endif
+
+static const lib_case lib_cases[] = {
+    {"lines/read_line", 0, DATA_LINES, setup_lines_file, run_read_line, "bytes"},
+    {"lines/line_reader", 0, DATA_LINES, setup_lines_file, run_line_reader, "bytes"},
+    {"lines/batch_reader", 0, DATA_LINES, setup_lines_file, run_batch_reader, "bytes"},
+    {"tokens/scan_token", 0, DATA_LINES, setup_text, run_scan_token, "bytes"},
+    {"tokens/next_token", 0, DATA_LINES, setup_text, run_next_token, "bytes"},
+    {"tokens/tokenize_all", 0, DATA_LINES, setup_text, run_tokenize_all, "bytes"},
+    // binsert shifts the tail of the array on every insert, O(n^2) in
+    // all, so it stops at 100k, already a few hundred ms; 10m would take hours
+    {"set/binsert-1k", 1000, DATA_NONE, setup_keys, run_binsert, "items"},
+    {"set/binsert-100k", 100000, DATA_NONE, setup_keys, run_binsert, "items"},
+    {"set/oset_insert-1k", 1000, DATA_NONE, setup_keys, run_oset_insert, "items"},
+    {"set/oset_insert-100k", 100000, DATA_NONE, setup_keys, run_oset_insert, "items"},
+    {"set/oset_insert-10m", 10000000, DATA_NONE, setup_keys, run_oset_insert, "items"},
+    {"set/oset_insert-100m", 100000000, DATA_NONE, setup_keys, run_oset_insert, "items"},
+    {"set/oset_bulk_load-10m", 10000000, DATA_NONE, setup_keys, run_oset_bulk_load, "items"},
+    {"set/oset_bulk_load-100m", 100000000, DATA_NONE, setup_keys, run_oset_bulk_load, "items"},
+    {"set/bsearch-1m", 1000000, DATA_NONE, setup_keys, run_bsearch, "items"},
+    {"set/eytz_find-1m", 1000000, DATA_NONE, setup_eytz_keys, run_eytz_find, "items"},
+    {"sort/qsort-lex", SORT_LEX, DATA_LINES, setup_sort, run_sort_qsort, "items"},
+    {"sort/line_sort-lex", SORT_LEX, DATA_LINES, setup_sort, run_line_sort, "items"},
+    {"sort/qsort-length", SORT_LENGTH, DATA_LINES, setup_sort, run_sort_qsort, "items"},
+    {"sort/line_sort-length", SORT_LENGTH, DATA_LINES, setup_sort, run_line_sort, "items"},
+    {"sort/qsort-numeric", SORT_NUMERIC, DATA_NUMBERS, setup_sort, run_sort_qsort, "items"},
+    {"sort/line_sort-numeric", SORT_NUMERIC, DATA_NUMBERS, setup_sort, run_line_sort, "items"},
+    {"pipeline/fused-top10", 10, DATA_LINES, setup_lines_file, run_fused_top, "bytes"},
+    {"utf16/to_utf8-loop", 0, DATA_NONE, setup_utf16, run_to_utf8_loop, "bytes"},
+    {"utf16/scalar", 0, DATA_NONE, setup_utf16, run_utf16_scalar, "bytes"},
+    {"utf16/dispatch", 0, DATA_NONE, setup_utf16, run_utf16, "bytes"},
+    {"utf8/validate-scalar", 0, DATA_NONE, setup_utf8, run_utf8_validate_scalar, "bytes"},
+    {"utf8/validate", 0, DATA_NONE, setup_utf8, run_utf8_validate, "bytes"},
+    {"utf8/decode", 0, DATA_NONE, setup_utf8, run_utf8_decode, "bytes"},
+    {"sat/sat_add-loop-32", 32, DATA_NONE, setup_sat, run_sat_add_loop, "items"},
+    {"sat/add_long-32", 32, DATA_NONE, setup_sat, run_sat_add_long, "items"},
+    {"sat/add_long-64", 64, DATA_NONE, setup_sat, run_sat_add_long, "items"},
+    {"sat/mac_long-32", 32, DATA_NONE, setup_sat, run_sat_mac_long, "items"},
+    {"sat/add_i16", 16, DATA_NONE, setup_sat, run_sat_add_i16, "items"},
+    {"sat/mac_i16", 16, DATA_NONE, setup_sat, run_sat_mac_i16, "items"},
+#ifdef BENCH_ALLOCATOR
+    {"alloc/churn", 0, DATA_NONE, setup_alloc, run_alloc_churn, "items"},
+#ifdef BENCH_SLAB
+    {"alloc/slab-churn", 0, DATA_NONE, setup_alloc, run_slab_churn, "items"},
+#endif
+#endif
+};
+
+/* Type: function run_lib_case
+ * ----------------------------------
+ * Runs a library case in a forked child so its peak RSS is its own:
+ * the child sets up, runs the warmup and timed trials and sends the
+ * work size and trial times back through a pipe. ru_maxrss of the
+ * child is reported, inputs included. The case's dataset is made here
+ * first, since a file the child generated would not be recorded in the
+ * parent's ctx and every later case would generate it again.
+ */
+static void run_lib_case(bench_ctx *ctx, const lib_case *c, case_result *res)
+{
+    ensure_dataset(ctx, c->data);
+    int fds[2];
+    if (pipe(fds) != 0) error(1, errno, "pipe failed");
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) error(1, errno, "fork failed");
+    if (pid == 0) {
+        close(fds[0]);
+        lib_state s = {0};
+        s.ctx = ctx;
+        s.param = c->param;
+        s.data = c->data;
+        if (ctx->scale != 1.0 && c->param >= 1000 && (c->setup == setup_keys || c->setup == setup_eytz_keys)) s.param = scaled(ctx, c->param);
+        double work = c->setup(&s);
+        if (write(fds[1], &work, sizeof(work)) != sizeof(work)) _exit(1);
+        for (int i = 0; i < ctx->warmup; i++) c->run(&s);
+        for (int i = 0; i < ctx->trials; i++) {
+            double start = now_seconds();
+            c->run(&s);
+            double elapsed = now_seconds() - start;
+            if (write(fds[1], &elapsed, sizeof(elapsed)) != sizeof(elapsed)) _exit(1);
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    FILE *fp = fdopen(fds[0], "r");
+    assert(fp);
+    if (fread(&res->work, sizeof(double), 1, fp) == 1) {
+        res->ntimes = fread(res->times, sizeof(double), ctx->trials, fp);
+    }
+    fclose(fp);
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    res->peak_rss_kb = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || res->ntimes != ctx->trials) res->failure = "case exited abnormally";
+}
+
+// ------- Tool cases -------
+
+// INPUT_SHELL runs args[0] as a /bin/sh script with the tool directory
+// as $1 and the dataset as $2; tool names the binary that must exist.
+typedef enum { INPUT_STDIN, INPUT_ARG, INPUT_NAMES_AS_ARGS, INPUT_SHELL } input_mode;
+
+typedef struct {
+    const char *name;
+    const char *tool;
+    const char *args[MAX_TOOL_ARGS];
+    dataset_id data;
+    input_mode mode;
+    int cpus; // Pin to this many CPUs; 0 for no limit
+    const char *unit;
+} tool_case;
+
+static const tool_case tool_cases[] = {
+    {"mysort/default", "mysort", {NULL}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"mysort/length", "mysort", {"-l"}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"mysort/numeric", "mysort", {"-n"}, DATA_NUMBERS, INPUT_ARG, 0, "bytes"},
+    {"mysort/unique", "mysort", {"-u"}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"mysort/reverse", "mysort", {"-r"}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"myuniq/adjacent", "myuniq", {NULL}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"myuniq/parallel-8", "myuniq", {"-j", "8"}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"myuniq/count-all", "myuniq", {"-c"}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"myuniq/top-10", "myuniq", {"-c", "-k", "10"}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"mytail/last-10", "mytail", {"-10"}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"mytail/last-100000", "mytail", {"-100000"}, DATA_LINES, INPUT_ARG, 0, "bytes"},
+    {"mytail/stdin", "mytail", {"-10"}, DATA_LINES, INPUT_STDIN, 0, "bytes"},
+    {"pipeline/shell-top10", "mysort", {"\"$1/mysort\" \"$2\" | \"$1/myuniq\" | \"$1/mysort\" -n | \"$1/mytail\" -10"}, DATA_LINES, INPUT_SHELL, 0, "bytes"},
+    {"myls/recursive-cpu1", "myls", {"-R"}, DATA_TREE, INPUT_ARG, 1, "entries"},
+    {"myls/recursive-cpu2", "myls", {"-R"}, DATA_TREE, INPUT_ARG, 2, "entries"},
+    {"myls/recursive-cpu4", "myls", {"-R"}, DATA_TREE, INPUT_ARG, 4, "entries"},
+    {"myls/recursive-cpu8", "myls", {"-R"}, DATA_TREE, INPUT_ARG, 8, "entries"},
+    {"myls/recursive", "myls", {"-R"}, DATA_TREE, INPUT_ARG, 0, "entries"},
+    {"myls/recursive-long", "myls", {"-Rl"}, DATA_TREE, INPUT_ARG, 0, "entries"},
+    {"mywhich/no-cache", "mywhich", {"--no-cache"}, DATA_NAMES, INPUT_NAMES_AS_ARGS, 0, "names"},
+    {"mywhich/cached", "mywhich", {NULL}, DATA_NAMES, INPUT_NAMES_AS_ARGS, 0, "names"},
+    {"mywhich/batch", "mywhich", {"--batch"}, DATA_NAMES, INPUT_STDIN, 0, "names"},
+    {"utf8/stream", "utf8", {"--stream"}, DATA_UTF16, INPUT_STDIN, 0, "bytes"},
+    {"sat/stream-text", "sat", {"--stream", "32"}, DATA_PAIRS, INPUT_STDIN, 0, "bytes"},
+    {"sat/stream-binary", "sat", {"--stream", "--binary", "32"}, DATA_PAIRS_BIN, INPUT_STDIN, 0, "bytes"},
+};
+
+/* Type: function load_names
+ * ----------------------------------
+ * Reads up to max names from the names dataset into argv slots for the
+ * mywhich argument cases. Returns how many were stored.
+ */
+static int load_names(bench_ctx *ctx, char **slots, int max)
+{
+    char path[PATH_MAX];
+    dataset_path(ctx, DATA_NAMES, path);
+    FILE *fp = open_input(path);
+    char *line;
+    int n = 0;
+    while (n < max && (line = read_line(fp)) != NULL) slots[n++] = line;
+    while (n == max && (line = read_line(fp)) != NULL) free(line); // Drain so read_line releases its reader
+    fclose(fp);
+    return n;
+}
+
+/* Type: function spawn_tool
+ * ----------------------------------
+ * Runs argv[0] once with stdin from in_path (or /dev/null) and stdout
+ * discarded, optionally pinned to the first cpus CPUs. Returns the wall
+ * time in seconds, or a negative value if the tool failed, and raises
+ * *peak_rss_kb to the child's peak RSS.
+ */
+static double spawn_tool(char **argv, const char *in_path, int cpus, const char *searchpath, long *peak_rss_kb)
+{
+    double start = now_seconds();
+    pid_t pid = fork();
+    if (pid < 0) error(1, errno, "fork failed");
+    if (pid == 0) {
+        int in = open(in_path ? in_path : "/dev/null", O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0) _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        if (cpus > 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int i = 0; i < cpus && i < CPU_SETSIZE; i++) CPU_SET(i, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+        if (searchpath[0] != '\0') setenv("MYPATH", searchpath, 1);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    double elapsed = now_seconds() - start;
+    if (usage.ru_maxrss > *peak_rss_kb) *peak_rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? elapsed : -1;
+}
+
+/* Type: function run_tool_case
+ * ----------------------------------
+ * Builds the command line for a tool case, runs the warmup and timed
+ * trials, and records wall times and the largest peak RSS seen.
+ */
+static void run_tool_case(bench_ctx *ctx, const tool_case *c, case_result *res)
+{
+    char exe[PATH_MAX], data[PATH_MAX], cache[PATH_MAX];
+    snprintf(exe, sizeof(exe), "%s/%s", ctx->bindir, c->tool);
+    if (access(exe, X_OK) != 0) {
+        res->failure = "tool not built";
+        return;
+    }
+    if (c->cpus > 0 && sysconf(_SC_NPROCESSORS_ONLN) < c->cpus) {
+        res->failure = "not enough CPUs";
+        return;
+    }
+    size_t size = ensure_dataset(ctx, c->data);
+    dataset_path(ctx, c->data, data);
+    char *argv[MAX_TOOL_ARGS + MAX_NAME_ARGS + 2];
+    int argc = 0;
+    argv[argc++] = exe;
+    for (int i = 0; i < MAX_TOOL_ARGS && c->args[i] != NULL; i++) argv[argc++] = (char *)c->args[i];
+    int nnames = 0;
+    const char *in_path = NULL;
+    if (c->mode == INPUT_SHELL) {
+        argv[0] = "/bin/sh";
+        argv[1] = "-c";
+        argv[2] = (char *)c->args[0];
+        argv[3] = "sh";
+        argv[4] = (char *)ctx->bindir;
+        argv[5] = data;
+        argc = 6;
+    } else if (c->mode == INPUT_ARG) {
+        argv[argc++] = data;
+    } else if (c->mode == INPUT_STDIN) {
+        in_path = data;
+    } else {
+        nnames = load_names(ctx, argv + argc, MAX_NAME_ARGS);
+        argc += nnames;
+    }
+    argv[argc] = NULL;
+    res->work = size;
+    if (c->data == DATA_NAMES) res->work = c->mode == INPUT_NAMES_AS_ARGS ? nnames : 2000;
+    snprintf(cache, sizeof(cache), "%s/mywhich.idx", ctx->workdir);
+    setenv("MYWHICH_CACHE", cache, 1); // Keep the user's own cache out of it
+    const char *searchpath = c->data == DATA_NAMES ? ctx->searchpath : "";
+    for (int i = 0; i < ctx->warmup + ctx->trials; i++) {
+        double t = spawn_tool(argv, in_path, c->cpus, searchpath, &res->peak_rss_kb);
+        if (t < 0) {
+            res->failure = "tool exited with an error";
+            break;
+        }
+        if (i >= ctx->warmup) res->times[res->ntimes++] = t;
+    }
+    for (int i = 0; i < nnames; i++) free(argv[argc - nnames + i]);
+}
+
+// ------- Reporting -------
+
+static int cmp_double(const void *p, const void *q)
+{
+    double a = *(const double *)p, b = *(const double *)q;
+    return (a > b) - (a < b);
+}
+
+/* Type: function print_result
+ * ----------------------------------
+ * Prints one case as a JSON object: median, p95 and min wall time in
+ * milliseconds, throughput in units per second at the median, and
+ * peak RSS in KiB. Failed or skipped cases carry a "skipped" reason.
+ */
+static void print_result(const char *name, const char *kind, const char *unit, case_result *res, bool first)
+{
+    printf("%s\n    {\"case\": \"%s\", \"kind\": \"%s\"", first ? "" : ",", name, kind);
+    if (res->failure != NULL || res->ntimes == 0) {
+        printf(", \"skipped\": \"%s\"}", res->failure ? res->failure : "no trials");
+        return;
+    }
+    qsort(res->times, res->ntimes, sizeof(double), cmp_double);
+    int n = res->ntimes;
+    double median = n % 2 ? res->times[n / 2] : (res->times[n / 2 - 1] + res->times[n / 2]) / 2;
+    int p95_index = (int)((n * 95 + 99) / 100) - 1; // Nearest-rank percentile
+    double p95 = res->times[p95_index < 0 ? 0 : p95_index];
+    printf(", \"trials\": %d, \"median_ms\": %.3f, \"p95_ms\": %.3f, \"min_ms\": %.3f", n, median * 1e3, p95 * 1e3, res->times[0] * 1e3);
+    printf(", \"work\": %.0f, \"unit\": \"%s\", \"per_second\": %.6g", res->work, unit, median > 0 ? res->work / median : 0);
+    printf(", \"peak_rss_kb\": %ld}", res->peak_rss_kb);
+}
+
+/* Type: function selected
+ * ----------------------------------
+ * True if name matches one of the filters (by prefix), or there are
+ * none.
+ */
+static bool selected(const char *name, char **filters, int nfilters)
+{
+    if (nfilters == 0) return true;
+    for (int i = 0; i < nfilters; i++) {
+        if (strncmp(name, filters[i], strlen(filters[i])) == 0) return true;
+    }
+    return false;
+}
+
+/* Type: function remove_tree
+ * ----------------------------------
+ * Deletes the generated work directory.
+ */
+static void remove_tree(const char *dir)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp("rm", "rm", "-rf", dir, (char *)NULL);
+        _exit(127);
+    }
+    if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+/* Type: function generate_only
+ * ----------------------------------
+ * `bench gen KIND OUT [args]`: writes a single dataset for use outside
+ * the suite. KIND is lines (nlines minlen maxlen cardinality dup%),
+ * tree (depth fanout files) or path (ndirs files nnames; the PATH is
+ * printed and the names go to OUT/names.txt).
+ */
+static int generate_only(int argc, char *argv[])
+{
+    if (argc < 2) error(1, 0, "Usage: bench gen lines|tree|path OUT [args]");
+    const char *kind = argv[0], *out = argv[1];
+    if (strcmp(kind, "lines") == 0 && argc == 7) {
+        line_spec spec = {convert_arg(argv[2]), convert_arg(argv[3]), convert_arg(argv[4]), convert_arg(argv[5]), convert_arg(argv[6])};
+        if (spec.min_len > spec.max_len || spec.cardinality == 0) error(1, 0, "need minlen <= maxlen and cardinality > 0");
+        printf("%zu\n", gen_lines(out, &spec, 1));
+    } else if (strcmp(kind, "tree") == 0 && argc == 5) {
+        tree_spec spec = {convert_arg(argv[2]), convert_arg(argv[3]), convert_arg(argv[4])};
+        uint64_t seed = 5;
+        printf("%zu\n", gen_tree(out, &spec, 0, &seed));
+    } else if (strcmp(kind, "path") == 0 && argc == 5) {
+        static char searchpath[PATH_MAX * 4];
+        char names[PATH_MAX];
+        int ndirs = convert_arg(argv[2]), nfiles = convert_arg(argv[3]);
+        if (ndirs == 0 || nfiles == 0) error(1, 0, "need at least one directory and one file");
+        snprintf(names, sizeof(names), "%s/names.txt", out);
+        if (mkdir(out, 0755) != 0 && errno != EEXIST) error(1, errno, "cannot create '%s'", out);
+        gen_path(out, ndirs, nfiles, convert_arg(argv[4]), names, searchpath, sizeof(searchpath), 6);
+        printf("%s\n", searchpath);
+    } else {
+        error(1, 0, "Usage: bench gen lines|tree|path OUT [args]");
+    }
+    return 0;
+}
+
+/*
+ * bench runs the benchmark suite. Options: -n trials (default 7),
+ * -w warmup runs (default 1), -s scale for dataset and input sizes
+ * (default 1), -b directory holding the built tools (default .),
+ * -d work directory for datasets (default a fresh one under /tmp,
+ * removed afterwards unless -k), -l to list the cases. Remaining
+ * arguments select cases by name prefix, such as "mysort" or "utf8/".
+ * Results go to stdout as one JSON document for before/after diffs.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "gen") == 0) return generate_only(argc - 2, argv + 2);
+    bench_ctx ctx = {0};
+    ctx.trials = 7;
+    ctx.warmup = 1;
+    ctx.scale = 1.0;
+    ctx.bindir = ".";
+    bool keep = false, list = false;
+    const char *workdir = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:s:b:d:kl")) != -1) {
+        switch (opt) {
+            case 'n': ctx.trials = convert_arg(optarg); break;
+            case 'w': ctx.warmup = convert_arg(optarg); break;
+            case 's': ctx.scale = strtod(optarg, NULL); break;
+            case 'b': ctx.bindir = optarg; break;
+            case 'd': workdir = optarg; keep = true; break;
+            case 'k': keep = true; break;
+            case 'l': list = true; break;
+            default: exit(1);
+        }
+    }
+    if (ctx.trials < 1 || ctx.trials > MAX_TRIALS) error(1, 0, "trials must be in range [1, %d]", MAX_TRIALS);
+    if (!(ctx.scale > 0)) error(1, 0, "scale must be positive");
+    char **filters = argv + optind;
+    int nfilters = argc - optind;
+    size_t nlib = sizeof(lib_cases) / sizeof(lib_cases[0]);
+    size_t ntool = sizeof(tool_cases) / sizeof(tool_cases[0]);
+    if (list) {
+        for (size_t i = 0; i < nlib; i++) printf("%s\n", lib_cases[i].name);
+        for (size_t i = 0; i < ntool; i++) printf("%s\n", tool_cases[i].name);
+        return 0;
+    }
+    if (workdir != NULL) {
+        if (mkdir(workdir, 0755) != 0 && errno != EEXIST) error(1, errno, "cannot create '%s'", workdir);
+        snprintf(ctx.workdir, sizeof(ctx.workdir), "%s", workdir);
+    } else {
+        snprintf(ctx.workdir, sizeof(ctx.workdir), "/tmp/bench.XXXXXX");
+        if (mkdtemp(ctx.workdir) == NULL) error(1, errno, "cannot create work directory");
+    }
+
+    printf("{\n  \"scale\": %g, \"trials\": %d, \"warmup\": %d, \"cpus\": %ld,", ctx.scale, ctx.trials, ctx.warmup, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("\n  \"kernels\": {\"utf16\": \"%s\", \"utf8\": \"%s\", \"sat\": \"%s\"},", utf16_kernel_name(), utf8_kernel_name(), sat_kernel_name());
+    printf("\n  \"results\": [");
+    bool first = true;
+    for (size_t i = 0; i < nlib; i++) {
+        if (!selected(lib_cases[i].name, filters, nfilters)) continue;
+        case_result *res = calloc(1, sizeof(case_result));
+        assert(res);
+        run_lib_case(&ctx, &lib_cases[i], res);
+        print_result(lib_cases[i].name, "library", lib_cases[i].unit, res, first);
+        first = false;
+        fflush(stdout);
+        free(res);
+    }
+    for (size_t i = 0; i < ntool; i++) {
+        if (!selected(tool_cases[i].name, filters, nfilters)) continue;
+        case_result *res = calloc(1, sizeof(case_result));
+        assert(res);
+        run_tool_case(&ctx, &tool_cases[i], res);
+        print_result(tool_cases[i].name, "tool", tool_cases[i].unit, res, first);
+        first = false;
+        fflush(stdout);
+        free(res);
+    }
+    printf("\n  ]\n}\n");
+    if (!keep) remove_tree(ctx.workdir);
+    return 0;
+}
@@ -1,14 +1,20 @@
 #include "allocator.h"
+#include "heap_check.h"
+#include "stats.h"
 
 #define ALIGNMENT 8
 #define MIN_SIZE_BLOCK 32 // sizeof(header) + sizeof(char *) * 2 + 8 byte payload
 
-static void *free_list, *heap_start;
+static void *free_list, *heap_start, *heap_end;
+static size_t nblocks, nfree; // Blocks before the end header, and how many are free
+static heap_touched touched;
+STATS_COUNTER(search_depth, "malloc search depth");
 
 typedef struct {
     unsigned int sz;	// size of memory block
     bool free;		    // in use or free?
     bool end;			// end header?
+    unsigned short canary; // HEAP_CANARY while the header is intact
 } header;
 
 typedef struct {
@@ -55,14 +61,19 @@ bool myinit(void *segment_start, size_t segment_size)
 	if (segment_size < MIN_SIZE_BLOCK) return false;
 	header *endhead = segment_start;
 	heap_start = segment_start;
+	heap_end = (char *)segment_start + rounddown(segment_size, ALIGNMENT);
     endhead->sz = rounddown(segment_size, ALIGNMENT) - (sizeof(header) * 3); // header * and two void *
     endhead->free = true;
     endhead->end = true;
+    endhead->canary = HEAP_CANARY;
     void *backnodeptr = (char *)segment_start + sizeof(header);
     node *backnode = backnodeptr;
     backnode->next = NULL;
     backnode->prev = NULL;
     free_list = endhead;
+    nblocks = nfree = 0;
+    touched = (heap_touched){0};
+    heap_touch(&touched, endhead);
     return true;
 }
 
@@ -78,6 +89,8 @@ void *mynewendheader(void *location, unsigned int size) {
 	newend->sz = ((header *)location)->sz - size;
 	newend->free = true;
 	newend->end = true;
+	newend->canary = HEAP_CANARY;
+	heap_touch(&touched, newend);
 	void *newnodeptr = (char *)newendptr + sizeof(header);
 	node *backnode = newnodeptr;
 	backnode->next = ((node *)((char *)location + sizeof(header)))->next;
@@ -96,6 +109,8 @@ void mynewheader(void *location, unsigned int size) {
 	newhead->sz = size;
 	newhead->free = false;
 	newhead->end = false;
+	newhead->canary = HEAP_CANARY;
+	heap_touch(&touched, newhead);
 }
 
 /* Type: function mymalloc
@@ -112,9 +127,14 @@ void *mymalloc(size_t requestedsz)
 	if (needed == 0 || needed > 0xFFFFFFFF) return NULL;
 	if (needed < MIN_SIZE_BLOCK) needed = MIN_SIZE_BLOCK;
 	void *traversal = free_list;
+	STATS_ONLY(uint64_t depth = 1;) // Free blocks examined, including the one chosen
 	while (true) {
-    	if (((header *)traversal)->sz < needed && ((header *)traversal)->end == true) return NULL; // Heap exhausted
+    	if (((header *)traversal)->sz < needed && ((header *)traversal)->end == true) { // Heap exhausted
+    		STATS_RECORD(search_depth, depth);
+    		return NULL;
+    	}
     	if (((header *)traversal)->sz >= needed && ((header *)traversal)->free == true) { // Found open block
+    		STATS_RECORD(search_depth, depth);
     		// Case 1: Available block is the end header
     		if (((header *)traversal)->end == true) {
     			free_list = mynewendheader(traversal, needed);
@@ -125,10 +145,13 @@ void *mymalloc(size_t requestedsz)
     			newendnode->next = oldendnode->next;
     			newendnode->prev = oldendnode->prev;
     			mynewheader(traversal, needed);
+    			nblocks++;
     			return oldendnodeptr;
     		}
             // Case 2: Regular block
     		((header *)traversal)->free = false;
+    		nfree--;
+    		heap_touch(&touched, traversal);
     		traversal = (char *)traversal + sizeof(header);
     		node *oldnode = traversal;
     		void *nextheader = oldnode->next;
@@ -136,12 +159,17 @@ void *mymalloc(size_t requestedsz)
     		node *nextnode = nextnodeptr;
     		nextnode->prev = oldnode->prev;
     		free_list = oldnode->next;
+    		heap_touch(&touched, free_list); // Its prev link changed
     		return traversal;
     	}
+    	// Blocks passed over drop out of the list once one further on is
+    	// taken, so their links are no longer checked
+    	heap_untouch(&touched, traversal, (char *)traversal + 1);
     	traversal = (char *)traversal + sizeof(header);
     	node *nextnode = traversal;
     	void *next = nextnode->next;
     	traversal = next;
+    	STATS_ONLY(depth++;)
     }
 }
 
@@ -156,6 +184,7 @@ void *mymalloc(size_t requestedsz)
 void myfree(void *ptr)
 {
 	void *blockhead = (char *)ptr - sizeof(header);
+	if (!((header *)blockhead)->free) nfree++;
 	((header *)blockhead)->free = true;
 	node *newnode = ptr;
 	newnode->next = free_list; // Point to the previous front of the list
@@ -163,7 +192,9 @@ void myfree(void *ptr)
 	void *endnodeptr = (char *)free_list + sizeof(header);
 	node *endnode = endnodeptr;
 	endnode->prev = blockhead;
+	heap_touch(&touched, free_list);
 	free_list = blockhead; // Add freed block to the front of the list
+	heap_touch(&touched, blockhead);
 }
 
 /* Type: function myrealloc
@@ -193,36 +224,91 @@ void *myrealloc(void *oldptr, size_t newsz)
 	return NULL;
 }
 
+/* Type: helper function header_ok
+ * ----------------------------------
+ * Checks one header in place: inside the heap, canary intact, both
+ * flags valid bools, and unless it is the end header, size aligned
+ * and nonzero.
+ */
+static bool header_ok(const header *h)
+{
+    if ((const char *)h < (const char *)heap_start || (const char *)(h + 1) > (const char *)heap_end) return false;
+    if (h->canary != HEAP_CANARY) return false;
+    // Nested if blocks check that the flags are bools
+    if (h->free != true) {
+        if (h->free != false) return false;
+    }
+    if (h->end != true) {
+        if (h->end != false) return false;
+    }
+    return h->end || (h->sz % ALIGNMENT == 0 && h->sz != 0);
+}
+
+/* Type: helper function links_ok
+ * ----------------------------------
+ * Checks a free block's place in the free list: the block after it is
+ * a free block whose prev link points back.
+ */
+static bool links_ok(const header *h)
+{
+    const header *next = ((const node *)(h + 1))->next;
+    if (!header_ok(next) || !next->free) return false;
+    return ((const node *)(next + 1))->prev == h;
+}
+
 /* Type: function validate_heap
  * ----------------------------------
- * Called after every request, validate_heap traverses the free list to make sure
- * no in-use blocks have snuck into the list. Next, the function traverses all 
- * memory blocks and checks that there aren't invalid entries for the header struct 
- * fields which indicate a bad heap.
+ * Called after every request. Checks the front of the free list and
+ * each block the requests since the last call touched: its header, the
+ * header right after it, so a write past the end of a payload shows up
+ * as a broken canary, and its free list links. Leaves it to
+ * validate_heap_full once enough calls have gone by.
  */
 bool validate_heap()
+{
+    if (heap_full_check_due(&touched, nblocks)) return validate_heap_full();
+    if (!header_ok(free_list) || !((header *)free_list)->free) return false;
+    for (int i = 0; i < touched.n; i++) {
+        header *block = touched.blocks[i];
+        if (!header_ok(block)) return false;
+        if (block->end) continue;
+        if (!header_ok((header *)((char *)block + sizeof(header) + block->sz))) return false;
+        if (block->free && !links_ok(block)) return false;
+    }
+    heap_touched_reset(&touched, false);
+    return true;
+}
+
+/* Type: function validate_heap_full
+ * ----------------------------------
+ * Traverses the free list to make sure no in-use blocks have snuck
+ * into the list. Next, the function traverses all memory blocks and
+ * checks that there aren't invalid entries for the header struct
+ * fields which indicate a bad heap, and that the running block and
+ * free counts match what is there.
+ */
+bool validate_heap_full()
 {
     void *free = free_list;
     while (true) {
-    	if (!((header *)free)->free) return false;
+    	if (!header_ok(free) || !((header *)free)->free) return false;
     	if (((header *)free)->end) break;
     	free = (char *)free + sizeof(header);
     	node *next = free;
     	free = next->next;
     }
     void *traversal = heap_start;
+    size_t blocks = 0, frees = 0;
     while (!((header *)traversal)->end) {
         int address = *(int *)traversal;
         // Check alignment
         if (address % ALIGNMENT != 0) return false;
-        // Nested if block checks that free field is a bool
-        if (((header *)traversal)->free != true) {
-            if (((header *)traversal)->free != false) return false;
-        }
-        // Second check ensures that end field is a bool
-        if (((header *)traversal)->end != false) return false;
-        if (((header *)traversal)->sz == 0) return false;
+        if (!header_ok(traversal)) return false;
+        blocks++;
+        frees += ((header *)traversal)->free;
         traversal = (char *)traversal + sizeof(header) + ((header *)traversal)->sz;
     }
+    if (!header_ok(traversal) || blocks != nblocks || frees != nfree) return false;
+    heap_touched_reset(&touched, true);
 	return true;
 }
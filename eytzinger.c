@@ -0,0 +1,172 @@
+#include "eytzinger.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PREFETCH_LEVELS 4 // 2^4 = 16 descendants ahead, two cache lines of longs
+#define BATCH_WIDTH 8     // Searches interleaved by eytz_find_batch
+
+/* Type: function elem
+ * ----------------------------------
+ * Returns a pointer to the k-th element in Eytzinger order.
+ */
+static inline char *elem(const eytz_set *e, size_t k)
+{
+    return e->data + k * e->width;
+}
+
+/* Type: function prefetch_below
+ * ----------------------------------
+ * Asks the cache for the block of descendants PREFETCH_LEVELS below
+ * node k, which the search will reach a few iterations from now. Near
+ * the bottom of the tree that block lies past the end of the array, so
+ * the address is formed as an integer rather than by pointer arithmetic;
+ * a prefetch of it is harmless and keeps the descent free of branches.
+ */
+static inline void prefetch_below(const eytz_set *e, size_t k)
+{
+    __builtin_prefetch((const void *)((uintptr_t)e->data + (k << PREFETCH_LEVELS) * e->width));
+}
+
+/* Type: function fill
+ * ----------------------------------
+ * In-order walk of the implicit tree rooted at k, handing out the
+ * sorted elements one by one, so the tree's in-order sequence is the
+ * sorted array. Returns the index of the next unused sorted element.
+ */
+static size_t fill(eytz_set *e, const char *sorted, size_t i, size_t k)
+{
+    if (k > e->n) return i;
+    i = fill(e, sorted, i, 2 * k);
+    memcpy(elem(e, k), sorted + i * e->width, e->width);
+    i++;
+    return fill(e, sorted, i, 2 * k + 1);
+}
+
+/* Type: function eytz_freeze
+ * ----------------------------------
+ * Copies n elements of the given width, sorted as by binsert, into
+ * Eytzinger order. The source array is not modified and may be freed.
+ */
+void eytz_freeze(eytz_set *e, const void *sorted, size_t n, size_t width)
+{
+    e->n = n;
+    e->width = width;
+    void *data;
+    if (posix_memalign(&data, 64, (n + 1) * width) != 0) data = NULL; // Slot 0 aligned, so for longs each block of 16 descendants (16k to 16k + 15) is two whole cache lines
+    assert(data);
+    e->data = data;
+    fill(e, sorted, 0, 1);
+}
+
+/* Type: function lower_bound_index
+ * ----------------------------------
+ * Undoes the descent: a search that ran off the bottom of the tree at
+ * k went right after every zero bit of k's trailing ones, so shifting
+ * them off lands on the last node where it went left, which is the
+ * first element not less than the key (0 when there is none).
+ */
+static inline size_t lower_bound_index(size_t k)
+{
+    return k >> __builtin_ffsll(~(unsigned long long)k);
+}
+
+/* Type: function eytz_find
+ * ----------------------------------
+ * Returns a pointer to the element equal to key, or NULL. The descent
+ * has no data-dependent branch: each step moves to child 2k or 2k + 1
+ * based on one comparison. The loop runs once per level, except that
+ * when the last level is only partly filled, keys whose path ends on
+ * the level above it take one iteration fewer.
+ */
+void *eytz_find(const eytz_set *e, const void *key, int (*compar)(const void *, const void *))
+{
+    size_t k = 1;
+    while (k <= e->n) {
+        prefetch_below(e, k);
+        k = 2 * k + (compar(elem(e, k), key) < 0);
+    }
+    k = lower_bound_index(k);
+    if (k != 0 && compar(elem(e, k), key) == 0) return elem(e, k);
+    return NULL;
+}
+
+/* Type: function eytz_find_batch
+ * ----------------------------------
+ * Looks up nkeys keys stored contiguously at keys (each e->width bytes)
+ * and stores each match, or NULL, in results. Searches advance in
+ * groups of BATCH_WIDTH, one level at a time across the group, so the
+ * cache misses of independent searches overlap instead of queueing.
+ */
+void eytz_find_batch(const eytz_set *e, const void *keys, size_t nkeys,
+                     int (*compar)(const void *, const void *), void **results)
+{
+    // Levels every search passes through; the last, partial level is done separately
+    unsigned int full_levels = 0;
+    while (((size_t)2 << full_levels) - 1 <= e->n) full_levels++;
+
+    for (size_t base = 0; base < nkeys; base += BATCH_WIDTH) {
+        size_t group = nkeys - base < BATCH_WIDTH ? nkeys - base : BATCH_WIDTH;
+        const char *key[BATCH_WIDTH];
+        size_t k[BATCH_WIDTH];
+        for (size_t j = 0; j < group; j++) {
+            key[j] = (const char *)keys + (base + j) * e->width;
+            k[j] = 1;
+        }
+        for (unsigned int level = 0; level < full_levels; level++) {
+            for (size_t j = 0; j < group; j++) {
+                prefetch_below(e, k[j]);
+                k[j] = 2 * k[j] + (compar(elem(e, k[j]), key[j]) < 0);
+            }
+        }
+        for (size_t j = 0; j < group; j++) {
+            if (k[j] <= e->n) k[j] = 2 * k[j] + (compar(elem(e, k[j]), key[j]) < 0);
+            k[j] = lower_bound_index(k[j]);
+            results[base + j] = k[j] != 0 && compar(elem(e, k[j]), key[j]) == 0 ? elem(e, k[j]) : NULL;
+        }
+    }
+}
+
+/* Type: function eytz_find_long
+ * ----------------------------------
+ * Fast path for sets of long: same descent as eytz_find with the
+ * comparison inlined, which lets it compile to a compare and add.
+ */
+const long *eytz_find_long(const eytz_set *e, long key)
+{
+    const long *data = (const long *)e->data;
+    size_t k = 1;
+    while (k <= e->n) {
+        prefetch_below(e, k);
+        k = 2 * k + (data[k] < key);
+    }
+    k = lower_bound_index(k);
+    return k != 0 && data[k] == key ? &data[k] : NULL;
+}
+
+/* Type: function eytz_find_ptr
+ * ----------------------------------
+ * Fast path for sets of pointers ordered by address.
+ */
+void *const *eytz_find_ptr(const eytz_set *e, const void *key)
+{
+    void *const *data = (void *const *)e->data;
+    size_t k = 1;
+    while (k <= e->n) {
+        prefetch_below(e, k);
+        k = 2 * k + ((uintptr_t)data[k] < (uintptr_t)key);
+    }
+    k = lower_bound_index(k);
+    return k != 0 && data[k] == key ? &data[k] : NULL;
+}
+
+/* Type: function eytz_dispose
+ * ----------------------------------
+ * Frees the set's storage.
+ */
+void eytz_dispose(eytz_set *e)
+{
+    free(e->data);
+    e->data = NULL;
+}
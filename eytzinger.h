@@ -0,0 +1,24 @@
+#ifndef EYTZINGER_H
+#define EYTZINGER_H
+
+#include <stddef.h>
+
+// Read-only copy of a sorted array in Eytzinger (breadth-first) order:
+// the root is element 1 and the children of element k are 2k and
+// 2k + 1. Searches touch memory in a predictable order that can be
+// prefetched several levels ahead.
+typedef struct {
+    char *data; // (n + 1) elements; element 0 is unused
+    size_t n;
+    size_t width;
+} eytz_set;
+
+void eytz_freeze(eytz_set *e, const void *sorted, size_t n, size_t width);
+void *eytz_find(const eytz_set *e, const void *key, int (*compar)(const void *, const void *));
+void eytz_find_batch(const eytz_set *e, const void *keys, size_t nkeys,
+                     int (*compar)(const void *, const void *), void **results);
+const long *eytz_find_long(const eytz_set *e, long key);
+void *const *eytz_find_ptr(const eytz_set *e, const void *key);
+void eytz_dispose(eytz_set *e);
+
+#endif
@@ -0,0 +1,496 @@
+#include "filters.h"
+#include "hash.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_NLINES 100
+#define MIN_NBATCHES 16
+#define MIN_TABLE_SLOTS 1024 // Power of two so probing can mask instead of mod
+#define MIN_ARENA_SIZE 4096
+
+// One distinct line seen by a count_stage. The text lives in the arena
+// at offset so that growing the arena never invalidates entries.
+struct line_entry {
+    uint64_t hash;
+    size_t offset;
+    size_t len;
+    long count;
+};
+
+// One line of the tail window. Each slot keeps its buffer between
+// lines and only reallocates when a longer line lands in it.
+struct tail_slot {
+    char *text;
+    size_t len;
+    size_t cap;
+};
+
+// One line held by a top_k_stage. Like a tail slot, each entry owns a
+// buffer that travels with it through the heap and is reused for the
+// next line to take its place.
+struct top_k_entry {
+    char *text;
+    size_t len;
+    size_t cap;
+    long count;
+    uint64_t seq; // Arrival order, for ties
+};
+
+static void emit_line(void *ctx, const char *line, size_t len, long count)
+{
+    (void)count;
+    writer_text(ctx, line, len);
+    writer_char(ctx, '\n');
+}
+
+/* Type: function emit_count
+ * ----------------------------------
+ * Writes one output line: the count right-aligned in six columns, a
+ * space and the line, as printf("%6ld %s\n") would.
+ */
+static void emit_count(void *ctx, const char *line, size_t len, long count)
+{
+    writer_long(ctx, count, 6);
+    writer_char(ctx, ' ');
+    writer_text(ctx, line, len);
+    writer_char(ctx, '\n');
+}
+
+line_sink writer_sink(writer *w)
+{
+    return (line_sink){emit_line, w};
+}
+
+line_sink writer_count_sink(writer *w)
+{
+    return (line_sink){emit_count, w};
+}
+
+/* Type: function line_set_read
+ * ----------------------------------
+ * Reads every line of fp in batches from a batch_reader and keeps
+ * views into the batches, which stay alive until the set is disposed,
+ * instead of copying each line.
+ */
+void line_set_read(line_set *set, FILE *fp)
+{
+    set->lines_cap = MIN_NLINES;
+    set->lines = malloc(sizeof(line_view) * set->lines_cap);
+    set->batches_cap = MIN_NBATCHES;
+    set->batches = malloc(sizeof(line_batch *) * set->batches_cap);
+    assert(set->lines && set->batches);
+    set->nlines = set->nbatches = 0;
+
+    batch_reader reader;
+    batch_reader_init(&reader, fp);
+    line_batch *batch;
+    while ((batch = batch_reader_next(&reader)) != NULL) {
+        if (set->nbatches == set->batches_cap) {
+            set->batches_cap *= 2;
+            set->batches = realloc(set->batches, sizeof(line_batch *) * set->batches_cap);
+            assert(set->batches);
+        }
+        set->batches[set->nbatches++] = batch;
+        if (set->nlines + batch->nlines > set->lines_cap) {
+            while (set->nlines + batch->nlines > set->lines_cap) set->lines_cap *= 2;
+            set->lines = realloc(set->lines, sizeof(line_view) * set->lines_cap);
+            assert(set->lines);
+        }
+        memcpy(set->lines + set->nlines, batch->lines, sizeof(line_view) * batch->nlines);
+        set->nlines += batch->nlines;
+    }
+    batch_reader_dispose(&reader);
+}
+
+void line_set_dispose(line_set *set)
+{
+    for (size_t i = 0; i < set->nbatches; i++) batch_free(set->batches[i]);
+    free(set->batches);
+    free(set->lines);
+}
+
+/* Type: function filter_sort
+ * ----------------------------------
+ * Sorts with line_sort's kernel for the order. For uniq, keeps the
+ * first line of each run that compares equal. The lex and length
+ * kernels are not stable, but lines they tie on are identical up to
+ * the terminator and print the same, so which one is kept does not
+ * show. The numeric kernel breaks ties by position, so it keeps the
+ * first in input, as sort -u always has.
+ */
+size_t filter_sort(line_view *lines, size_t n, sort_order order, bool uniq)
+{
+    static int (*const cmps[NSORT_ORDERS])(const void *, const void *) = {cmp_pstr, cmp_pstr_len, cmp_pstr_numeric};
+    line_sort(lines, n, order);
+    if (!uniq || n == 0) return n;
+    size_t kept = 1;
+    for (size_t i = 1; i < n; i++) {
+        if (cmps[order](&lines[kept - 1], &lines[i]) != 0) lines[kept++] = lines[i];
+    }
+    return kept;
+}
+
+void filter_emit(const line_view *lines, size_t n, bool reverse, line_sink sink)
+{
+    if (reverse) {
+        for (size_t i = n; i-- > 0; ) sink.emit(sink.ctx, lines[i].ptr, lines[i].len, 1);
+    } else {
+        for (size_t i = 0; i < n; i++) sink.emit(sink.ctx, lines[i].ptr, lines[i].len, 1);
+    }
+}
+
+void uniq_init(uniq_stage *u)
+{
+    u->prev = NULL;
+    u->prev_len = 0;
+    u->count = 0;
+    u->saved = NULL;
+    u->saved_cap = 0;
+}
+
+/* Type: function uniq_feed
+ * ----------------------------------
+ * Keeps count of repeating lines, emitting each line once it stops
+ * occurring consecutively, with the number of occurrences as its
+ * count. Within an array the previous line is just a view; it is
+ * copied into a growable buffer at the end, since the run may continue
+ * into the next array and this one may not outlive the call.
+ */
+void uniq_feed(uniq_stage *u, const line_view *lines, size_t n, line_sink sink)
+{
+    for (size_t i = 0; i < n; i++) {
+        const line_view *curr = &lines[i];
+        if (u->count != 0 && curr->len == u->prev_len && memcmp(u->prev, curr->ptr, u->prev_len) == 0) { // Consecutive occurrence increments count
+            u->count++;
+            continue;
+        }
+        if (u->count != 0) sink.emit(sink.ctx, u->prev, u->prev_len, u->count); // Not consecutive occurrence, emit prev and reset count
+        u->prev = curr->ptr;
+        u->prev_len = curr->len;
+        u->count = 1;
+    }
+    if (u->count != 0 && u->prev != u->saved) { // Last run may continue into the next array
+        if (u->saved_cap < u->prev_len + 1) {
+            u->saved_cap = u->prev_len + 1;
+            free(u->saved);
+            u->saved = malloc(u->saved_cap);
+            assert(u->saved);
+        }
+        memcpy(u->saved, u->prev, u->prev_len);
+        u->saved[u->prev_len] = '\0';
+        u->prev = u->saved;
+    }
+}
+
+/* Type: function uniq_finish
+ * ----------------------------------
+ * Emits the last run. Its line stays valid until the stage is
+ * initialized again or disposed with uniq_dispose.
+ */
+void uniq_finish(uniq_stage *u, line_sink sink)
+{
+    if (u->count != 0) sink.emit(sink.ctx, u->prev, u->prev_len, u->count);
+    u->count = 0;
+}
+
+void uniq_dispose(uniq_stage *u)
+{
+    free(u->saved);
+    uniq_init(u);
+}
+
+void tail_init(tail_stage *t, size_t k)
+{
+    t->k = k;
+    t->nlines = 0;
+    t->slots = calloc(k + 1, sizeof(struct tail_slot));
+    assert(t->slots);
+}
+
+/* Type: function tail_feed
+ * ----------------------------------
+ * Treats the slots as a circular array with wraparound advancement so
+ * that a window of k lines moves across the whole input. Only the last
+ * k lines of an array can survive, so the rest are counted and skipped.
+ */
+void tail_feed(tail_stage *t, const line_view *lines, size_t n)
+{
+    if (t->k == 0) return;
+    size_t first = n > t->k ? n - t->k : 0;
+    t->nlines += first;
+    for (size_t i = first; i < n; i++) {
+        struct tail_slot *slot = &t->slots[t->nlines % t->k]; // Wraparound advance overwrites the oldest line
+        if (slot->cap < lines[i].len + 1) {
+            free(slot->text);
+            slot->cap = lines[i].len + 1;
+            slot->text = malloc(slot->cap);
+            assert(slot->text);
+        }
+        memcpy(slot->text, lines[i].ptr, lines[i].len);
+        slot->text[lines[i].len] = '\0';
+        slot->len = lines[i].len;
+        t->nlines++;
+    }
+}
+
+/* Type: function tail_finish
+ * ----------------------------------
+ * Emits the window oldest first and frees the slots.
+ */
+void tail_finish(tail_stage *t, line_sink sink)
+{
+    size_t stored = t->nlines < t->k ? t->nlines : t->k;
+    size_t index = t->nlines <= t->k ? 0 : t->nlines % t->k; // Oldest line in the window
+    for (size_t i = 0; i < stored; i++) {
+        const struct tail_slot *slot = &t->slots[(index + i) % t->k];
+        sink.emit(sink.ctx, slot->text, slot->len, 1);
+    }
+    for (size_t i = 0; i < t->k; i++) free(t->slots[i].text);
+    free(t->slots);
+    t->slots = NULL;
+}
+
+/* Type: function count_init
+ * ----------------------------------
+ * Sets up an empty table with MIN_TABLE_SLOTS slots and small entry
+ * and arena arrays that grow geometrically. Slots hold the cached hash
+ * and entry index + 1 (0 marks an empty slot), so most probes that
+ * miss are rejected without touching the entry or the arena.
+ */
+void count_init(count_stage *c)
+{
+    c->nslots = MIN_TABLE_SLOTS;
+    c->slot_hash = malloc(sizeof(uint64_t) * c->nslots);
+    c->slot_index = calloc(c->nslots, sizeof(size_t));
+    c->entries_cap = MIN_TABLE_SLOTS / 2;
+    c->entries = malloc(sizeof(struct line_entry) * c->entries_cap);
+    c->nentries = 0;
+    c->arena_cap = MIN_ARENA_SIZE;
+    c->arena = malloc(c->arena_cap);
+    c->arena_len = 0;
+    assert(c->slot_hash && c->slot_index && c->entries && c->arena);
+}
+
+/* Type: function count_grow
+ * ----------------------------------
+ * Doubles the slot array and reinserts every entry using its stored
+ * hash, so no line is ever rehashed or re-read from the arena.
+ */
+static void count_grow(count_stage *c)
+{
+    size_t nslots = c->nslots * 2;
+    uint64_t *slot_hash = malloc(sizeof(uint64_t) * nslots);
+    size_t *slot_index = calloc(nslots, sizeof(size_t));
+    assert(slot_hash && slot_index);
+    for (size_t i = 0; i < c->nentries; i++) {
+        size_t pos = c->entries[i].hash & (nslots - 1);
+        while (slot_index[pos] != 0) pos = (pos + 1) & (nslots - 1);
+        slot_hash[pos] = c->entries[i].hash;
+        slot_index[pos] = i + 1;
+    }
+    free(c->slot_hash);
+    free(c->slot_index);
+    c->slot_hash = slot_hash;
+    c->slot_index = slot_index;
+    c->nslots = nslots;
+}
+
+/* Type: function count_add
+ * ----------------------------------
+ * Adds count to the len bytes at line, adding a new entry (and copying
+ * the bytes into the arena) the first time it is seen. Keeps the load
+ * factor at or below one half.
+ */
+void count_add(count_stage *c, const char *line, size_t len, long count)
+{
+    uint64_t hash = hash_bytes(line, len);
+    size_t pos = hash & (c->nslots - 1);
+    while (c->slot_index[pos] != 0) {
+        if (c->slot_hash[pos] == hash) {
+            struct line_entry *e = &c->entries[c->slot_index[pos] - 1];
+            if (e->len == len && memcmp(c->arena + e->offset, line, len) == 0) {
+                e->count += count;
+                return;
+            }
+        }
+        pos = (pos + 1) & (c->nslots - 1);
+    }
+    // New distinct line: copy into the arena with a null terminator for printing
+    if (c->arena_len + len + 1 > c->arena_cap) {
+        while (c->arena_len + len + 1 > c->arena_cap) c->arena_cap *= 2;
+        c->arena = realloc(c->arena, c->arena_cap);
+        assert(c->arena);
+    }
+    memcpy(c->arena + c->arena_len, line, len);
+    c->arena[c->arena_len + len] = '\0';
+    if (c->nentries == c->entries_cap) {
+        c->entries_cap *= 2;
+        c->entries = realloc(c->entries, sizeof(struct line_entry) * c->entries_cap);
+        assert(c->entries);
+    }
+    struct line_entry *e = &c->entries[c->nentries];
+    e->hash = hash;
+    e->offset = c->arena_len;
+    e->len = len;
+    e->count = count;
+    c->arena_len += len + 1;
+    c->slot_hash[pos] = hash;
+    c->slot_index[pos] = ++c->nentries;
+    if (c->nentries * 2 > c->nslots) count_grow(c);
+}
+
+void count_feed(count_stage *c, const line_view *lines, size_t n)
+{
+    for (size_t i = 0; i < n; i++) count_add(c, lines[i].ptr, lines[i].len, 1);
+}
+
+void count_finish(count_stage *c, size_t top_k, line_sink sink)
+{
+    top_k_stage top;
+    line_sink out = sink;
+    if (top_k != 0) {
+        top_k_init(&top, top_k < c->nentries ? top_k : c->nentries);
+        out = top_k_sink(&top);
+    }
+    for (size_t i = 0; i < c->nentries; i++) {
+        const struct line_entry *e = &c->entries[i];
+        out.emit(out.ctx, c->arena + e->offset, e->len, e->count);
+    }
+    if (top_k != 0) top_k_finish(&top, sink);
+    free(c->slot_hash);
+    free(c->slot_index);
+    free(c->entries);
+    free(c->arena);
+}
+
+/* Type: function ranks_before
+ * ----------------------------------
+ * Orders entries for top-K output: higher counts first, and among equal
+ * counts the line that arrived first wins.
+ */
+static bool ranks_before(const struct top_k_entry *a, const struct top_k_entry *b)
+{
+    if (a->count != b->count) return a->count > b->count;
+    return a->seq < b->seq;
+}
+
+/* Type: function sift_down
+ * ----------------------------------
+ * Restores the heap property below index i in a heap of n entries
+ * whose root is the entry that ranks last, so the root is always the
+ * one to evict when a better entry shows up.
+ */
+static void sift_down(struct top_k_entry *heap, size_t n, size_t i)
+{
+    while (true) {
+        size_t worst = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < n && ranks_before(&heap[worst], &heap[left])) worst = left;
+        if (right < n && ranks_before(&heap[worst], &heap[right])) worst = right;
+        if (worst == i) return;
+        struct top_k_entry tmp = heap[i];
+        heap[i] = heap[worst];
+        heap[worst] = tmp;
+        i = worst;
+    }
+}
+
+void top_k_init(top_k_stage *t, size_t k)
+{
+    t->k = k;
+    t->n = 0;
+    t->seq = 0;
+    t->heap = calloc(k ? k : 1, sizeof(struct top_k_entry)); // calloc(0) may return NULL
+    assert(t->heap);
+}
+
+/* Type: function keep_line
+ * ----------------------------------
+ * Copies line into e's buffer, growing it only when the line is longer
+ * than any it has held.
+ */
+static void keep_line(struct top_k_entry *e, const char *line, size_t len)
+{
+    if (e->cap < len + 1) {
+        free(e->text);
+        e->cap = len + 1;
+        e->text = malloc(e->cap);
+        assert(e->text);
+    }
+    memcpy(e->text, line, len);
+    e->text[len] = '\0';
+    e->len = len;
+}
+
+/* Type: function top_k_emit
+ * ----------------------------------
+ * Sink callback. Fills the heap, sifting each new entry up, then only
+ * replaces the root when a better entry arrives, so n lines cost
+ * O(n log k). Only lines that enter the heap are copied.
+ */
+static void top_k_emit(void *ctx, const char *line, size_t len, long count)
+{
+    top_k_stage *t = ctx;
+    struct top_k_entry rank = {.count = count, .seq = t->seq++}; // For comparing before anything is copied
+    if (t->n < t->k) {
+        size_t i = t->n++;
+        struct top_k_entry e = t->heap[i]; // Unused slot, whose buffer e takes
+        e.count = rank.count;
+        e.seq = rank.seq;
+        keep_line(&e, line, len);
+        while (i > 0 && ranks_before(&t->heap[(i - 1) / 2], &e)) { // Parent ranks better, so e moves up
+            t->heap[i] = t->heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        t->heap[i] = e;
+    } else if (t->k != 0 && ranks_before(&rank, &t->heap[0])) {
+        t->heap[0].count = rank.count; // Evict the root and reuse its buffer
+        t->heap[0].seq = rank.seq;
+        keep_line(&t->heap[0], line, len);
+        sift_down(t->heap, t->k, 0);
+    }
+}
+
+line_sink top_k_sink(top_k_stage *t)
+{
+    return (line_sink){top_k_emit, t};
+}
+
+/* Type: function top_k_finish
+ * ----------------------------------
+ * Pops the worst entry to the back repeatedly, leaving best-first
+ * order, emits the entries and frees the heap.
+ */
+void top_k_finish(top_k_stage *t, line_sink sink)
+{
+    for (size_t n = t->n; n > 1; n--) {
+        struct top_k_entry tmp = t->heap[0];
+        t->heap[0] = t->heap[n - 1];
+        t->heap[n - 1] = tmp;
+        sift_down(t->heap, n - 1, 0);
+    }
+    for (size_t i = 0; i < t->n; i++) sink.emit(sink.ctx, t->heap[i].text, t->heap[i].len, t->heap[i].count);
+    for (size_t i = 0; i < t->n; i++) free(t->heap[i].text);
+    free(t->heap);
+    t->heap = NULL;
+}
+
+/* Type: function filter_sort_count_top
+ * ----------------------------------
+ * Sorts the lines, then feeds them to a uniq stage whose runs go
+ * straight into a top-K heap, so no count is ever formatted or parsed.
+ */
+void filter_sort_count_top(line_view *lines, size_t n, size_t k, line_sink sink)
+{
+    uniq_stage u;
+    top_k_stage top;
+    filter_sort(lines, n, SORT_LEX, false);
+    // Sorting compares up to the terminator, so runs must too
+    for (size_t i = 0; i < n; i++) lines[i].len = strnlen(lines[i].ptr, lines[i].len);
+    uniq_init(&u);
+    top_k_init(&top, k);
+    uniq_feed(&u, lines, n, top_k_sink(&top));
+    uniq_finish(&u, top_k_sink(&top));
+    top_k_finish(&top, sink);
+    uniq_dispose(&u);
+}
@@ -0,0 +1,115 @@
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include "batch_reader.h"
+#include "line_sort.h"
+#include "read_line.h"
+#include "writer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// In-process versions of the sort, uniq and tail filters. Stages take
+// arrays of line_views and hand their output to a line_sink callback,
+// so they chain without formatting or parsing text in between; mysort,
+// myuniq and mytail are these stages with a writer sink on the end.
+// Streaming stages (uniq, tail, count) are fed any number of arrays
+// and finished once. Lines handed to a sink are valid only during the
+// call unless a stage says otherwise.
+
+// Receives output lines in order. count is how many input lines the
+// line stands for: 1, except after uniq and count.
+typedef struct {
+    void (*emit)(void *ctx, const char *line, size_t len, long count);
+    void *ctx;
+} line_sink;
+
+line_sink writer_sink(writer *w);       // "line\n"
+line_sink writer_count_sink(writer *w); // "%6ld line\n", as uniq prints
+
+// Every line of a stream, held in the batches it was read in.
+typedef struct {
+    line_view *lines;
+    size_t nlines, lines_cap;
+    line_batch **batches;
+    size_t nbatches, batches_cap;
+} line_set;
+
+void line_set_read(line_set *set, FILE *fp);
+void line_set_dispose(line_set *set);
+
+// Sorts lines in place. With uniq, keeps only the first of each run of
+// lines that compare equal, like sort -u, and returns the new count.
+size_t filter_sort(line_view *lines, size_t n, sort_order order, bool uniq);
+void filter_emit(const line_view *lines, size_t n, bool reverse, line_sink sink);
+
+// Collapses runs of identical adjacent lines, across feeds, into one
+// line with the run's length as its count.
+typedef struct {
+    const char *prev;
+    size_t prev_len;
+    long count;
+    char *saved; // Copy of prev once the array it came from may be gone
+    size_t saved_cap;
+} uniq_stage;
+
+void uniq_init(uniq_stage *u);
+void uniq_feed(uniq_stage *u, const line_view *lines, size_t n, line_sink sink);
+// The last run's line stays valid until uniq_dispose.
+void uniq_finish(uniq_stage *u, line_sink sink);
+void uniq_dispose(uniq_stage *u);
+
+// Keeps the last k lines fed to it, copying only those that can end up
+// in the window.
+typedef struct {
+    struct tail_slot *slots;
+    size_t k;
+    uint64_t nlines;
+} tail_stage;
+
+void tail_init(tail_stage *t, size_t k);
+void tail_feed(tail_stage *t, const line_view *lines, size_t n);
+void tail_finish(tail_stage *t, line_sink sink);
+
+// Counts every distinct line wherever it occurs, in a hash table whose
+// memory is proportional to the number of distinct lines.
+typedef struct {
+    uint64_t *slot_hash;
+    size_t *slot_index;
+    size_t nslots;
+    struct line_entry *entries;
+    size_t nentries;
+    size_t entries_cap;
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+} count_stage;
+
+void count_init(count_stage *c);
+void count_feed(count_stage *c, const line_view *lines, size_t n);
+void count_add(count_stage *c, const char *line, size_t len, long count);
+// Emits each line with its count in order of first occurrence, or only
+// the top_k most frequent when top_k is nonzero, then frees the table.
+void count_finish(count_stage *c, size_t top_k, line_sink sink);
+
+// Keeps the k lines with the highest counts among those emitted into
+// top_k_sink, the earliest winning ties, copying each line that enters
+// the heap, so it can follow any stage. top_k_finish emits them best
+// first.
+typedef struct {
+    struct top_k_entry *heap;
+    size_t k, n;
+    uint64_t seq;
+} top_k_stage;
+
+void top_k_init(top_k_stage *t, size_t k);
+line_sink top_k_sink(top_k_stage *t);
+void top_k_finish(top_k_stage *t, line_sink sink);
+
+// sort | uniq -c | top k by count, fused: runs flow from the sorted
+// array straight into the top-K heap. Lines end at their first null
+// byte, as they do in mysort's output.
+void filter_sort_count_top(line_view *lines, size_t n, size_t k, line_sink sink);
+
+#endif
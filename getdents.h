@@ -0,0 +1,31 @@
+#ifndef GETDENTS_H
+#define GETDENTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define DIRENT_BUF_SIZE (1 << 20) // One syscall returns thousands of entries
+
+// Record layout returned by getdents64(2); glibc does not export it.
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} linux_dirent64;
+
+/* Type: function read_dirents
+ * ----------------------------------
+ * Fills buf with raw directory records from the open directory fd and
+ * returns the number of bytes used, 0 at the end of the directory or
+ * -1 on error. Records are walked with d_reclen.
+ */
+static inline long read_dirents(int fd, void *buf, size_t size)
+{
+    return syscall(SYS_getdents64, fd, buf, size);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Type: function hash_bytes
+ * ----------------------------------
+ * Hashes len bytes starting at p into a 64-bit value. Consumes the
+ * input eight bytes at a time with a multiply/xorshift mix so long
+ * lines cost one multiply per word instead of one per byte. The
+ * result is stable across runs and machines of the same endianness,
+ * so it is safe to persist.
+ */
+static inline uint64_t hash_bytes(const void *p, size_t len)
+{
+    const unsigned char *bytes = p;
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    uint64_t word;
+    while (len >= 8) {
+        memcpy(&word, bytes, 8); // memcpy avoids unaligned loads
+        h = (h ^ word) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+        bytes += 8;
+        len -= 8;
+    }
+    word = 0;
+    memcpy(&word, bytes, len); // Remaining 0-7 bytes, zero padded
+    h = (h ^ word) * 0x94D049BB133111EBULL;
+    h ^= h >> 29;
+    return h;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef HEAP_CHECK_H
+#define HEAP_CHECK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Incremental heap checking shared by the allocators. Each request
+// records the block headers it wrote in a heap_touched set, and
+// validate_heap checks only those blocks, their right neighbours and
+// their free list links, in O(1). A full walk still runs, and compares
+// the allocator's running block counts against the heap, once the
+// checks since the last walk reach the number of blocks (so its cost
+// is O(1) amortized), whenever the set overflowed, or on demand through
+// validate_heap_full. Build with -DHEAP_CHECK_FULL to walk on every call.
+
+#define HEAP_CANARY 0xB10C     // Stored in the spare bytes of every header
+#define HEAP_TOUCHED_MAX 16    // Blocks remembered between checks
+#define HEAP_FULL_CHECK_MIN 64 // Checks between full walks on small heaps
+
+typedef struct {
+    void *blocks[HEAP_TOUCHED_MAX];
+    int n;
+    bool overflow;       // Blocks were dropped; only a full walk will do
+    size_t since_full;   // validate_heap calls since the last full walk
+} heap_touched;
+
+bool validate_heap_full(void);
+
+/* Type: function heap_touch
+ * ----------------------------------
+ * Records that a request wrote the header at block.
+ */
+static inline void heap_touch(heap_touched *t, void *block)
+{
+    for (int i = 0; i < t->n; i++) {
+        if (t->blocks[i] == block) return;
+    }
+    if (t->n == HEAP_TOUCHED_MAX) t->overflow = true;
+    else t->blocks[t->n++] = block;
+}
+
+/* Type: function heap_untouch
+ * ----------------------------------
+ * Forgets recorded blocks in [start, end), for headers that a request
+ * merged away and that now lie inside another block's payload.
+ */
+static inline void heap_untouch(heap_touched *t, const void *start, const void *end)
+{
+    for (int i = t->n; i-- > 0; ) {
+        if ((const char *)t->blocks[i] >= (const char *)start && (const char *)t->blocks[i] < (const char *)end) {
+            t->blocks[i] = t->blocks[--t->n];
+        }
+    }
+}
+
+/* Type: function heap_full_check_due
+ * ----------------------------------
+ * Counts a validate_heap call and says whether it should be a full
+ * walk of a heap with nblocks blocks.
+ */
+static inline bool heap_full_check_due(heap_touched *t, size_t nblocks)
+{
+#ifdef HEAP_CHECK_FULL
+    (void)t;
+    (void)nblocks;
+    return true;
+#else
+    size_t period = nblocks > HEAP_FULL_CHECK_MIN ? nblocks : HEAP_FULL_CHECK_MIN;
+    return t->overflow || ++t->since_full >= period;
+#endif
+}
+
+/* Type: function heap_touched_reset
+ * ----------------------------------
+ * Empties the set once its blocks have been checked.
+ */
+static inline void heap_touched_reset(heap_touched *t, bool full)
+{
+    t->n = 0;
+    t->overflow = false;
+    if (full) t->since_full = 0;
+}
+
+#endif
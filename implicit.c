@@ -1,17 +1,23 @@
 #include <string.h>
 #include <stdbool.h>
 #include "allocator.h"
+#include "heap_check.h"
+#include "stats.h"
 
 #define ALIGNMENT 8
 #define MIN_SIZE_BLOCK 16 // sizeof(header) + 8 byte payload
 
 static void *heap_start, *heap_end;
+static size_t nblocks, nfree; // Blocks before the end header, and how many are free
+static heap_touched touched;
+STATS_COUNTER(search_depth, "malloc search depth");
 
 // 8 bytes
 typedef struct {
     unsigned int sz;	// size of memory block (does not include sizeof(header))
     bool free;		    // in use or free
     bool end;			// end header or not
+    unsigned short canary; // HEAP_CANARY while the header is intact
 } header;
 
 /* Type: function roundup
@@ -58,6 +64,10 @@ bool myinit(void *segment_start, size_t segment_size)
     endhead->sz = rounddown(segment_size, ALIGNMENT) - sizeof(header);
     endhead->free = true;
     endhead->end = true;
+    endhead->canary = HEAP_CANARY;
+    nblocks = nfree = 0;
+    touched = (heap_touched){0};
+    heap_touch(&touched, endhead);
     return true;
 }
 
@@ -73,6 +83,8 @@ void mynewendheader(void *location, unsigned int size) {
     newend->sz = ((header *)location)->sz - size;
     newend->free = true;
     newend->end = true;
+    newend->canary = HEAP_CANARY;
+    heap_touch(&touched, newend);
 }
 
 /* Type: helper function mynewheader
@@ -86,6 +98,8 @@ void mynewheader(void *location, unsigned int size) {
     newhead->sz = size;
     newhead->free = false;
     newhead->end = false;
+    newhead->canary = HEAP_CANARY;
+    heap_touch(&touched, newhead);
 }
 
 /* Type: function mymalloc
@@ -102,22 +116,31 @@ void *mymalloc(size_t requestedsz)
     if (needed == 0 || needed > 0xFFFFFFFF) return NULL;
     if (needed < MIN_SIZE_BLOCK) needed = MIN_SIZE_BLOCK;
     void *traversal = heap_start;
+    STATS_ONLY(uint64_t depth = 1;) // Blocks examined, including the one chosen
     while (true) {
-        if (((header *)traversal)->sz < needed && ((header *)traversal)->end == true) return NULL; // Heap exhausted
+        if (((header *)traversal)->sz < needed && ((header *)traversal)->end == true) { // Heap exhausted
+            STATS_RECORD(search_depth, depth);
+            return NULL;
+        }
     	if (((header *)traversal)->sz >= needed && ((header *)traversal)->free == true) { // Found open block
+            STATS_RECORD(search_depth, depth);
     		// Case 1: Available block is the end header
             if (((header *)traversal)->end == true) {
                 mynewendheader(traversal, needed);
                 mynewheader(traversal, needed);
+                nblocks++;
                 void *alloc = (char *)traversal + sizeof(header);
                 return alloc;
             }
             // Case 2: Regular block
             ((header *)traversal)->free = false;
+            nfree--;
+            heap_touch(&touched, traversal);
     		void *alloc = (char *)traversal + sizeof(header); // Advance past header to get pointer to memory block
     		return alloc;
     	}
     	traversal = (char *)traversal + sizeof(header) + ((header *)traversal)->sz;
+        STATS_ONLY(depth++;)
     }
 }
 
@@ -130,7 +153,9 @@ void myfree(void *ptr)
 {
 	if (ptr == NULL) return;
 	ptr = (char *)ptr - sizeof(header); // Move pointer back to header in front of block
+	if (!((header *)ptr)->free) nfree++;
 	((header *)ptr)->free = true;
+	heap_touch(&touched, ptr);
 }
 
 /* Type: function myrealloc
@@ -163,25 +188,35 @@ void *myrealloc(void *oldptr, size_t newsz)
             extraspace -= sizeof(header); // Decrement size of splitblock's header
             mynewheader(splitblock, extraspace);
             ((header *)splitblock)->free = true;
+            nblocks++;
+            nfree++;
+            heap_touch(&touched, oldptrhead);
         }
         return oldptr;
     }
     // Case 2: Absorb free blocks to the right
     void *rightblockhead = (char *)oldptr + ((header *)oldptrhead)->sz;
+    void *firstright = rightblockhead; // Headers from here on that get absorbed vanish
     if (((header *)rightblockhead)->free == true) {
+        heap_touch(&touched, oldptrhead);
         // Right block is the end header
         if (((header *)rightblockhead)->end == true) {
             unsigned int offset = needed - ((header *)oldptrhead)->sz;
             rightblockhead = (char *)rightblockhead - sizeof(header); // Move back by 8 because mynewendhead adds 8 for new header that isn't created at rightblockhead 
             mynewendheader(rightblockhead, offset);
+            heap_untouch(&touched, firstright, (char *)firstright + offset);
             ((header *)oldptrhead)->sz += offset;
             return oldptr;
         }
         // Else traverse adjacent free blocks until run out of free blocks or size is met
         unsigned int freesz = ((header *)oldptrhead)->sz + ((header *)rightblockhead)->sz + sizeof(header);
+        size_t absorbed = 1;
         while (true) {
             if (freesz >= needed) {
                 ((header *)oldptrhead)->sz = freesz;
+                heap_untouch(&touched, firstright, (char *)oldptr + freesz);
+                nblocks -= absorbed;
+                nfree -= absorbed;
                 return oldptr;
             }
             rightblockhead = (char *)rightblockhead + sizeof(header) + ((header *)rightblockhead)->sz;
@@ -190,10 +225,14 @@ void *myrealloc(void *oldptr, size_t newsz)
                     unsigned int offset = needed - freesz;
                     rightblockhead = (char *)rightblockhead - sizeof(header);
                     mynewendheader(rightblockhead, offset);
+                    heap_untouch(&touched, firstright, (char *)oldptr + needed);
                     ((header *)oldptrhead)->sz = needed;
+                    nblocks -= absorbed;
+                    nfree -= absorbed;
                     return oldptr;
                 }
                 freesz += ((header *)rightblockhead)->sz + sizeof(header);
+                absorbed++;
             } else {
                 break; // Resize in-place is not possible, jump to re-malloc
             }
@@ -201,34 +240,72 @@ void *myrealloc(void *oldptr, size_t newsz)
     }
     // Case 3: Traverse heap to find block via call to malloc
     void *newblock = mymalloc(newsz);
-    mynewheader(newblock, needed);
+    if (newblock == NULL) return NULL;
     memcpy(newblock, oldptr, ((header *)oldptrhead)->sz); // Preserve data from old block
     myfree(oldptr);
     return newblock;
 }
 
+/* Type: helper function header_ok
+ * ----------------------------------
+ * Checks one header in place: inside the heap, canary intact, both
+ * flags valid bools, and unless it is the end header, size aligned
+ * and nonzero.
+ */
+static bool header_ok(const header *h)
+{
+    if ((const char *)h < (const char *)heap_start || (const char *)(h + 1) > (const char *)heap_end) return false;
+    if (h->canary != HEAP_CANARY) return false;
+    // Nested if blocks check that the flags are bools
+    if (h->free != true) {
+        if (h->free != false) return false;
+    }
+    if (h->end != true) {
+        if (h->end != false) return false;
+    }
+    return h->end || (h->sz % ALIGNMENT == 0 && h->sz != 0);
+}
+
 /* Type: function validate_heap
  * ----------------------------------
- * Called after every request, validate_heap traverses all memory blocks and 
- * checks that there aren't invalid entries for the header struct fields which
- * indicate a bad heap.
+ * Called after every request. Checks each block the requests since the
+ * last call touched and the header right after it, so a write past the
+ * end of a payload shows up as a broken canary. Leaves it to
+ * validate_heap_full once enough calls have gone by.
  */
 bool validate_heap()
+{
+    if (heap_full_check_due(&touched, nblocks)) return validate_heap_full();
+    for (int i = 0; i < touched.n; i++) {
+        header *block = touched.blocks[i];
+        if (!header_ok(block)) return false;
+        if (!block->end && !header_ok((header *)((char *)block + sizeof(header) + block->sz))) return false;
+    }
+    heap_touched_reset(&touched, false);
+    return true;
+}
+
+/* Type: function validate_heap_full
+ * ----------------------------------
+ * Traverses all memory blocks and checks that there aren't invalid
+ * entries for the header struct fields which indicate a bad heap, and
+ * that the running block and free counts match what is there.
+ */
+bool validate_heap_full()
 {
     void *traversal = heap_start;
+    size_t blocks = 0, frees = 0;
     // Traverse until reaching the end of the heap
     while (!((header *)traversal)->end) {
         int address = *(int *)traversal;
         // Check alignment
         if (address % ALIGNMENT != 0) return false;
-        // Nested if block checks that free field is a bool
-        if (((header *)traversal)->free != true) {
-            if (((header *)traversal)->free != false) return false;
-        }
-        // Second check ensures that end field is a bool
-        if (((header *)traversal)->end != false) return false;
-        if (((header *)traversal)->sz == 0) return false;
+        if (!header_ok(traversal)) return false;
+        blocks++;
+        frees += ((header *)traversal)->free;
         traversal = (char *)traversal + sizeof(header) + ((header *)traversal)->sz;
     }
+    if (!header_ok(traversal) || blocks != nblocks || frees != nfree) return false;
+    heap_touched_reset(&touched, true);
     return true;
 }
@@ -0,0 +1,234 @@
+#include "line_sort.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SORT_INSERTION_MAX 16 // Partitions this small finish with insertion sort
+#define LENGTH_KEY_MAX ((1u << 24) - 1) // Longer lines share one length key
+
+/* Type: comparison function cmp_pstr
+ * ----------------------------------
+ * Default comparison function set to the typedef.
+ * Sorts according to case-sensitive lexicographic
+ * order by calling string.h's strcmp function.
+ */
+int cmp_pstr(const void *p, const void *q)
+{
+    return strcmp(*(const char **)p, *(const char **)q);
+    // Need to access array of characters, not array of strings
+}
+
+/* Type: comparison function cmp_pstr_len
+ * ----------------------------------
+ * Functionality for sorting by line length. Ties in
+ * line length are broken lexicographically. Invoked
+ * via the command-line flag 'l'.
+ */
+int cmp_pstr_len(const void *p, const void *q)
+{
+    if (strlen(*(const char **)p) == (strlen(*(const char **)q))) {
+        return strcmp(*(const char **)p, *(const char **)q);
+    } else {
+        return strlen(*(const char **)p) - strlen(*(const char **)q);
+    }
+}
+
+/* Type: comparison function cmp_pstr_numeric
+ * ----------------------------------
+ * Functionality for sorting by string numerical value
+ * by calling stdlib.h's atoi function. Invoked via the
+ * command-line flag 'n'. Compares rather than subtracts,
+ * since the difference of two ints can overflow.
+ */
+int cmp_pstr_numeric(const void *p, const void *q)
+{
+    int a = atoi(*(const char **)p), b = atoi(*(const char **)q);
+    return (a > b) - (a < b);
+}
+
+// A line with a precomputed sort key, so most comparisons are one
+// integer compare and never touch the line itself.
+typedef struct {
+    uint64_t key;
+    const line_view *line;
+} sort_entry;
+
+// line_sort writes the sorted views back over the entries.
+_Static_assert(sizeof(sort_entry) == sizeof(line_view), "sort_entry must be the size of a line_view");
+
+/* Type: function prefix_key
+ * ----------------------------------
+ * First eight bytes of s, big-endian and zero padded past its end, so
+ * keys compare as unsigned integers in the order strcmp would give.
+ */
+static inline uint64_t prefix_key(const char *s)
+{
+    uint64_t key = 0;
+    bool ended = false;
+    for (int i = 0; i < 8; i++) {
+        unsigned char c = ended ? 0 : (unsigned char)s[i];
+        ended = c == '\0';
+        key = key << 8 | c;
+    }
+    return key;
+}
+
+/* Type: function lex_less
+ * ----------------------------------
+ * Keys are the prefixes. Equal prefixes with a zero low byte mean both
+ * lines ended inside them, so they are equal; otherwise strcmp
+ * settles it from the ninth byte on.
+ */
+static inline bool lex_less(const sort_entry *x, const sort_entry *y)
+{
+    if (x->key != y->key) return x->key < y->key;
+    if ((x->key & 0xFF) == 0) return false;
+    return strcmp(x->line->ptr + 8, y->line->ptr + 8) < 0;
+}
+
+/* Type: function length_key
+ * ----------------------------------
+ * Length in the top 24 bits, capped at LENGTH_KEY_MAX, over the first
+ * five bytes of the line, so most ties in length are settled by the
+ * key too.
+ */
+static inline uint64_t length_key(const char *s)
+{
+    size_t len = strlen(s);
+    return (uint64_t)(len < LENGTH_KEY_MAX ? len : LENGTH_KEY_MAX) << 40 | prefix_key(s) >> 24;
+}
+
+static inline bool length_less(const sort_entry *x, const sort_entry *y)
+{
+    if (x->key != y->key) return x->key < y->key;
+    if (x->key >> 40 == LENGTH_KEY_MAX) { // Both at the cap; the real lengths may differ
+        size_t xlen = strlen(x->line->ptr), ylen = strlen(y->line->ptr);
+        if (xlen != ylen) return xlen < ylen;
+    }
+    return strcmp(x->line->ptr, y->line->ptr) < 0;
+}
+
+// Keys are values; ties keep input order, which is array order.
+static inline bool numeric_less(const sort_entry *x, const sort_entry *y)
+{
+    if (x->key != y->key) return x->key < y->key;
+    return x->line < y->line;
+}
+
+#define SORT_SWAP(x, y, tmp) (tmp = (x), (x) = (y), (y) = tmp)
+
+/*
+ * SORT_KERNEL(name, T, less) defines name(T *a, size_t n), an introsort
+ * of a with less(const T *, const T *) inlined at every comparison:
+ * quicksort with a median-of-three pivot, insertion sort for
+ * partitions of up to SORT_INSERTION_MAX elements, and heapsort for any
+ * partition that recurses past 2 log2 n levels, bounding the worst case
+ * at O(n log n). Hoare partitioning stops on keys equal to the pivot
+ * from both sides, so runs of duplicates split evenly. The smaller side
+ * is recursed into and the larger one looped on, keeping the stack at
+ * O(log n).
+ */
+#define SORT_KERNEL(name, T, less) \
+static void name##_insertion(T *a, size_t n) \
+{ \
+    for (size_t i = 1; i < n; i++) { \
+        T x = a[i]; \
+        size_t j = i; \
+        for (; j > 0 && less(&x, &a[j - 1]); j--) a[j] = a[j - 1]; \
+        a[j] = x; \
+    } \
+} \
+static void name##_sift(T *a, size_t root, size_t n) \
+{ \
+    T x = a[root]; \
+    size_t child; \
+    while ((child = 2 * root + 1) < n) { \
+        if (child + 1 < n && less(&a[child], &a[child + 1])) child++; \
+        if (!less(&x, &a[child])) break; \
+        a[root] = a[child]; \
+        root = child; \
+    } \
+    a[root] = x; \
+} \
+static void name##_heapsort(T *a, size_t n) \
+{ \
+    T tmp; \
+    for (size_t i = n / 2; i-- > 0; ) name##_sift(a, i, n); \
+    for (size_t i = n; i-- > 1; ) { \
+        SORT_SWAP(a[0], a[i], tmp); \
+        name##_sift(a, 0, i); \
+    } \
+} \
+static void name##_intro(T *a, size_t n, int depth) \
+{ \
+    T tmp; \
+    while (n > SORT_INSERTION_MAX) { \
+        if (depth-- == 0) { \
+            name##_heapsort(a, n); \
+            return; \
+        } \
+        T *mid = a + n / 2, *last = a + n - 1; \
+        if (less(mid, a)) SORT_SWAP(*mid, *a, tmp); \
+        if (less(last, mid)) { \
+            SORT_SWAP(*last, *mid, tmp); \
+            if (less(mid, a)) SORT_SWAP(*mid, *a, tmp); \
+        } \
+        SORT_SWAP(*a, *mid, tmp); /* Pivot to a[0]; the minimum and maximum bound the scans */ \
+        size_t i = 0, j = n; \
+        for (;;) { \
+            do i++; while (less(&a[i], a)); \
+            do j--; while (less(a, &a[j])); \
+            if (i >= j) break; \
+            SORT_SWAP(a[i], a[j], tmp); \
+        } \
+        SORT_SWAP(a[0], a[j], tmp); \
+        if (j < n - j - 1) { \
+            name##_intro(a, j, depth); \
+            a += j + 1; \
+            n -= j + 1; \
+        } else { \
+            name##_intro(a + j + 1, n - j - 1, depth); \
+            n = j; \
+        } \
+    } \
+    name##_insertion(a, n); \
+} \
+static void name(T *a, size_t n) \
+{ \
+    int depth = 0; \
+    for (size_t m = n; m > 1; m >>= 1) depth += 2; \
+    name##_intro(a, n, depth); \
+}
+
+SORT_KERNEL(sort_lex, sort_entry, lex_less)
+SORT_KERNEL(sort_length, sort_entry, length_less)
+SORT_KERNEL(sort_numeric, sort_entry, numeric_less)
+
+/* Type: function line_sort
+ * ----------------------------------
+ * Builds a key for every line in one pass, sorts the (key, line)
+ * pairs with the kernel for the order, and writes the views back in
+ * their new order. Numeric keys are the values biased to sort
+ * unsigned; equal values fall back to array position, which keeps
+ * them in input order as glibc's merge-sort qsort does.
+ */
+void line_sort(line_view *lines, size_t n, sort_order order)
+{
+    sort_entry *entries = malloc(n * sizeof(sort_entry) + 1);
+    assert(entries);
+    for (size_t i = 0; i < n; i++) {
+        entries[i].line = &lines[i];
+        if (order == SORT_LEX) entries[i].key = prefix_key(lines[i].ptr);
+        else if (order == SORT_LENGTH) entries[i].key = length_key(lines[i].ptr);
+        else entries[i].key = (uint32_t)atoi(lines[i].ptr) ^ 0x80000000u;
+    }
+    if (order == SORT_LEX) sort_lex(entries, n);
+    else if (order == SORT_LENGTH) sort_length(entries, n);
+    else sort_numeric(entries, n);
+    line_view *sorted = (line_view *)entries; // Entry i is read before view i overwrites it
+    for (size_t i = 0; i < n; i++) sorted[i] = *entries[i].line;
+    memcpy(lines, sorted, n * sizeof(line_view));
+    free(entries);
+}
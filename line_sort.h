@@ -0,0 +1,29 @@
+#ifndef LINE_SORT_H
+#define LINE_SORT_H
+
+#include "read_line.h"
+#include <stddef.h>
+
+// The orders mysort offers: strcmp (default), length then strcmp (-l),
+// and atoi value with ties kept in input order (-n).
+typedef enum {
+    SORT_LEX,
+    SORT_LENGTH,
+    SORT_NUMERIC,
+    NSORT_ORDERS
+} sort_order;
+
+// qsort-style comparators, one per order, for containers that take a
+// comparison function. Elements are char * or line_view, whose first
+// member is the line.
+int cmp_pstr(const void *p, const void *q);
+int cmp_pstr_len(const void *p, const void *q);
+int cmp_pstr_numeric(const void *p, const void *q);
+
+// Sorts n lines in place by the order's comparator, with the comparison
+// inlined. Lines are compared up to their null terminator. Only the
+// numeric order is stable; lex and length ties are identical up to the
+// terminator, so the output still reads as a stable sort's would.
+void line_sort(line_view *lines, size_t n, sort_order order);
+
+#endif
@@ -1,10 +1,111 @@
+#define _GNU_SOURCE // qsort_r
+#include "getdents.h"
+#include "stats.h"
+#include "writer.h"
+#include <assert.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_WALK_THREADS 32
+#define MIN_STAT_PER_THREAD 256 // Smaller directories are stat'ed on one thread
+#define KEY_PREFIX_LEN 7 // Folded name bytes packed below the type rank byte
+
+// One directory entry. The name lives in the listing's arena at
+// name_off, so entries are small and sorting moves only records.
+typedef struct {
+    size_t name_off;
+    unsigned int len;
+    unsigned char type;
+    bool stat_ok;       // Fields below are valid (-l, -S, -t only)
+    unsigned short mode;
+    unsigned long long size;
+    long long mtime_sec;
+    unsigned int mtime_nsec;
+    unsigned long long sort_key; // Type rank and folded name prefix, see make_sort_key
+} entry_rec;
+
+// Everything read from one directory.
+typedef struct {
+    char *arena;
+    size_t arena_len, arena_cap;
+    entry_rec *entries;
+    size_t n, cap;
+} listing;
+
+// Command line flags.
+typedef struct {
+    bool show_all;
+    bool sort_by_type;
+    bool unsorted;
+    bool long_format;
+    bool sort_by_size;
+    bool sort_by_time;
+} ls_opts;
+
+// Argument to qsort_r comparison functions.
+typedef struct {
+    const char *arena;
+    const ls_opts *opts;
+} sort_ctx;
+
+// A stripe of entries for one statx thread.
+typedef struct {
+    int dirfd;
+    const char *arena;
+    entry_rec *entries;
+    size_t n;
+} stat_job;
+
+// One directory of a -R walk. A worker fills in its output and its
+// subdirectories (in listing order), then marks it done; the main
+// thread emits nodes in pre-order as they complete.
+typedef struct dir_node {
+    char *path;
+    writer out;             // In memory until the node's turn to be written
+    struct dir_node **children;
+    size_t nchildren;
+    int error;              // errno from opening the directory, or 0
+    bool done;
+} dir_node;
+
+// Per-worker double-ended queue. The owner pushes and pops at the
+// bottom (newest first, so it goes deep and stays cache-warm); idle
+// workers steal from the top (oldest, usually the biggest subtrees).
+typedef struct {
+    dir_node **tasks;
+    size_t top, bottom, cap;
+    pthread_mutex_t lock;
+} task_deque;
+
+// Shared state of a -R walk.
+typedef struct {
+    const ls_opts *opts;
+    task_deque *deques;
+    size_t nworkers;
+    size_t queued;          // Tasks sitting in deques
+    size_t pending;         // Tasks queued or running
+    pthread_mutex_t lock;   // Guards done flags and idle waits
+    pthread_cond_t work;    // Signalled when tasks are queued or the walk ends
+    pthread_cond_t finished; // Signalled when a node is done
+} walk_pool;
+
+// Argument to each worker thread.
+typedef struct {
+    walk_pool *pool;
+    size_t id;
+    char *dirent_buf;       // DIRENT_BUF_SIZE bytes, reused for every directory it reads
+} walk_worker;
 
 /* Type: function is_dir
  * ----------------------------------
@@ -17,112 +118,604 @@ bool is_dir(int filetype)
     return filetype == DT_DIR;
 }
 
-/* Type: comparison function compar_type
+/* Type: function make_sort_key
  * ----------------------------------
- * Passed into scandir function as its comparison function
- * to sort directories first, followed by non-directories,
- * alphabetically ordering within type.
+ * Packs everything the name order needs from an entry into one
+ * integer, computed once per entry: the top byte ranks directories
+ * before other files (only with -z), and the low bytes hold the
+ * first KEY_PREFIX_LEN bytes of the name folded to lower case as
+ * strcasecmp folds them, big-endian and zero padded. Comparing two
+ * keys as integers then agrees with the full comparison whenever
+ * the keys differ.
  */
-int compar_type(const struct dirent **entry1, const struct dirent **entry2) {
-    if (is_dir((*entry1)->d_type) == is_dir((*entry2)->d_type)) { // Both are same type, order alphabetically
-        return strcasecmp((*entry1)->d_name, (*entry2)->d_name);
-    } else if (is_dir((*entry2)->d_type)) {
-        return 1;
-    } else {
-        return -1;
+unsigned long long make_sort_key(const char *name, size_t len, bool dir, bool sort_by_type)
+{
+    unsigned long long key = sort_by_type && !dir ? 1 : 0;
+    for (size_t i = 0; i < KEY_PREFIX_LEN; i++) {
+        unsigned char ch = i < len ? (unsigned char)name[i] : 0;
+        if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+        key = key << 8 | ch;
     }
+    return key;
 }
 
 /* Type: comparison function compar_name
  * ----------------------------------
- * Passed into scandir function as its comparison function
- * to sort entries alphabetically case-insensitively by using
- * strcasecmp. Returns the relationship (less than, equal, 
- * greater than between entry1's name and entry2's name as an int.
+ * Sorts entries alphabetically case-insensitively. Decided by the
+ * packed sort keys unless they tie, in which case strcasecmp
+ * finishes the comparison past the shared prefix. Names that
+ * differ only in case are ordered by strcmp so the output does not
+ * depend on directory order.
  */
-int compar_name(const struct dirent **entry1, const struct dirent **entry2) {
-    return strcasecmp((*entry1)->d_name, (*entry2)->d_name);
+int compar_name(const entry_rec *entry1, const entry_rec *entry2, const char *arena)
+{
+    if (entry1->sort_key != entry2->sort_key) return entry1->sort_key < entry2->sort_key ? -1 : 1;
+    const char *name1 = arena + entry1->name_off;
+    const char *name2 = arena + entry2->name_off;
+    // Equal keys mean equal folded prefixes; a name shorter than the prefix is then equal throughout
+    size_t skip = entry1->len < KEY_PREFIX_LEN ? entry1->len : KEY_PREFIX_LEN;
+    int cmp = strcasecmp(name1 + skip, name2 + skip);
+    return cmp != 0 ? cmp : strcmp(name1, name2);
 }
 
-/* Type: filter starts_dot
+/* Type: comparison function compar_entry
  * ----------------------------------
- * Passed into scandir function as its filter function,
- * for functionality to exclude entries that start with
- * the "." character. scandir includes entries for which this
- * function returns nonzero and excludes entries for which
- * it returns zero.
+ * qsort_r comparison function for entry records. Applies, in
+ * order: directories first (-z), largest first (-S), newest
+ * first (-t), and finally the name order of compar_name. The
+ * -z rank is part of the sort key, so without -S or -t the whole
+ * order comes from compar_name.
  */
-int starts_dot(const struct dirent *entry) {
-    return strncmp(".", entry->d_name, 1);
+int compar_entry(const void *p, const void *q, void *arg)
+{
+    const entry_rec *entry1 = p, *entry2 = q;
+    const sort_ctx *ctx = arg;
+    if (!ctx->opts->sort_by_size && !ctx->opts->sort_by_time) return compar_name(entry1, entry2, ctx->arena);
+    if (ctx->opts->sort_by_type && is_dir(entry1->type) != is_dir(entry2->type)) {
+        return is_dir(entry2->type) ? 1 : -1;
+    }
+    if (ctx->opts->sort_by_size && entry1->size != entry2->size) {
+        return entry1->size < entry2->size ? 1 : -1;
+    }
+    if (ctx->opts->sort_by_time) {
+        if (entry1->mtime_sec != entry2->mtime_sec) return entry1->mtime_sec < entry2->mtime_sec ? 1 : -1;
+        if (entry1->mtime_nsec != entry2->mtime_nsec) return entry1->mtime_nsec < entry2->mtime_nsec ? 1 : -1;
+    }
+    return compar_name(entry1, entry2, ctx->arena);
+}
+
+/* Type: function out_entry
+ * ----------------------------------
+ * Appends one entry's output line: its name, a trailing "/"
+ * for directories, and a newline.
+ */
+void out_entry(writer *out, const char *name, size_t len, int type)
+{
+    writer_write(out, name, len);
+    if (is_dir(type)) writer_char(out, '/');
+    writer_char(out, '\n');
+}
+
+/* Type: function listing_add
+ * ----------------------------------
+ * Copies an entry's name into the arena and records it.
+ */
+void listing_add(listing *l, const char *name, size_t len, unsigned char type)
+{
+    if (l->arena_len + len + 1 > l->arena_cap) {
+        while (l->arena_len + len + 1 > l->arena_cap) l->arena_cap = l->arena_cap ? l->arena_cap * 2 : 4096;
+        l->arena = realloc(l->arena, l->arena_cap);
+        assert(l->arena);
+    }
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 256;
+        l->entries = realloc(l->entries, sizeof(entry_rec) * l->cap);
+        assert(l->entries);
+    }
+    memcpy(l->arena + l->arena_len, name, len + 1);
+    l->entries[l->n++] = (entry_rec){l->arena_len, len, type, false, 0, 0, 0, 0, 0};
+    l->arena_len += len + 1;
+}
+
+/* Type: function is_dots
+ * ----------------------------------
+ * Returns whether name is "." or "..".
+ */
+static inline bool is_dots(const char *name)
+{
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/* Type: function read_listing
+ * ----------------------------------
+ * Reads the open directory fd in large getdents64 batches,
+ * skipping entries that start with "." unless show_all is set,
+ * and skipping "." and ".." themselves when skip_dots is set.
+ * Filesystems that do not report d_type get one fstatat per
+ * entry. buf is DIRENT_BUF_SIZE bytes of scratch space, owned by
+ * the caller so a -R worker can reuse one for every directory.
+ * If stream is non-NULL, entries are written to it as
+ * they are read and not kept; otherwise they are added to l.
+ */
+void read_listing(int fd, const ls_opts *opts, bool skip_dots, char *buf, listing *l, writer *stream)
+{
+    long nread;
+    while ((nread = read_dirents(fd, buf, DIRENT_BUF_SIZE)) > 0) {
+        for (long off = 0; off < nread; ) {
+            const linux_dirent64 *entry = (const linux_dirent64 *)(buf + off);
+            off += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (!opts->show_all && name[0] == '.') continue; // Filter out entries that start with "."
+            if (skip_dots && is_dots(name)) continue;
+            unsigned char type = entry->d_type;
+            struct stat st;
+            if (type == DT_UNKNOWN && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                type = IFTODT(st.st_mode); // Stays DT_UNKNOWN if even that fails
+            }
+            if (stream != NULL) {
+                out_entry(stream, name, strlen(name), type);
+            } else {
+                listing_add(l, name, strlen(name), type);
+            }
+        }
+    }
+}
+
+/* Type: function needs_stat
+ * ----------------------------------
+ * Returns whether the flags need anything beyond the names and
+ * types that getdents64 already provides.
+ */
+bool needs_stat(const ls_opts *opts)
+{
+    return opts->long_format || opts->sort_by_size || opts->sort_by_time;
+}
+
+/* Type: function stat_stripe
+ * ----------------------------------
+ * Thread body that fills in metadata for a stripe of entries with
+ * statx relative to the directory fd, so the kernel never resolves
+ * full paths. Only mode, size and mtime are requested, which lets
+ * filesystems skip the rest. Symbolic links describe themselves.
+ */
+void *stat_stripe(void *arg)
+{
+    stat_job *job = arg;
+    for (size_t i = 0; i < job->n; i++) {
+        entry_rec *e = &job->entries[i];
+        struct statx stx;
+        if (statx(job->dirfd, job->arena + e->name_off, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                  STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, &stx) != 0) continue;
+        e->stat_ok = true;
+        e->mode = stx.stx_mode;
+        e->size = stx.stx_size;
+        e->mtime_sec = stx.stx_mtime.tv_sec;
+        e->mtime_nsec = stx.stx_mtime.tv_nsec;
+    }
+    return NULL;
+}
+
+/* Type: function stat_listing
+ * ----------------------------------
+ * Gathers metadata for every entry, splitting large directories
+ * into contiguous stripes across up to max_threads threads so
+ * metadata reads overlap instead of queueing one at a time.
+ */
+void stat_listing(int fd, listing *l, size_t max_threads)
+{
+    size_t nthreads = l->n / MIN_STAT_PER_THREAD;
+    if (nthreads > max_threads) nthreads = max_threads;
+    if (nthreads < 1) nthreads = 1;
+    stat_job jobs[MAX_WALK_THREADS];
+    pthread_t threads[MAX_WALK_THREADS];
+    for (size_t t = 0; t < nthreads; t++) {
+        size_t start = l->n * t / nthreads, end = l->n * (t + 1) / nthreads;
+        jobs[t] = (stat_job){fd, l->arena, l->entries + start, end - start};
+        if (t > 0 && pthread_create(&threads[t], NULL, stat_stripe, &jobs[t]) != 0) error(1, 0, "cannot create thread");
+    }
+    stat_stripe(&jobs[0]);
+    for (size_t t = 1; t < nthreads; t++) pthread_join(threads[t], NULL);
+}
+
+/* Type: function sort_listing
+ * ----------------------------------
+ * Sorts the gathered entry records as the flags ask, after
+ * decorating each with its packed sort key so case folding and
+ * type checks happen once per entry instead of once per
+ * comparison. Leaves directory order with unsorted.
+ */
+void sort_listing(listing *l, const ls_opts *opts)
+{
+    if (opts->unsorted || l->n == 0) return; // qsort_r must not see the NULL array of an empty directory
+    for (size_t i = 0; i < l->n; i++) {
+        entry_rec *e = &l->entries[i];
+        e->sort_key = make_sort_key(l->arena + e->name_off, e->len, is_dir(e->type), opts->sort_by_type);
+    }
+    sort_ctx ctx = {l->arena, opts};
+    qsort_r(l->entries, l->n, sizeof(entry_rec), compar_entry, &ctx);
+}
+
+/* Type: function mode_string
+ * ----------------------------------
+ * Writes the ten-character type and permission string for mode,
+ * as in "drwxr-xr-x", into str. Setuid and setgid show as s in the
+ * owner or group execute place and the sticky bit as t in the other
+ * one, capitalized when the execute bit under them is off.
+ */
+void mode_string(unsigned int mode, char str[11])
+{
+    const char *types = "?pc?d?b?-?l?s???"; // Indexed by the S_IFMT bits
+    str[0] = types[(mode & S_IFMT) >> 12];
+    const char *rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++) str[i + 1] = mode & (0400 >> i) ? rwx[i] : '-';
+    if (mode & S_ISUID) str[3] = mode & S_IXUSR ? 's' : 'S';
+    if (mode & S_ISGID) str[6] = mode & S_IXGRP ? 's' : 'S';
+    if (mode & S_ISVTX) str[9] = mode & S_IXOTH ? 't' : 'T';
+    str[10] = '\0';
+}
+
+/* Type: function out_listing
+ * ----------------------------------
+ * Appends every entry in l to out. In long format each line is
+ * the mode string, the size right-aligned to the widest size in
+ * the directory, and the local modification time before the name.
+ */
+void out_listing(writer *out, const listing *l, const ls_opts *opts)
+{
+    int width = 1;
+    if (opts->long_format) {
+        for (size_t i = 0; i < l->n; i++) {
+            char digits[WRITER_LONG_MAX];
+            int len = format_long(digits, l->entries[i].size, 0);
+            if (len > width) width = len;
+        }
+    }
+    for (size_t i = 0; i < l->n; i++) { // Print each entry in array
+        const entry_rec *e = &l->entries[i];
+        if (opts->long_format) {
+            if (e->stat_ok) {
+                char mode[11], when[32];
+                mode_string(e->mode, mode);
+                time_t mtime = e->mtime_sec;
+                struct tm tm;
+                size_t when_len = strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime_r(&mtime, &tm));
+                writer_write(out, mode, 10);
+                writer_char(out, ' ');
+                writer_long(out, e->size, width);
+                writer_char(out, ' ');
+                writer_write(out, when, when_len);
+                writer_char(out, ' ');
+            } else { // Entry vanished or cannot be stat'ed
+                char line[128];
+                int len = snprintf(line, sizeof(line), "%-10s %*s %-16s ", "?", width, "?", "?");
+                writer_write(out, line, len);
+            }
+        }
+        out_entry(out, l->arena + e->name_off, e->len, e->type);
+    }
 }
 
 /* Type: function ls
  * ----------------------------------
- * Takes a pointer to the directory and the booleans for
- * the command line flags. Scans the directory according
- * to the presence or absence of flags and then prints
- * the directory's entries.
- */
-void ls(const char *dir, bool show_all, bool sort_by_type)
-{
-    struct dirent **entrylist;
-    int n;
-    if (show_all) { // Don't filter out entries that start with "."
-        n = scandir(dir, &entrylist, NULL, compar_name);
-    } else if (sort_by_type) { // Directories > non-directories
-        n = scandir(dir, &entrylist, starts_dot, compar_type);
-    } else { // No flags
-        n = scandir(dir, &entrylist, starts_dot, compar_name);
-    }
-
-    if (n < 0) { // Handle failure
-        error(EXIT_FAILURE, 0, "cannot access %s: No such directory", dir);
-    } else { // scandir successful
-       for (int i = 0; i < n; i++) { // Print each entry in array
-        if (is_dir(entrylist[i]->d_type)) {
-            printf("%s/\n", entrylist[i]->d_name);
+ * Takes a pointer to the directory, the command line flags and
+ * the output writer. Names are copied into one arena, metadata
+ * is gathered in parallel if the flags need it, and the compact
+ * entry records are sorted, then written to out.
+ * With unsorted (and no metadata needed), entries are written
+ * out as they are read and nothing is kept.
+ */
+void ls(const char *dir, const ls_opts *opts, writer *out)
+{
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        writer_flush(out); // Keep earlier listings ahead of the message, as stdio did
+        error(EXIT_FAILURE, 0, "cannot access %s: No such directory", dir); // Handle failure
+    }
+
+    listing l = {0};
+    char *buf = malloc(DIRENT_BUF_SIZE);
+    assert(buf);
+    read_listing(fd, opts, false, buf, &l, opts->unsorted && !needs_stat(opts) ? out : NULL);
+    free(buf);
+    if (needs_stat(opts)) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        stat_listing(fd, &l, ncpus < 1 ? 1 : ncpus > MAX_WALK_THREADS ? MAX_WALK_THREADS : ncpus);
+    }
+    close(fd);
+    sort_listing(&l, opts);
+    out_listing(out, &l, opts);
+    free(l.arena);
+    free(l.entries);
+}
+
+/* Type: function node_new
+ * ----------------------------------
+ * Creates a -R node for path, taking ownership of the string.
+ */
+dir_node *node_new(char *path)
+{
+    dir_node *node = calloc(1, sizeof(dir_node));
+    assert(node);
+    node->path = path;
+    writer_init(&node->out, -1);
+    return node;
+}
+
+/* Type: function deque_push
+ * ----------------------------------
+ * Pushes a task at the bottom of a worker's deque.
+ */
+void deque_push(task_deque *d, dir_node *node)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom == d->cap) {
+        if (d->top > 0) { // Reclaim space left behind by steals
+            memmove(d->tasks, d->tasks + d->top, sizeof(dir_node *) * (d->bottom - d->top));
+            d->bottom -= d->top;
+            d->top = 0;
+        }
+        if (d->bottom == d->cap) {
+            d->cap = d->cap ? d->cap * 2 : 64;
+            d->tasks = realloc(d->tasks, sizeof(dir_node *) * d->cap);
+            assert(d->tasks);
+        }
+    }
+    d->tasks[d->bottom++] = node;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* Type: function deque_take
+ * ----------------------------------
+ * Removes a task from the bottom (owner) or top (thief) of a
+ * deque. Returns NULL if it is empty.
+ */
+dir_node *deque_take(task_deque *d, bool steal)
+{
+    dir_node *node = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->top < d->bottom) node = steal ? d->tasks[d->top++] : d->tasks[--d->bottom];
+    pthread_mutex_unlock(&d->lock);
+    return node;
+}
+
+/* Type: function list_node
+ * ----------------------------------
+ * Does the work for one -R node: reads and sorts the directory,
+ * formats its output, and creates child nodes for its
+ * subdirectories in output order, queueing each on the calling
+ * worker's deque. With -a, "." and ".." are listed as ls lists
+ * them but never descended into. Opening the directory relative
+ * to nothing but its path keeps workers independent of one another.
+ */
+void list_node(walk_worker *self, dir_node *node)
+{
+    walk_pool *pool = self->pool;
+    int fd = open(node->path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        node->error = errno;
+        return;
+    }
+    listing l = {0};
+    read_listing(fd, pool->opts, !pool->opts->show_all, self->dirent_buf, &l, NULL);
+    if (needs_stat(pool->opts)) stat_listing(fd, &l, 1); // Workers already run in parallel
+    close(fd);
+    sort_listing(&l, pool->opts);
+
+    writer_str(&node->out, node->path);
+    writer_write(&node->out, ":\n", 2);
+    out_listing(&node->out, &l, pool->opts);
+    size_t ndirs = 0;
+    for (size_t i = 0; i < l.n; i++) {
+        if (is_dir(l.entries[i].type) && !is_dots(l.arena + l.entries[i].name_off)) ndirs++;
+    }
+    writer_char(&node->out, '\n');
+
+    node->children = malloc(sizeof(dir_node *) * (ndirs + 1));
+    assert(node->children);
+    size_t path_len = strlen(node->path);
+    bool slash = path_len > 0 && node->path[path_len - 1] == '/';
+    for (size_t i = 0; i < l.n; i++) {
+        if (!is_dir(l.entries[i].type) || is_dots(l.arena + l.entries[i].name_off)) continue;
+        char *path = malloc(path_len + l.entries[i].len + 2);
+        assert(path);
+        sprintf(path, slash ? "%s%s" : "%s/%s", node->path, l.arena + l.entries[i].name_off);
+        node->children[node->nchildren++] = node_new(path);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->pending += node->nchildren;
+    pool->queued += node->nchildren;
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = node->nchildren; i-- > 0; ) { // Reversed so the first subdirectory is popped first
+        deque_push(&pool->deques[self->id], node->children[i]);
+    }
+    if (node->nchildren > 0) pthread_cond_broadcast(&pool->work);
+    free(l.arena);
+    free(l.entries);
+}
+
+/* Type: function walk_worker_main
+ * ----------------------------------
+ * Worker loop: pops its own newest task, or steals the oldest
+ * task from another worker, and sleeps only when no task is
+ * queued anywhere. Exits once every task has finished.
+ */
+void *walk_worker_main(void *arg)
+{
+    walk_worker *self = arg;
+    walk_pool *pool = self->pool;
+    while (true) {
+        dir_node *node = deque_take(&pool->deques[self->id], false);
+        for (size_t i = 1; node == NULL && i < pool->nworkers; i++) {
+            node = deque_take(&pool->deques[(self->id + i) % pool->nworkers], true);
+        }
+        if (node == NULL) {
+            pthread_mutex_lock(&pool->lock);
+            while (pool->queued == 0 && pool->pending > 0) pthread_cond_wait(&pool->work, &pool->lock);
+            bool finished = pool->pending == 0;
+            pthread_mutex_unlock(&pool->lock);
+            if (finished) return NULL;
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+
+        list_node(self, node);
+
+        pthread_mutex_lock(&pool->lock);
+        node->done = true;
+        pool->pending--;
+        pthread_cond_broadcast(&pool->finished);
+        if (pool->pending == 0) pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* Type: function emit_tree
+ * ----------------------------------
+ * Writes the -R output in pre-order (a directory, then each of
+ * its subdirectories in listing order), waiting for each node to
+ * be finished by the workers and freeing it once written. Uses an
+ * explicit stack so deep trees cannot overflow the call stack.
+ * Returns false if any directory could not be opened.
+ */
+bool emit_tree(walk_pool *pool, dir_node *root, writer *out)
+{
+    bool ok = true;
+    size_t depth = 0, cap = 64;
+    dir_node **stack = malloc(sizeof(dir_node *) * cap);
+    assert(stack);
+    stack[depth++] = root;
+    while (depth > 0) {
+        dir_node *node = stack[--depth];
+        pthread_mutex_lock(&pool->lock);
+        while (!node->done) pthread_cond_wait(&pool->finished, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+        if (node->error != 0) {
+            writer_flush(out);
+            if (node == root) error(0, 0, "cannot access %s: No such directory", node->path); // As ls reports it
+            else error(0, node->error, "cannot open directory %s", node->path);
+            ok = false;
         } else {
-            printf("%s\n", entrylist[i]->d_name);
+            writer_write(out, node->out.buf, node->out.len);
+        }
+        if (depth + node->nchildren > cap) {
+            while (depth + node->nchildren > cap) cap *= 2;
+            stack = realloc(stack, sizeof(dir_node *) * cap);
+            assert(stack);
         }
-        free(entrylist[i]);
+        for (size_t i = node->nchildren; i-- > 0; ) stack[depth++] = node->children[i];
+        free(node->children);
+        writer_dispose(&node->out);
+        free(node->path);
+        free(node);
     }
-    free(entrylist);
+    free(stack);
+    return ok;
 }
+
+/* Type: function ls_recursive
+ * ----------------------------------
+ * Lists dir and every directory below it (-R). Directories are
+ * read in parallel by a work-stealing pool of one thread per CPU,
+ * while the calling thread writes finished directories out in the
+ * same order a serial walk would produce. Symbolic links to
+ * directories are not followed. Returns false if any directory
+ * could not be opened.
+ */
+bool ls_recursive(const char *dir, const ls_opts *opts, writer *out)
+{
+    walk_pool pool = {0};
+    pool.opts = opts;
+    pool.queued = pool.pending = 1; // The root
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    pool.nworkers = ncpus < 1 ? 1 : ncpus > MAX_WALK_THREADS ? MAX_WALK_THREADS : ncpus;
+    pool.deques = calloc(pool.nworkers, sizeof(task_deque));
+    walk_worker *workers = malloc(sizeof(walk_worker) * pool.nworkers);
+    pthread_t *threads = malloc(sizeof(pthread_t) * pool.nworkers);
+    assert(pool.deques && workers && threads);
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.work, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+    for (size_t i = 0; i < pool.nworkers; i++) pthread_mutex_init(&pool.deques[i].lock, NULL);
+
+    dir_node *root = node_new(strdup(dir));
+    deque_push(&pool.deques[0], root);
+    for (size_t i = 0; i < pool.nworkers; i++) {
+        workers[i] = (walk_worker){&pool, i, malloc(DIRENT_BUF_SIZE)};
+        assert(workers[i].dirent_buf);
+        if (pthread_create(&threads[i], NULL, walk_worker_main, &workers[i]) != 0) error(1, 0, "cannot create thread");
+    }
+    bool ok = emit_tree(&pool, root, out);
+    for (size_t i = 0; i < pool.nworkers; i++) pthread_join(threads[i], NULL);
+
+    for (size_t i = 0; i < pool.nworkers; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].tasks);
+        free(workers[i].dirent_buf);
+    }
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.work);
+    pthread_cond_destroy(&pool.finished);
+    free(pool.deques);
+    free(workers);
+    free(threads);
+    return ok;
 }
 
 /* myls
  * ----------------------------------
  * Lists a directory's contents given zero or more
  * directory paths from the command line. Supports 
- * two flags: -a to show hidden directories that 
- * start with ".", and -z to sort directories first
- * and non-directories second. Utilizes the scandir
- * function with custom filter and comparison functions.
+ * these flags: -a to show hidden directories that 
+ * start with ".", -z to sort directories first
+ * and non-directories second, -f to list entries
+ * unsorted in directory order, -R to list every
+ * directory below each path as well, -l for mode,
+ * size and modification time, and -S / -t to sort
+ * by size or time, largest or newest first. Reads
+ * directories with getdents64 rather than scandir.
  */
 int main(int argc, char *argv[])
 {
-    bool show_all = false;
-    bool dirs_first = false;
+    STATS_INIT(&argc, argv);
+    ls_opts opts = {false, false, false, false, false, false};
+    bool recursive = false;
 
     int opt;
-    while ((opt = getopt(argc, argv, "az")) != -1) { // Process command line flags by 
+    while ((opt = getopt(argc, argv, "afzRlSt")) != -1) { // Process command line flags by 
         //calling getopt, which returns only values prefixed with '-' and -1 with none remaining
         switch (opt) { // Turns on boolean for appropriate flag
-            case 'a': show_all = true; break; // Don't ignore entries that start with .
-            case 'z': dirs_first = true; break; // Sort directories first followed by non-directories
+            case 'a': opts.show_all = true; break; // Don't ignore entries that start with .
+            case 'z': opts.sort_by_type = true; break; // Sort directories first followed by non-directories
+            case 'f': opts.unsorted = true; break; // Directory order, no sorting
+            case 'R': recursive = true; break; // Descend into subdirectories
+            case 'l': opts.long_format = true; break; // Mode, size and mtime
+            case 'S': opts.sort_by_size = true; break; // Largest first
+            case 't': opts.sort_by_time = true; break; // Newest first
             default: exit(1);
         }
     }
-    if (optind < argc -1) { // External variable updated by getopt of argv index
+    writer out;
+    writer_init(&out, STDOUT_FILENO);
+    int status = 0;
+    if (recursive) { // Every directory gets a "path:" header already
+        if (optind == argc && !ls_recursive(".", &opts, &out)) status = EXIT_FAILURE;
+        for (int i = optind; i < argc; i++) {
+            if (!ls_recursive(argv[i], &opts, &out)) status = EXIT_FAILURE;
+        }
+    } else if (optind < argc -1) { // External variable updated by getopt of argv index
         // of first argv element that doesn't start with '-'; therefore, process
         // all remaining arguments
         for (int i = optind; i < argc; i++) {
-            printf("%s:\n", argv[i]);
-            ls(argv[i], show_all, dirs_first);
-            printf("\n");
+            writer_str(&out, argv[i]);
+            writer_write(&out, ":\n", 2);
+            ls(argv[i], &opts, &out);
+            writer_char(&out, '\n');
         }
     } else { // No paths, print from current directory
-        ls(optind == argc -1? argv[optind] : ".", show_all, dirs_first); 
+        ls(optind == argc -1? argv[optind] : ".", &opts, &out);
     }
-    return 0;
+    writer_dispose(&out);
+    return status;
 }
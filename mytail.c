@@ -1,52 +1,34 @@
 #include "samples/prototypes.h"
+#include "batch_reader.h"
+#include "filters.h"
+#include "stats.h"
+#include "writer.h"
 #include <error.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdbool.h>
-#include <string.h>
-
-#define MAX_NLINES_ON_STACK 10000
+#include <unistd.h>
 
 /* Type: function print_last_n
  * ----------------------------------
- * Creates an array holding n lines from an inputted
- * file. Stores it on the stack if n < MAX_NLINES_ON_STACK
- * and if greater, dynamically on the heap carefully
- * tracking memory allocation to avoid leaks. Acts as
- * a circular array with wraparound advancement so that
- * a window of size 10 lines is incremented across the
- * entire file.
+ * Reads lines from an inputted file in batches from a
+ * batch_reader and feeds them to a tail stage, which keeps
+ * a window of the last n lines, copying only those that
+ * can end up in it. The window is written through out.
  */
-void print_last_n(FILE *fp, int n)
+void print_last_n(FILE *fp, int n, writer *out)
 {
-    char *lines[MAX_NLINES_ON_STACK];
-    char **arrayptr = lines;
-    if (n >= MAX_NLINES_ON_STACK) arrayptr = malloc(sizeof(char *) * n);
-    char *line = NULL;
-    for (int i = 0; i < n; i++) { // Fill first n spots in the array
-        line = read_line(fp);
-        if (!line) break; // No more lines
-        arrayptr[i] = line;
-    }
-    int index = n - 1; // Set to highest value for index
-    while (line) { // n > number of lines
-        index = (index + 1) % n; // Use integer division to wraparound advance
-        line = read_line(fp);
-        if (!line) break; // No more lines
-        free(arrayptr[index]);
-        arrayptr[index] = line;
-    }
-    for (int i = index; i < n; i++) { // Print from index to n
-        printf("%s\n", arrayptr[i]);
-    }
-    for (int i = 0; i < index; i++) { // Print from 0 up to index
-        printf("%s\n", arrayptr[i]);
-    }
-    for (int i = 0; i < n; i++) {
-        free(arrayptr[i]);
+    tail_stage t;
+    tail_init(&t, n);
+    batch_reader reader;
+    batch_reader_init(&reader, fp);
+    line_batch *batch;
+    while ((batch = batch_reader_next(&reader)) != NULL) {
+        tail_feed(&t, batch->lines, batch->nlines);
+        batch_reader_release(&reader, batch);
     }
-    if (n >= MAX_NLINES_ON_STACK) free(arrayptr);
+    batch_reader_dispose(&reader);
+    tail_finish(&t, writer_sink(out));
 }
 
 /* Type: function convert_arg
@@ -73,6 +55,7 @@ int convert_arg(const char *str)
  */
 int main(int argc, char *argv[])
 {
+    STATS_INIT(&argc, argv);
     int num = 10; // Default value for n
 
     if (argc > 1 && argv[1][0] == '-') { // Handle user inputted value for n
@@ -88,7 +71,10 @@ int main(int argc, char *argv[])
         fp = fopen(argv[1], "r");
         if (fp == NULL) error(1, 0, "%s: no such file", argv[1]);
     }
-    print_last_n(fp, num);
+    writer out;
+    writer_init(&out, STDOUT_FILENO);
+    print_last_n(fp, num, &out);
+    writer_dispose(&out);
     fclose(fp);
     return 0;
 }
@@ -1,58 +1,299 @@
 #include "samples/prototypes.h"
+#include "batch_reader.h"
+#include "filters.h"
+#include "stats.h"
+#include "writer.h"
+#include <assert.h>
 #include <error.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MIN_CHUNK_SIZE (1 << 16) // Below this, extra threads cost more than they save
+#define MAX_THREADS 256
+
+// A run of identical adjacent lines inside a mapped file.
+typedef struct {
+    const char *line;
+    size_t len;
+    long count;
+} line_run;
+
+// Work for one thread in -j mode. The thread scans [start, end), keeps
+// the first and last runs aside because they may continue into the
+// neighbouring chunks, and formats every run in between into out.
+typedef struct {
+    const char *start;
+    const char *end;
+    line_run first;
+    line_run last;
+    size_t nruns;
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+} uniq_chunk;
 
 /* Type: function print_uniq_lines
  * ----------------------------------
- * Takes pointer to a FILE struct, calling read_line
- * to process each line. Keeps count of repeating lines,
- * printing each line after it doesn't occur consecutively
- * with the number of occurrences as a prefix followed by
- * the line.
+ * Takes pointer to a FILE struct, reading its lines in
+ * batches from a batch_reader and feeding each batch to a
+ * uniq stage, which prints each run of repeated lines once
+ * with the number of occurrences as a prefix. The stage
+ * copies the pending line before a batch is handed back.
+ */
+void print_uniq_lines(FILE *fp, writer *out)
+{
+    line_sink sink = writer_count_sink(out);
+    uniq_stage u;
+    uniq_init(&u);
+    batch_reader reader;
+    batch_reader_init(&reader, fp);
+    line_batch *batch;
+    while ((batch = batch_reader_next(&reader)) != NULL) {
+        uniq_feed(&u, batch->lines, batch->nlines, sink);
+        batch_reader_release(&reader, batch);
+    }
+    uniq_finish(&u, sink);
+    uniq_dispose(&u);
+    batch_reader_dispose(&reader);
+}
+
+/* Type: function print_all_counts
+ * ----------------------------------
+ * Takes pointer to a FILE struct and counts every distinct line in a
+ * single pass with a count stage, regardless of whether duplicates
+ * are adjacent. Prints each line with its count in order of first
+ * occurrence, or only the top_k most frequent lines when top_k is
+ * nonzero.
  */
-void print_uniq_lines(FILE *fp)
+void print_all_counts(FILE *fp, size_t top_k, writer *out)
 {
-    int count = 1;
-    char *curr = read_line(fp);
-    while (curr != NULL) {
-        char *prev = malloc(sizeof(char)*strlen(curr) + 1);
-        prev = strcpy(prev, curr);
-        free(curr);
-        curr = read_line(fp);
-        if (curr == NULL) { // Reach EOF, print last prev and free
-            printf("%6d %s\n", count, prev);
-            free(curr);
-            free(prev);
-            break;
+    STATS_PHASE("count");
+    count_stage c;
+    count_init(&c);
+    batch_reader reader;
+    batch_reader_init(&reader, fp);
+    line_batch *batch;
+    while ((batch = batch_reader_next(&reader)) != NULL) {
+        count_feed(&c, batch->lines, batch->nlines);
+        batch_reader_release(&reader, batch);
+    }
+    batch_reader_dispose(&reader);
+    STATS_PHASE("write");
+    count_finish(&c, top_k, writer_count_sink(out));
+    STATS_PHASE(NULL);
+}
+
+/* Type: function append_run
+ * ----------------------------------
+ * Formats run exactly as writer_count_sink would print it and appends
+ * it to the chunk's output buffer, growing the buffer as needed.
+ */
+void append_run(uniq_chunk *c, const line_run *run)
+{
+    size_t needed = run->len + 32; // Count field, space and newline
+    if (c->out_len + needed > c->out_cap) {
+        while (c->out_len + needed > c->out_cap) c->out_cap = c->out_cap ? c->out_cap * 2 : MIN_CHUNK_SIZE;
+        c->out = realloc(c->out, c->out_cap);
+        assert(c->out);
+    }
+    c->out_len += format_long(c->out + c->out_len, run->count, 6);
+    c->out[c->out_len++] = ' ';
+    memcpy(c->out + c->out_len, run->line, run->len);
+    c->out_len += run->len;
+    c->out[c->out_len++] = '\n';
+}
+
+/* Type: function uniq_chunk_worker
+ * ----------------------------------
+ * Thread body for -j mode. Splits the chunk into lines with memchr and
+ * collapses adjacent duplicates into runs. Only interior runs are
+ * formatted here; the first and last are left for the main thread to
+ * stitch against the neighbouring chunks.
+ */
+void *uniq_chunk_worker(void *arg)
+{
+    uniq_chunk *c = arg;
+    line_run curr = {NULL, 0, 0};
+    const char *p = c->start;
+    while (p < c->end) {
+        const char *nl = memchr(p, '\n', c->end - p);
+        size_t len = (nl ? nl : c->end) - p;
+        if (curr.count != 0 && curr.len == len && memcmp(curr.line, p, len) == 0) {
+            curr.count++;
+        } else {
+            if (curr.count != 0) {
+                if (c->nruns == 0) {
+                    c->first = curr;
+                } else if (c->nruns > 1) { // Run between first and last
+                    append_run(c, &c->last);
+                }
+                if (c->nruns > 0) c->last = curr;
+                c->nruns++;
+            }
+            curr.line = p;
+            curr.len = len;
+            curr.count = 1;
         }
-        if (strcmp(prev, curr) == 0) { // Consecutive occurrence increments count
-            count++;
-        } else { // Not consecutive occurrence, print prev and reset count
-            printf("%6d %s\n", count, prev);
-            count = 1;
+        p += len + 1;
+    }
+    if (curr.count != 0) {
+        if (c->nruns == 0) {
+            c->first = curr;
+        } else if (c->nruns > 1) {
+            append_run(c, &c->last);
         }
-        free(prev);
+        c->last = curr;
+        c->nruns++;
     }
+    return NULL;
+}
+
+/* Type: function print_uniq_parallel
+ * ----------------------------------
+ * Parallel version of print_uniq_lines for a regular file. Maps the
+ * file, splits it into nthreads chunks whose boundaries are moved
+ * forward to the next newline, and collapses each chunk on its own
+ * thread. Runs that straddle a chunk boundary are merged while the
+ * results are written out in order, so the output is byte-identical
+ * to the serial mode. Returns false if the file cannot be mapped, in
+ * which case the caller should fall back to the serial path.
+ */
+bool print_uniq_parallel(FILE *fp, int nthreads, writer *out)
+{
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    size_t size = st.st_size;
+    if (size == 0) return true;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (data == MAP_FAILED) return false;
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    const char *end = data + size;
+    size_t nchunks = nthreads;
+    if (nchunks > size / MIN_CHUNK_SIZE) nchunks = size / MIN_CHUNK_SIZE;
+    if (nchunks == 0) nchunks = 1;
+
+    uniq_chunk *chunks = calloc(nchunks, sizeof(uniq_chunk));
+    pthread_t *threads = malloc(sizeof(pthread_t) * nchunks);
+    assert(chunks && threads);
+    const char *start = data;
+    for (size_t i = 0; i < nchunks; i++) {
+        const char *split = end;
+        if (i + 1 < nchunks) { // Advance nominal split point past the next newline
+            split = data + size / nchunks * (i + 1);
+            if (split < start) split = start;
+            const char *nl = split < end ? memchr(split, '\n', end - split) : NULL;
+            split = nl ? nl + 1 : end;
+        }
+        chunks[i].start = start;
+        chunks[i].end = split;
+        start = split;
+    }
+    for (size_t i = 1; i < nchunks; i++) {
+        if (pthread_create(&threads[i], NULL, uniq_chunk_worker, &chunks[i]) != 0)
+            error(1, 0, "cannot create thread");
+    }
+    uniq_chunk_worker(&chunks[0]); // Main thread takes the first chunk
+
+    line_sink sink = writer_count_sink(out);
+    line_run pending = {NULL, 0, 0};
+    for (size_t i = 0; i < nchunks; i++) {
+        if (i > 0) pthread_join(threads[i], NULL);
+        uniq_chunk *c = &chunks[i];
+        if (c->nruns == 0) continue;
+        if (pending.count != 0 && pending.len == c->first.len
+            && memcmp(pending.line, c->first.line, pending.len) == 0) {
+            pending.count += c->first.count; // Run continues across the seam
+        } else {
+            if (pending.count != 0) sink.emit(sink.ctx, pending.line, pending.len, pending.count);
+            pending = c->first;
+        }
+        if (c->nruns > 1) {
+            sink.emit(sink.ctx, pending.line, pending.len, pending.count);
+            writer_write(out, c->out, c->out_len); // Large, so written straight from the chunk
+            pending = c->last;
+        }
+        free(c->out);
+    }
+    if (pending.count != 0) sink.emit(sink.ctx, pending.line, pending.len, pending.count);
+    free(threads);
+    free(chunks);
+    munmap(data, size);
+    return true;
+}
+
+/* Type: function convert_arg
+ * ----------------------------------
+ * Takes a number passed as a string on the command
+ * line and uses strtol to convert it to an int.
+ */
+int convert_arg(const char *str)
+{
+    char *end;
+    long n = strtol(str, &end, 10);
+    if (*end != '\0')
+        error(1, 0, "Invalid number '%s'", str);
+    if (n < 1 || n > INT_MAX)
+        error(1, 0, "%s is not within the acceptable range [%d, %d]", str, 1, INT_MAX);
+    return n;
 }
 
 /* myuniq
  * ----------------------------------
  * Counts number of consecutive occurences of lines in a file. Prints
- * this number as a prefix followed by the line. Does not support any CLI flags.
+ * this number as a prefix followed by the line. Supports two flags:
+ * -c (--count-all) to count every distinct line wherever it occurs
+ * instead of only adjacent repeats, and -k N (--top N) to print only
+ * the N most frequent lines in that mode. -j N splits a regular file
+ * into chunks that are collapsed on N threads; output is identical to
+ * the serial mode.
  */
 int main(int argc, char *argv[])
 {
-    FILE *fp;
+    STATS_INIT(&argc, argv);
+    bool count_all = false;
+    size_t top_k = 0;
+    int nthreads = 1;
 
-    if (argc == 1) {
-        fp = stdin;
-    } else { // Ignores any arguments other than file as first argument
-        fp = fopen(argv[1], "r");
-        if (fp == NULL) error(1, 0, "%s: no such file", argv[1]);
+    static const struct option long_opts[] = {
+        {"count-all", no_argument, NULL, 'c'},
+        {"top", required_argument, NULL, 'k'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "ck:j:", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'c': count_all = true; break;
+            case 'k': top_k = convert_arg(optarg); break;
+            case 'j': nthreads = convert_arg(optarg); break;
+            default: exit(1);
+        }
+    }
+    if (top_k != 0 && !count_all) error(1, 0, "--top requires --count-all");
+    if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+
+    FILE *fp = stdin;
+    if (optind < argc) { // Ignores any arguments other than file as first argument
+        fp = fopen(argv[optind], "r");
+        if (fp == NULL) error(1, 0, "%s: no such file", argv[optind]);
+    }
+    writer out;
+    writer_init(&out, STDOUT_FILENO);
+    if (count_all) {
+        print_all_counts(fp, top_k, &out);
+    } else if (nthreads == 1 || !print_uniq_parallel(fp, nthreads, &out)) { // Pipes fall back to serial
+        print_uniq_lines(fp, &out);
     }
-    print_uniq_lines(fp);
+    writer_dispose(&out);
     fclose(fp);
     return 0;
 }
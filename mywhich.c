@@ -1,9 +1,63 @@
 #include "samples/prototypes.h"
+#include "getdents.h"
+#include "hash.h"
+#include "path_cache.h"
+#include "read_line.h"
+#include "scan_token.h"
+#include "stats.h"
+#include <assert.h>
+#include <error.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/stat.h>
+
+#define MAX_CACHE_HITS 256
+#define MAX_SCAN_THREADS 8
+#define NO_NAME UINT32_MAX
+
+// Set of distinct strings with dense ids, probed by precomputed hash.
+typedef struct {
+    const char **names;
+    size_t *lens;
+    uint64_t *hashes;
+    uint32_t *slots; // Id + 1, 0 when empty
+    size_t nslots, n, cap;
+} name_set;
+
+// One hit in a directory: the exact name or substring id it matched,
+// and the entry's name in the directory's arena.
+typedef struct {
+    uint32_t id;
+    uint32_t seq;     // Position in the directory, to keep readdir order
+    size_t name_off;
+} dir_match;
+
+// Results of scanning one search path directory in batch mode.
+typedef struct {
+    char path[PATH_MAX];
+    dir_match *matches;
+    size_t nmatches, cap;
+    char *arena;
+    size_t arena_len, arena_cap;
+} dir_scan;
+
+// State shared by the scanning threads. Directories are claimed by
+// atomically bumping next_dir.
+typedef struct {
+    dir_scan *dirs;
+    size_t ndirs;
+    size_t next_dir;
+    const name_set *exact;
+    const name_set *substrings;
+    const size_t *sub_lens; // Distinct substring lengths
+    size_t nsub_lens;
+} scan_job;
 
 /*
  * Function takes const char * to array of environment variables
@@ -20,6 +74,17 @@ const char *get_env_value(const char *envp[], const char *key)
     return NULL; 
 }
 
+/*
+ * Copies a PATH token into the null-terminated dir buffer of size
+ * PATH_MAX, truncating entries that could never name a real directory.
+ */
+void token_to_dir(const token_view *token, char *dir)
+{
+    size_t len = token->len < PATH_MAX - 1 ? token->len : PATH_MAX - 1;
+    memcpy(dir, token->ptr, len);
+    dir[len] = '\0';
+}
+
 /*
  * parse_path takes the pointer to the path buffer, the pointer to
  * the directory buffer holding the current directory being searched, 
@@ -51,40 +116,387 @@ void parse_path(char *pathptr, const char *remaining, char *dir, char *execname,
         closedir(dirptr);
     }
 
+/*
+ * Writes the location of the lookup cache into file (PATH_MAX bytes):
+ * $MYWHICH_CACHE if set, otherwise ~/.cache/mywhich.idx, creating
+ * ~/.cache if needed. Returns false when there is nowhere to put it.
+ */
+bool cache_file_path(const char *envp[], char *file)
+{
+    const char *override = get_env_value(envp, "MYWHICH_CACHE");
+    if (override != NULL) return snprintf(file, PATH_MAX, "%s", override) < PATH_MAX;
+    const char *home = get_env_value(envp, "HOME");
+    if (home == NULL) return false;
+    if (snprintf(file, PATH_MAX, "%s/.cache", home) >= PATH_MAX) return false;
+    mkdir(file, 0755); // Already existing is fine
+    return snprintf(file, PATH_MAX, "%s/.cache/mywhich.idx", home) < PATH_MAX;
+}
+
+/*
+ * Prints every match for execname recorded in the lookup cache, in the
+ * same format and order as parse_path would across the search path.
+ */
+void print_cached(const path_cache *cache, const char *execname)
+{
+    uint32_t dirs[MAX_CACHE_HITS];
+    size_t found = path_cache_lookup(cache, execname, dirs, MAX_CACHE_HITS);
+    if (found > MAX_CACHE_HITS) found = MAX_CACHE_HITS;
+    for (size_t i = 0; i < found; i++) {
+        size_t len;
+        const char *dir = path_cache_dir(cache, dirs[i], &len);
+        printf("%.*s/%s\n", (int)len, dir, execname);
+    }
+}
+
+/*
+ * Adds the len bytes at name to the set and returns its id, or the id
+ * it already had. Keeps the table at most half full.
+ */
+uint32_t name_set_add(name_set *set, const char *name, size_t len)
+{
+    if ((set->n + 1) * 2 > set->nslots) { // Grow and reinsert by stored hash
+        size_t nslots = set->nslots ? set->nslots * 2 : 64;
+        uint32_t *slots = calloc(nslots, sizeof(uint32_t));
+        assert(slots);
+        for (size_t i = 0; i < set->n; i++) {
+            size_t pos = set->hashes[i] & (nslots - 1);
+            while (slots[pos] != 0) pos = (pos + 1) & (nslots - 1);
+            slots[pos] = i + 1;
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->nslots = nslots;
+    }
+    uint64_t hash = hash_bytes(name, len);
+    size_t pos = hash & (set->nslots - 1);
+    for (; set->slots[pos] != 0; pos = (pos + 1) & (set->nslots - 1)) {
+        uint32_t id = set->slots[pos] - 1;
+        if (set->hashes[id] == hash && set->lens[id] == len && memcmp(set->names[id], name, len) == 0) return id;
+    }
+    if (set->n == set->cap) {
+        set->cap = set->cap ? set->cap * 2 : 64;
+        set->names = realloc(set->names, sizeof(char *) * set->cap);
+        set->lens = realloc(set->lens, sizeof(size_t) * set->cap);
+        set->hashes = realloc(set->hashes, sizeof(uint64_t) * set->cap);
+        assert(set->names && set->lens && set->hashes);
+    }
+    set->names[set->n] = name;
+    set->lens[set->n] = len;
+    set->hashes[set->n] = hash;
+    set->slots[pos] = set->n + 1;
+    return set->n++;
+}
+
+/*
+ * Returns the id of the len bytes at name, or NO_NAME if they are not
+ * in the set.
+ */
+uint32_t name_set_find(const name_set *set, const char *name, size_t len)
+{
+    if (set->n == 0) return NO_NAME;
+    uint64_t hash = hash_bytes(name, len);
+    for (size_t pos = hash & (set->nslots - 1); set->slots[pos] != 0; pos = (pos + 1) & (set->nslots - 1)) {
+        uint32_t id = set->slots[pos] - 1;
+        if (set->hashes[id] == hash && set->lens[id] == len && memcmp(set->names[id], name, len) == 0) return id;
+    }
+    return NO_NAME;
+}
+
+/*
+ * Frees the set's tables; the names belong to the caller.
+ */
+void name_set_free(name_set *set)
+{
+    free(set->names);
+    free(set->lens);
+    free(set->hashes);
+    free(set->slots);
+}
+
+/*
+ * Records that entry name (len bytes) of a scanned directory matched
+ * query id.
+ */
+void add_match(dir_scan *d, uint32_t id, uint32_t seq, const char *name, size_t len)
+{
+    if (d->nmatches == d->cap) {
+        d->cap = d->cap ? d->cap * 2 : 16;
+        d->matches = realloc(d->matches, sizeof(dir_match) * d->cap);
+        assert(d->matches);
+    }
+    if (d->arena_len + len + 1 > d->arena_cap) {
+        while (d->arena_len + len + 1 > d->arena_cap) d->arena_cap = d->arena_cap ? d->arena_cap * 2 : 256;
+        d->arena = realloc(d->arena, d->arena_cap);
+        assert(d->arena);
+    }
+    memcpy(d->arena + d->arena_len, name, len + 1);
+    d->matches[d->nmatches++] = (dir_match){id, seq, d->arena_len};
+    d->arena_len += len + 1;
+}
+
+/*
+ * Orders matches by query id and then by position in the directory,
+ * so each query's hits form one run in readdir order.
+ */
+int cmp_match(const void *p, const void *q)
+{
+    const dir_match *a = p, *b = q;
+    if (a->id != b->id) return a->id < b->id ? -1 : 1;
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/*
+ * Reads one directory with getdents64 and matches every entry against
+ * all queries at once: one hash probe for the exact names, and one
+ * probe per window for each distinct substring length, so the cost
+ * does not grow with the number of queries. stamp (one slot per
+ * substring) makes a substring that occurs twice in a name match once.
+ * Only matching entries get the access check.
+ */
+void scan_dir_batch(const scan_job *job, dir_scan *d, char *buf, uint32_t *stamp)
+{
+    int fd = open(d->path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    uint32_t seq = 0;
+    long n;
+    while ((n = read_dirents(fd, buf, DIRENT_BUF_SIZE)) > 0) {
+        for (long off = 0; off < n; ) {
+            const linux_dirent64 *ent = (const linux_dirent64 *)(buf + off);
+            off += ent->d_reclen;
+            const char *name = ent->d_name;
+            size_t len = strlen(name);
+            seq++;
+            uint32_t id = name_set_find(job->exact, name, len);
+            if (id != NO_NAME && faccessat(fd, name, X_OK | R_OK, 0) == 0) add_match(d, id, seq, name, len);
+            bool checked = false, allowed = false;
+            for (size_t l = 0; l < job->nsub_lens; l++) {
+                size_t sub_len = job->sub_lens[l];
+                for (size_t start = 0; start + sub_len <= len; start++) {
+                    uint32_t sub = name_set_find(job->substrings, name + start, sub_len);
+                    if (sub == NO_NAME || stamp[sub] == seq) continue;
+                    stamp[sub] = seq;
+                    if (!checked) {
+                        allowed = faccessat(fd, name, X_OK | R_OK, 0) == 0;
+                        checked = true;
+                    }
+                    if (allowed) add_match(d, job->exact->n + sub, seq, name, len);
+                }
+            }
+        }
+    }
+    close(fd);
+    qsort(d->matches, d->nmatches, sizeof(dir_match), cmp_match);
+}
+
+/*
+ * Thread body for batch mode: claims directories until none are left.
+ */
+void *scan_worker(void *arg)
+{
+    scan_job *job = arg;
+    char *buf = malloc(DIRENT_BUF_SIZE);
+    uint32_t *stamp = calloc(job->substrings->n + 1, sizeof(uint32_t));
+    assert(buf && stamp);
+    size_t i;
+    while ((i = __atomic_fetch_add(&job->next_dir, 1, __ATOMIC_RELAXED)) < job->ndirs) {
+        memset(stamp, 0, sizeof(uint32_t) * (job->substrings->n + 1)); // seq restarts in every directory
+        scan_dir_batch(job, &job->dirs[i], buf, stamp);
+    }
+    free(stamp);
+    free(buf);
+    return NULL;
+}
+
+/*
+ * Batch mode: resolves every name in names (a "+" prefix marks a
+ * wildcard, as in normal mode) reading each search path directory
+ * exactly once, with directories spread over a few threads. Output is
+ * the same as looking the names up one at a time.
+ */
+void which_batch(const char *searchpath, char **names, size_t nnames)
+{
+    name_set exact = {0}, substrings = {0};
+    uint32_t *query_ids = malloc(sizeof(uint32_t) * (nnames + 1));
+    assert(query_ids);
+    for (size_t i = 0; i < nnames; i++) { // Substring ids are offset after all exact names below
+        if (names[i][0] != '+') query_ids[i] = name_set_add(&exact, names[i], strlen(names[i]));
+    }
+    size_t sub_lens[PATH_MAX];
+    size_t nsub_lens = 0;
+    for (size_t i = 0; i < nnames; i++) {
+        if (names[i][0] != '+') continue;
+        size_t len = strlen(names[i] + 1);
+        uint32_t sub = name_set_add(&substrings, names[i] + 1, len);
+        query_ids[i] = exact.n + sub;
+        bool seen = false;
+        for (size_t l = 0; l < nsub_lens; l++) seen |= sub_lens[l] == len;
+        if (!seen && len < PATH_MAX) sub_lens[nsub_lens++] = len;
+    }
+
+    scan_job job = {NULL, 0, 0, &exact, &substrings, sub_lens, nsub_lens};
+    size_t dirs_cap = 0;
+    delim_set colon;
+    delim_set_init(&colon, ":");
+    token_view token;
+    const char *remaining = searchpath;
+    while (next_token(&remaining, &colon, &token)) {
+        if (job.ndirs == dirs_cap) {
+            dirs_cap = dirs_cap ? dirs_cap * 2 : 16;
+            job.dirs = realloc(job.dirs, sizeof(dir_scan) * dirs_cap);
+            assert(job.dirs);
+        }
+        dir_scan *d = &job.dirs[job.ndirs++];
+        memset(d, 0, sizeof(dir_scan));
+        token_to_dir(&token, d->path);
+    }
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = ncpus > 0 ? ncpus : 1;
+    if (nthreads > MAX_SCAN_THREADS) nthreads = MAX_SCAN_THREADS;
+    if (nthreads > job.ndirs) nthreads = job.ndirs ? job.ndirs : 1;
+    pthread_t threads[MAX_SCAN_THREADS];
+    for (size_t t = 1; t < nthreads; t++) {
+        if (pthread_create(&threads[t], NULL, scan_worker, &job) != 0) error(1, 0, "cannot create thread");
+    }
+    scan_worker(&job);
+    for (size_t t = 1; t < nthreads; t++) pthread_join(threads[t], NULL);
+
+    for (size_t i = 0; i < nnames; i++) { // Query order, then search path order, then readdir order
+        for (size_t j = 0; j < job.ndirs; j++) {
+            const dir_scan *d = &job.dirs[j];
+            size_t lo = 0, hi = d->nmatches;
+            while (lo < hi) { // First match for this query
+                size_t mid = (lo + hi) / 2;
+                if (d->matches[mid].id < query_ids[i]) lo = mid + 1; else hi = mid;
+            }
+            for (; lo < d->nmatches && d->matches[lo].id == query_ids[i]; lo++) {
+                printf("%s/%s\n", d->path, d->arena + d->matches[lo].name_off);
+            }
+        }
+    }
+    for (size_t j = 0; j < job.ndirs; j++) {
+        free(job.dirs[j].matches);
+        free(job.dirs[j].arena);
+    }
+    free(job.dirs);
+    free(query_ids);
+    name_set_free(&exact);
+    name_set_free(&substrings);
+}
+
+/*
+ * Reads names for batch mode from stdin, one per line. Returns a
+ * malloc'd array of malloc'd strings and stores its length in *nnames.
+ */
+char **read_names(size_t *nnames)
+{
+    size_t cap = 64;
+    char **names = malloc(sizeof(char *) * cap);
+    assert(names);
+    *nnames = 0;
+    line_reader reader;
+    reader_init(&reader, stdin);
+    line_view line;
+    while (reader_next(&reader, &line)) {
+        if (line.len == 0) continue;
+        if (*nnames == cap) {
+            cap *= 2;
+            names = realloc(names, sizeof(char *) * cap);
+            assert(names);
+        }
+        names[(*nnames)++] = strdup(line.ptr);
+    }
+    reader_dispose(&reader);
+    return names;
+}
+
 /*
  * mywhich searches for a command name and displays the path to its
  * matching executable. This search is performed directory by directory
- * and utilizes the scan_token function. mywhich also has additional
+ * and splits the search path with next_token, building the delimiter
+ * set once for every directory and name. mywhich also has additional
  * functionality supporting a wildcard search when an argument has a
  * "+" prefix, returning all executables that contain the wildcard substring.
+ *
+ * Exact-name lookups go through an on-disk index (see path_cache.c) that
+ * is checked with one stat per search path directory and rebuilt for the
+ * directories that changed. --no-cache searches directly, --rebuild-cache
+ * rebuilds the index from scratch and --show-cache describes it.
+ *
+ * --batch resolves many names (from the remaining arguments, or one per
+ * line on stdin) with a single pass over the search path; see which_batch.
  */
     int main(int argc, char *argv[], const char *envp[])
     {
+        STATS_INIT(&argc, argv);
         char *execname = "";
         const char *searchpath = get_env_value(envp, "MYPATH");
     if (searchpath == NULL) searchpath = get_env_value(envp, "PATH"); // No MYPATH environment variable, use PATH instead
+    if (searchpath == NULL) searchpath = "";
+    char cache_file[PATH_MAX];
+    bool use_cache = cache_file_path(envp, cache_file);
+    path_cache cache;
+    bool cache_loaded = false;
+    if (argc > 1 && strcmp(argv[1], "--no-cache") == 0) {
+        use_cache = false;
+        argv++;
+        argc--;
+    } else if (argc > 1 && strcmp(argv[1], "--rebuild-cache") == 0) {
+        if (!use_cache || !path_cache_rebuild(cache_file, searchpath, NULL)) error(1, 0, "cannot write lookup cache");
+        return 0;
+    } else if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        if (argc > 2) {
+            which_batch(searchpath, argv + 2, argc - 2);
+        } else {
+            size_t nnames;
+            char **names = read_names(&nnames);
+            which_batch(searchpath, names, nnames);
+            for (size_t i = 0; i < nnames; i++) free(names[i]);
+            free(names);
+        }
+        return 0;
+    } else if (argc > 1 && strcmp(argv[1], "--show-cache") == 0) {
+        if (!use_cache || !path_cache_load(&cache, cache_file, searchpath)) error(1, 0, "no lookup cache available");
+        printf("%s\n", cache_file);
+        path_cache_show(&cache, stdout);
+        path_cache_close(&cache);
+        return 0;
+    }
     char dir[PATH_MAX];
     char path[PATH_MAX];
     char *pathptr = path;
     bool wildcard = false;
+    delim_set colon;
+    delim_set_init(&colon, ":");
+    token_view token;
     if (argc == 1) { // No arguments case = print all directories in search path
         const char *remaining = searchpath;
         printf("Directories in search path:\n");
-        while (scan_token(&remaining, ":", dir, sizeof(dir))) { // Tokenize search path into directories, then print them
-            printf("%s\n", dir);
+        while (next_token(&remaining, &colon, &token)) { // Tokenize search path into directories, then print them
+            printf("%.*s\n", (int)token.len, token.ptr);
         }
     } else {
         for (int i = 1; argv[i]; i++) { // Iterate through all search names
             const char *remaining = searchpath; // Copy to iteratively progress through searchpath
             execname = argv[i];
-            if (execname[0] == '+') { // Check for wildcard case
-                execname++;
-                wildcard = true;
+            wildcard = execname[0] == '+';
+            if (wildcard) execname++; // Check for wildcard case
+            if (!wildcard && use_cache && strchr(execname, '/') == NULL) {
+                if (!cache_loaded) { // Load lazily, once for all names
+                    cache_loaded = path_cache_load(&cache, cache_file, searchpath);
+                    use_cache = cache_loaded;
+                }
+                if (cache_loaded) {
+                    print_cached(&cache, execname);
+                    continue;
+                }
             }
-            while (scan_token(&remaining, ":", dir, sizeof(dir))) { // Tokenize then check each directory path using helper function
+            while (next_token(&remaining, &colon, &token)) { // Tokenize then check each directory path using helper function
+                token_to_dir(&token, dir);
                 parse_path(pathptr, remaining, dir, execname, wildcard);
             }
         }
     }
+    if (cache_loaded) path_cache_close(&cache);
     return 0;
 }
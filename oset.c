@@ -0,0 +1,304 @@
+#include "oset.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LEAF_BYTES 4096 // Leaf key storage, sized to a page
+#define MIN_LEAF_CAP 4
+#define INNER_CAP 63    // Separator keys per internal node; fanout is one more
+
+// Leaves hold elements and are chained in order for iteration. Internal
+// nodes hold nkeys separators and nkeys + 1 children, where children[i]
+// holds elements >= keys[i - 1] and < keys[i]. Both arrays live in the
+// same allocation as the node.
+struct oset_node {
+    unsigned int nkeys;
+    bool leaf;
+    struct oset_node *next;
+    struct oset_node **children;
+    char *keys;
+};
+
+/* Type: function node_new
+ * ----------------------------------
+ * Allocates a leaf or internal node with room for its keys (and
+ * children) in a single block.
+ */
+static oset_node *node_new(const oset *s, bool leaf)
+{
+    unsigned int cap = leaf ? s->leaf_cap : INNER_CAP;
+    size_t children = leaf ? 0 : sizeof(oset_node *) * (INNER_CAP + 1);
+    oset_node *node = malloc(sizeof(oset_node) + children + cap * s->width);
+    assert(node);
+    node->nkeys = 0;
+    node->leaf = leaf;
+    node->next = NULL;
+    node->children = leaf ? NULL : (oset_node **)(node + 1);
+    node->keys = (char *)(node + 1) + children;
+    return node;
+}
+
+/* Type: function key_at
+ * ----------------------------------
+ * Returns a pointer to the i-th key stored in node.
+ */
+static inline char *key_at(const oset *s, const oset_node *node, unsigned int i)
+{
+    return node->keys + (size_t)i * s->width;
+}
+
+/* Type: function lower_bound
+ * ----------------------------------
+ * Binary search within one node: returns the index of the first key
+ * that is not less than key. *equal reports whether that key matches.
+ */
+static unsigned int lower_bound(const oset *s, const oset_node *node, const void *key, bool *equal)
+{
+    unsigned int lo = 0, hi = node->nkeys;
+    *equal = false;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        int sign = s->compar(key, key_at(s, node, mid));
+        if (sign == 0) {
+            *equal = true;
+            return mid;
+        }
+        if (sign > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Type: function child_index
+ * ----------------------------------
+ * Returns which child of an internal node may hold key: the number of
+ * separators that are less than or equal to it.
+ */
+static unsigned int child_index(const oset *s, const oset_node *node, const void *key)
+{
+    bool equal;
+    unsigned int i = lower_bound(s, node, key, &equal);
+    return equal ? i + 1 : i;
+}
+
+/* Type: function is_full
+ * ----------------------------------
+ * Returns whether node has no room for another key.
+ */
+static inline bool is_full(const oset *s, const oset_node *node)
+{
+    return node->nkeys == (node->leaf ? s->leaf_cap : INNER_CAP);
+}
+
+/* Type: function split_child
+ * ----------------------------------
+ * Splits the full child at index i of parent, which must have room,
+ * into two half-full nodes and inserts the separator into parent. A
+ * leaf split copies the right half's first key up; an internal split
+ * moves its middle key up.
+ */
+static void split_child(const oset *s, oset_node *parent, unsigned int i)
+{
+    oset_node *child = parent->children[i];
+    oset_node *right = node_new(s, child->leaf);
+    unsigned int mid = child->nkeys / 2;
+    if (child->leaf) {
+        right->nkeys = child->nkeys - mid;
+        memcpy(right->keys, key_at(s, child, mid), (size_t)right->nkeys * s->width);
+        right->next = child->next;
+        child->next = right;
+    } else {
+        right->nkeys = child->nkeys - mid - 1;
+        memcpy(right->keys, key_at(s, child, mid + 1), (size_t)right->nkeys * s->width);
+        memcpy(right->children, child->children + mid + 1, sizeof(oset_node *) * (right->nkeys + 1));
+    }
+    // Open a slot at i in parent's keys and i + 1 in its children
+    memmove(key_at(s, parent, i + 1), key_at(s, parent, i), (size_t)(parent->nkeys - i) * s->width);
+    memmove(parent->children + i + 2, parent->children + i + 1, sizeof(oset_node *) * (parent->nkeys - i));
+    memcpy(key_at(s, parent, i), child->leaf ? right->keys : key_at(s, child, mid), s->width);
+    parent->children[i + 1] = right;
+    parent->nkeys++;
+    child->nkeys = mid;
+}
+
+/* Type: function oset_init
+ * ----------------------------------
+ * Initializes an empty set of elements of the given width ordered by
+ * compar. Leaves hold about a page of elements.
+ */
+void oset_init(oset *s, size_t width, int (*compar)(const void *, const void *))
+{
+    s->width = width;
+    s->compar = compar;
+    s->nelem = 0;
+    s->leaf_cap = LEAF_BYTES / width;
+    if (s->leaf_cap < MIN_LEAF_CAP) s->leaf_cap = MIN_LEAF_CAP;
+    s->root = node_new(s, true);
+}
+
+/* Type: function oset_insert
+ * ----------------------------------
+ * Insert-or-find. Returns a pointer to the element equal to key,
+ * copying key into the set first if no such element exists; *inserted
+ * (if not NULL) says which happened. Full nodes are split on the way
+ * down, so the only shifting is within a single leaf and the cost is
+ * O(log n). The returned pointer is valid until the next insert.
+ */
+void *oset_insert(oset *s, const void *key, bool *inserted)
+{
+    if (is_full(s, s->root)) { // Grow the tree by one level
+        oset_node *root = node_new(s, false);
+        root->children[0] = s->root;
+        s->root = root;
+        split_child(s, root, 0);
+    }
+    oset_node *node = s->root;
+    while (!node->leaf) {
+        unsigned int i = child_index(s, node, key);
+        if (is_full(s, node->children[i])) {
+            split_child(s, node, i);
+            if (s->compar(key, key_at(s, node, i)) >= 0) i++; // Key belongs to the new right half
+        }
+        node = node->children[i];
+    }
+    bool equal;
+    unsigned int i = lower_bound(s, node, key, &equal);
+    if (inserted != NULL) *inserted = !equal;
+    if (equal) return key_at(s, node, i); // Match found with key
+    memmove(key_at(s, node, i + 1), key_at(s, node, i), (size_t)(node->nkeys - i) * s->width);
+    memcpy(key_at(s, node, i), key, s->width);
+    node->nkeys++;
+    s->nelem++;
+    return key_at(s, node, i);
+}
+
+/* Type: function oset_find
+ * ----------------------------------
+ * Returns a pointer to the element equal to key, or NULL if there is
+ * none, in O(log n) comparisons.
+ */
+void *oset_find(const oset *s, const void *key)
+{
+    const oset_node *node = s->root;
+    while (!node->leaf) node = node->children[child_index(s, node, key)];
+    bool equal;
+    unsigned int i = lower_bound(s, node, key, &equal);
+    return equal ? key_at(s, node, i) : NULL;
+}
+
+/* Type: function oset_bulk_load
+ * ----------------------------------
+ * Builds the set bottom-up from nelem elements at base that are already
+ * sorted by compar, replacing its contents. Adjacent equal elements are
+ * kept once. Leaves are packed full and each upper level is built from
+ * the one below in a single pass, so loading is O(n) with no searching.
+ */
+void oset_bulk_load(oset *s, const void *base, size_t nelem)
+{
+    oset_dispose(s);
+    s->nelem = 0;
+    s->root = node_new(s, true);
+    if (nelem == 0) return;
+
+    // Level 0: pack leaves, remembering each node's smallest element
+    size_t nnodes = 0, cap = 16;
+    oset_node **level = malloc(sizeof(oset_node *) * cap);
+    const char **mins = malloc(sizeof(char *) * cap);
+    assert(level && mins);
+    oset_node *leaf = s->root;
+    const char *prev = NULL;
+    for (size_t i = 0; i < nelem; i++) {
+        const char *elem = (const char *)base + i * s->width;
+        if (prev != NULL && s->compar(prev, elem) == 0) continue;
+        prev = elem;
+        if (leaf->nkeys == s->leaf_cap || nnodes == 0) {
+            if (nnodes > 0) {
+                leaf->next = node_new(s, true);
+                leaf = leaf->next;
+            }
+            if (nnodes == cap) {
+                cap *= 2;
+                level = realloc(level, sizeof(oset_node *) * cap);
+                mins = realloc(mins, sizeof(char *) * cap);
+                assert(level && mins);
+            }
+            level[nnodes] = leaf;
+            mins[nnodes++] = elem;
+        }
+        memcpy(key_at(s, leaf, leaf->nkeys++), elem, s->width);
+        s->nelem++;
+    }
+    // Upper levels: group up to INNER_CAP + 1 nodes under each parent
+    while (nnodes > 1) {
+        size_t nparents = 0;
+        for (size_t i = 0; i < nnodes; i += INNER_CAP + 1) {
+            size_t nchildren = nnodes - i < INNER_CAP + 1 ? nnodes - i : INNER_CAP + 1;
+            oset_node *parent = node_new(s, false);
+            parent->children[0] = level[i];
+            for (size_t c = 1; c < nchildren; c++) {
+                memcpy(key_at(s, parent, c - 1), mins[i + c], s->width);
+                parent->children[c] = level[i + c];
+            }
+            parent->nkeys = nchildren - 1;
+            mins[nparents] = mins[i];
+            level[nparents++] = parent;
+        }
+        nnodes = nparents;
+    }
+    s->root = level[0];
+    free(level);
+    free(mins);
+}
+
+/* Type: function oset_iter_init
+ * ----------------------------------
+ * Positions it before the smallest element of the set.
+ */
+void oset_iter_init(const oset *s, oset_iter *it)
+{
+    const oset_node *node = s->root;
+    while (!node->leaf) node = node->children[0];
+    it->leaf = node;
+    it->index = 0;
+    it->width = s->width;
+}
+
+/* Type: function oset_iter_next
+ * ----------------------------------
+ * Returns the next element in order, or NULL after the largest, by
+ * walking the leaf chain.
+ */
+void *oset_iter_next(oset_iter *it)
+{
+    while (it->leaf != NULL && it->index == it->leaf->nkeys) {
+        it->leaf = it->leaf->next;
+        it->index = 0;
+    }
+    if (it->leaf == NULL) return NULL;
+    return it->leaf->keys + (size_t)it->index++ * it->width;
+}
+
+/* Type: function node_free
+ * ----------------------------------
+ * Frees node and everything below it.
+ */
+static void node_free(oset_node *node)
+{
+    if (!node->leaf) {
+        for (unsigned int i = 0; i <= node->nkeys; i++) node_free(node->children[i]);
+    }
+    free(node);
+}
+
+/* Type: function oset_dispose
+ * ----------------------------------
+ * Frees every node of the set.
+ */
+void oset_dispose(oset *s)
+{
+    node_free(s->root);
+    s->root = NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef OSET_H
+#define OSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct oset_node oset_node;
+
+// Ordered set of fixed-width elements kept in a B+-tree. Elements are
+// copied in by value, like binsert, and ordered by compar, which takes
+// pointers to two elements.
+typedef struct {
+    oset_node *root;
+    size_t width;
+    size_t nelem;
+    int (*compar)(const void *, const void *);
+    unsigned int leaf_cap;
+} oset;
+
+// In-order cursor over an oset. Invalidated by any insert.
+typedef struct {
+    const oset_node *leaf;
+    unsigned int index;
+    size_t width;
+} oset_iter;
+
+void oset_init(oset *s, size_t width, int (*compar)(const void *, const void *));
+void *oset_insert(oset *s, const void *key, bool *inserted);
+void *oset_find(const oset *s, const void *key);
+void oset_bulk_load(oset *s, const void *base, size_t nelem);
+void oset_iter_init(const oset *s, oset_iter *it);
+void *oset_iter_next(oset_iter *it);
+void oset_dispose(oset *s);
+
+#endif
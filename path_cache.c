@@ -0,0 +1,417 @@
+#include "path_cache.h"
+#include "hash.h"
+#include "scan_token.h"
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "MYWHICH1"
+#define MIN_CACHE_SLOTS 64
+#define RACY_SECONDS 1 // Directories changed this close to a build are rescanned next time
+
+// In-memory form of an index while it is being built.
+typedef struct {
+    char *strings;
+    size_t strings_len, strings_cap;
+    cache_dir *dirs;
+    uint32_t ndirs, dirs_cap;
+    cache_slot *entries; // Only name and dir are filled until slots are laid out
+    size_t nentries, entries_cap;
+} cache_builder;
+
+/* Type: function add_string
+ * ----------------------------------
+ * Appends len bytes to the builder's string pool and returns their
+ * offset. Strings are not null terminated in the pool.
+ */
+static uint32_t add_string(cache_builder *b, const char *str, size_t len)
+{
+    if (b->strings_len + len > b->strings_cap) {
+        while (b->strings_len + len > b->strings_cap) b->strings_cap = b->strings_cap ? b->strings_cap * 2 : 4096;
+        b->strings = realloc(b->strings, b->strings_cap);
+        assert(b->strings);
+    }
+    memcpy(b->strings + b->strings_len, str, len);
+    b->strings_len += len;
+    return b->strings_len - len;
+}
+
+/* Type: function add_entry
+ * ----------------------------------
+ * Records that executable name (len bytes) is in directory dir.
+ */
+static void add_entry(cache_builder *b, const char *name, size_t len, uint32_t dir)
+{
+    if (b->nentries == b->entries_cap) {
+        b->entries_cap = b->entries_cap ? b->entries_cap * 2 : 1024;
+        b->entries = realloc(b->entries, sizeof(cache_slot) * b->entries_cap);
+        assert(b->entries);
+    }
+    cache_slot *e = &b->entries[b->nentries++];
+    e->hash = hash_bytes(name, len);
+    e->name_off = add_string(b, name, len);
+    e->name_len = len;
+    e->dir = dir;
+    e->pad = 0;
+}
+
+/* Type: function stat_dir
+ * ----------------------------------
+ * Stores the modification time of the directory named by the len
+ * bytes at name in *sec and *nsec, or -1 for both if it cannot be
+ * stat'ed. Adding, removing or renaming an entry updates it.
+ */
+static void stat_dir(const char *name, size_t len, int64_t *sec, int64_t *nsec)
+{
+    char dir[PATH_MAX];
+    struct stat st;
+    if (len < sizeof(dir)) {
+        memcpy(dir, name, len);
+        dir[len] = '\0';
+        if (stat(dir, &st) == 0) {
+            *sec = st.st_mtim.tv_sec;
+            *nsec = st.st_mtim.tv_nsec;
+            return;
+        }
+    }
+    *sec = *nsec = -1;
+}
+
+/* Type: function scan_dir
+ * ----------------------------------
+ * Reads directory dir (len bytes at name) and records every entry that
+ * mywhich would report, i.e. that passes the same read and execute
+ * access check as parse_path.
+ */
+static void scan_dir(cache_builder *b, const char *name, size_t len, uint32_t dir)
+{
+    char path[PATH_MAX];
+    if (len >= sizeof(path)) return;
+    memcpy(path, name, len);
+    path[len] = '\0';
+    DIR *dirptr = opendir(path);
+    if (dirptr == NULL) return;
+    struct dirent *entry;
+    while ((entry = readdir(dirptr)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (faccessat(dirfd(dirptr), entry->d_name, X_OK | R_OK, 0) == 0) {
+            add_entry(b, entry->d_name, strlen(entry->d_name), dir);
+        }
+    }
+    closedir(dirptr);
+}
+
+/* Type: function is_fresh
+ * ----------------------------------
+ * Returns whether the cached listing of directory dir can still be
+ * trusted given its current mtime. A directory modified within
+ * RACY_SECONDS of the build may have changed again in the same
+ * timestamp tick, so it is never trusted.
+ */
+static bool is_fresh(const path_cache *pc, uint32_t dir, int64_t sec, int64_t nsec)
+{
+    const cache_dir *d = &pc->dirs[dir];
+    if (d->mtime_sec != sec || d->mtime_nsec != nsec) return false;
+    return sec == -1 || sec < pc->header->built_sec - RACY_SECONDS;
+}
+
+/* Type: function find_old_dir
+ * ----------------------------------
+ * Returns the index of a still-fresh directory with the given name in
+ * the old index, or CACHE_EMPTY_SLOT if it must be rescanned.
+ */
+static uint32_t find_old_dir(const path_cache *old, const char *name, size_t len, int64_t sec, int64_t nsec)
+{
+    if (old == NULL) return CACHE_EMPTY_SLOT;
+    for (uint32_t j = 0; j < old->header->ndirs; j++) {
+        const cache_dir *d = &old->dirs[j];
+        if (d->name_len == len && memcmp(old->strings + d->name_off, name, len) == 0
+            && is_fresh(old, j, sec, nsec)) return j;
+    }
+    return CACHE_EMPTY_SLOT;
+}
+
+/* Type: function write_index
+ * ----------------------------------
+ * Lays out the builder's contents in the on-disk format with a hash
+ * table at most half full, and writes it to file through a temporary
+ * file and rename so readers never see a partial index.
+ */
+static bool write_index(const cache_builder *b, const char *file, uint32_t path_len)
+{
+    uint64_t nslots = MIN_CACHE_SLOTS;
+    while (nslots < b->nentries * 2) nslots *= 2;
+    size_t dirs_off = sizeof(cache_header);
+    size_t slots_off = dirs_off + sizeof(cache_dir) * b->ndirs;
+    size_t strings_off = slots_off + sizeof(cache_slot) * nslots;
+    size_t size = strings_off + b->strings_len;
+    char *buf = calloc(1, size);
+    assert(buf);
+
+    cache_header *header = (cache_header *)buf;
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    header->ndirs = b->ndirs;
+    header->path_len = path_len;
+    header->nslots = nslots;
+    header->nentries = b->nentries;
+    header->built_sec = time(NULL);
+    header->strings_size = b->strings_len;
+    memcpy(buf + dirs_off, b->dirs, sizeof(cache_dir) * b->ndirs);
+    cache_slot *slots = (cache_slot *)(buf + slots_off);
+    for (uint64_t i = 0; i < nslots; i++) slots[i].dir = CACHE_EMPTY_SLOT;
+    // Entries go in directory order, so a name's slots are probed in search path order
+    for (size_t i = 0; i < b->nentries; i++) {
+        uint64_t pos = b->entries[i].hash & (nslots - 1);
+        while (slots[pos].dir != CACHE_EMPTY_SLOT) pos = (pos + 1) & (nslots - 1);
+        slots[pos] = b->entries[i];
+    }
+    memcpy(buf + strings_off, b->strings, b->strings_len);
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", file, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0;
+    for (size_t written = 0; ok && written < size; ) {
+        ssize_t n = write(fd, buf + written, size - written);
+        ok = n > 0;
+        written += ok ? n : 0;
+    }
+    if (fd >= 0 && close(fd) != 0) ok = false;
+    if (ok && rename(tmp, file) != 0) ok = false;
+    if (!ok && fd >= 0) unlink(tmp);
+    free(buf);
+    return ok;
+}
+
+/* Type: function path_cache_rebuild
+ * ----------------------------------
+ * Writes a fresh index for searchpath to file. Directories whose
+ * listing in old (which may be NULL) is still fresh are copied from it;
+ * only the rest are read again. Returns false if file cannot be written.
+ */
+bool path_cache_rebuild(const char *file, const char *searchpath, const path_cache *old)
+{
+    cache_builder b = {0};
+    size_t path_len = strlen(searchpath);
+    add_string(&b, searchpath, path_len);
+    delim_set colon;
+    delim_set_init(&colon, ":");
+    token_view token;
+    const char *remaining = searchpath;
+    while (next_token(&remaining, &colon, &token)) {
+        if (b.ndirs == b.dirs_cap) {
+            b.dirs_cap = b.dirs_cap ? b.dirs_cap * 2 : 16;
+            b.dirs = realloc(b.dirs, sizeof(cache_dir) * b.dirs_cap);
+            assert(b.dirs);
+        }
+        uint32_t dir = b.ndirs++;
+        cache_dir *d = &b.dirs[dir];
+        d->name_off = add_string(&b, token.ptr, token.len);
+        d->name_len = token.len;
+        stat_dir(token.ptr, token.len, &d->mtime_sec, &d->mtime_nsec);
+        uint32_t old_dir = find_old_dir(old, token.ptr, token.len, d->mtime_sec, d->mtime_nsec);
+        if (old_dir == CACHE_EMPTY_SLOT) {
+            scan_dir(&b, token.ptr, token.len, dir);
+            continue;
+        }
+        for (uint64_t i = 0; i < old->header->nslots; i++) {
+            const cache_slot *s = &old->slots[i];
+            if (s->dir == old_dir) add_entry(&b, old->strings + s->name_off, s->name_len, dir);
+        }
+    }
+    bool ok = write_index(&b, file, path_len);
+    free(b.strings);
+    free(b.dirs);
+    free(b.entries);
+    return ok;
+}
+
+/* Type: function range_ok
+ * ----------------------------------
+ * Returns whether len bytes at off lie within a section of size bytes,
+ * without overflowing.
+ */
+static bool range_ok(uint64_t off, uint64_t len, uint64_t size)
+{
+    return off <= size && len <= size - off;
+}
+
+/* Type: function contents_ok
+ * ----------------------------------
+ * Checks that every offset in a mapped index stays inside the string
+ * pool, every used slot names a real directory, and the table has an
+ * empty slot for probes to stop at.
+ */
+static bool contents_ok(const path_cache *pc)
+{
+    const cache_header *h = pc->header;
+    if (h->path_len > h->strings_size) return false;
+    for (uint32_t i = 0; i < h->ndirs; i++) {
+        if (!range_ok(pc->dirs[i].name_off, pc->dirs[i].name_len, h->strings_size)) return false;
+    }
+    uint64_t used = 0;
+    for (uint64_t i = 0; i < h->nslots; i++) {
+        const cache_slot *s = &pc->slots[i];
+        if (s->dir == CACHE_EMPTY_SLOT) continue;
+        if (s->dir >= h->ndirs || !range_ok(s->name_off, s->name_len, h->strings_size)) return false;
+        used++;
+    }
+    return used < h->nslots;
+}
+
+/* Type: function map_index
+ * ----------------------------------
+ * Maps file and checks that its header, section sizes and contents
+ * are consistent, so a corrupt file is never read out of bounds.
+ * Returns false, leaving pc unmapped, if it is missing or malformed.
+ */
+static bool map_index(path_cache *pc, const char *file)
+{
+    pc->map = NULL;
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cache_header)) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    const cache_header *header = map;
+    // Sections are sized by dividing what is left, so no product can overflow
+    size_t left = st.st_size - sizeof(cache_header);
+    bool ok = memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0
+        && header->ndirs <= left / sizeof(cache_dir);
+    if (ok) left -= sizeof(cache_dir) * header->ndirs;
+    ok = ok && header->nslots != 0 && (header->nslots & (header->nslots - 1)) == 0
+        && header->nslots <= left / sizeof(cache_slot);
+    if (ok) left -= sizeof(cache_slot) * header->nslots;
+    ok = ok && header->strings_size == left;
+    if (ok) {
+        size_t slots_off = sizeof(cache_header) + sizeof(cache_dir) * header->ndirs;
+        pc->map = map;
+        pc->size = st.st_size;
+        pc->header = header;
+        pc->dirs = (const cache_dir *)(header + 1);
+        pc->slots = (const cache_slot *)((const char *)map + slots_off);
+        pc->strings = (const char *)pc->slots + sizeof(cache_slot) * header->nslots;
+        ok = contents_ok(pc);
+    }
+    if (!ok) {
+        munmap(map, st.st_size);
+        pc->map = NULL;
+    }
+    return ok;
+}
+
+/* Type: function is_current
+ * ----------------------------------
+ * Returns whether the mapped index was built for searchpath and every
+ * directory in it is fresh. Costs one stat per directory.
+ */
+static bool is_current(const path_cache *pc, const char *searchpath)
+{
+    size_t path_len = strlen(searchpath);
+    if (pc->header->path_len != path_len || memcmp(pc->strings, searchpath, path_len) != 0) return false;
+    for (uint32_t i = 0; i < pc->header->ndirs; i++) {
+        int64_t sec, nsec;
+        stat_dir(pc->strings + pc->dirs[i].name_off, pc->dirs[i].name_len, &sec, &nsec);
+        if (!is_fresh(pc, i, sec, nsec)) return false;
+    }
+    return true;
+}
+
+/* Type: function path_cache_load
+ * ----------------------------------
+ * Maps the index in file for searchpath, first rebuilding it if it is
+ * missing, was built for another search path, or lists a directory
+ * that has changed since. Returns false if no usable index could be
+ * produced, in which case the caller should search directly.
+ */
+bool path_cache_load(path_cache *pc, const char *file, const char *searchpath)
+{
+    bool mapped = map_index(pc, file);
+    if (mapped && is_current(pc, searchpath)) return true;
+    bool ok = path_cache_rebuild(file, searchpath, mapped ? pc : NULL);
+    if (mapped) path_cache_close(pc);
+    return ok && map_index(pc, file);
+}
+
+/* Type: function path_cache_lookup
+ * ----------------------------------
+ * Stores the indices of the directories that contain executable name,
+ * in search path order, in dirs (up to max_dirs of them) and returns
+ * how many there are. One hash and one probe sequence.
+ */
+size_t path_cache_lookup(const path_cache *pc, const char *name, uint32_t *dirs, size_t max_dirs)
+{
+    size_t len = strlen(name);
+    uint64_t hash = hash_bytes(name, len);
+    uint64_t mask = pc->header->nslots - 1;
+    size_t found = 0;
+    for (uint64_t pos = hash & mask; pc->slots[pos].dir != CACHE_EMPTY_SLOT; pos = (pos + 1) & mask) {
+        const cache_slot *s = &pc->slots[pos];
+        if (s->hash == hash && s->name_len == len && memcmp(pc->strings + s->name_off, name, len) == 0) {
+            if (found < max_dirs) dirs[found] = s->dir;
+            found++;
+        }
+    }
+    return found;
+}
+
+/* Type: function path_cache_dir
+ * ----------------------------------
+ * Returns the name of directory dir (not null terminated) and stores
+ * its length in *len.
+ */
+const char *path_cache_dir(const path_cache *pc, uint32_t dir, size_t *len)
+{
+    *len = pc->dirs[dir].name_len;
+    return pc->strings + pc->dirs[dir].name_off;
+}
+
+/* Type: function path_cache_show
+ * ----------------------------------
+ * Prints a summary of the index followed by each directory with its
+ * recorded mtime, number of executables and whether it is still fresh.
+ */
+void path_cache_show(const path_cache *pc, FILE *out)
+{
+    const cache_header *h = pc->header;
+    size_t *counts = calloc(h->ndirs + 1, sizeof(size_t));
+    assert(counts);
+    for (uint64_t i = 0; i < h->nslots; i++) {
+        if (pc->slots[i].dir != CACHE_EMPTY_SLOT) counts[pc->slots[i].dir]++;
+    }
+    time_t built = h->built_sec;
+    fprintf(out, "Built: %s", ctime(&built));
+    fprintf(out, "Search path: %.*s\n", (int)h->path_len, pc->strings);
+    fprintf(out, "%lu executables in %u directories, %lu slots, %zu bytes\n",
+            (unsigned long)h->nentries, h->ndirs, (unsigned long)h->nslots, pc->size);
+    for (uint32_t i = 0; i < h->ndirs; i++) {
+        const cache_dir *d = &pc->dirs[i];
+        int64_t sec, nsec;
+        stat_dir(pc->strings + d->name_off, d->name_len, &sec, &nsec);
+        fprintf(out, "%8zu  %s  %lld.%09lld  %.*s\n", counts[i], is_fresh(pc, i, sec, nsec) ? "fresh" : "stale",
+                (long long)d->mtime_sec, (long long)d->mtime_nsec, (int)d->name_len, pc->strings + d->name_off);
+    }
+    free(counts);
+}
+
+/* Type: function path_cache_close
+ * ----------------------------------
+ * Unmaps the index.
+ */
+void path_cache_close(path_cache *pc)
+{
+    if (pc->map != NULL) munmap(pc->map, pc->size);
+    pc->map = NULL;
+}
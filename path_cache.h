@@ -0,0 +1,59 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// On-disk index from executable name to the search path directories
+// that hold it. The file is mapped read-only and used in place:
+//
+//   cache_header | cache_dir[ndirs] | cache_slot[nslots] | strings
+//
+// strings starts with the search path the index was built for,
+// followed by directory and executable names.
+typedef struct {
+    char magic[8];
+    uint32_t ndirs;
+    uint32_t path_len;
+    uint64_t nslots;       // Power of two
+    uint64_t nentries;
+    int64_t built_sec;     // Wall clock time the index was written
+    uint64_t strings_size;
+} cache_header;
+
+typedef struct {
+    uint32_t name_off;
+    uint32_t name_len;
+    int64_t mtime_sec;     // -1 when the directory could not be stat'ed
+    int64_t mtime_nsec;
+} cache_dir;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t name_off;
+    uint32_t name_len;
+    uint32_t dir;          // CACHE_EMPTY_SLOT when unused
+    uint32_t pad;
+} cache_slot;
+
+#define CACHE_EMPTY_SLOT UINT32_MAX
+
+typedef struct {
+    void *map;
+    size_t size;
+    const cache_header *header;
+    const cache_dir *dirs;
+    const cache_slot *slots;
+    const char *strings;
+} path_cache;
+
+bool path_cache_load(path_cache *pc, const char *file, const char *searchpath);
+bool path_cache_rebuild(const char *file, const char *searchpath, const path_cache *old);
+size_t path_cache_lookup(const path_cache *pc, const char *name, uint32_t *dirs, size_t max_dirs);
+const char *path_cache_dir(const path_cache *pc, uint32_t dir, size_t *len);
+void path_cache_show(const path_cache *pc, FILE *out);
+void path_cache_close(path_cache *pc);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef RAND64_H
+#define RAND64_H
+
+#include <stdint.h>
+
+/* Type: function next_rand
+ * ----------------------------------
+ * splitmix64 step: advances *state and returns the next 64 random bits.
+ * Callers start from a fixed seed, so bench datasets and test inputs
+ * come out the same on every run.
+ */
+static inline uint64_t next_rand(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+#endif
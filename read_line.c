@@ -1,43 +1,131 @@
 #include "samples/prototypes.h"
+#include "read_line.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <error.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
 
-// initial allocation will be for min size, if not big enough, doubles
-// to 64, then 128, then 256, etc. as needed to accommodate the entire line
-#define MINIMUM_SIZE 32
+// Initial reader buffer. Lines longer than this double the buffer
+// (128K, 256K, ...) until the line fits.
+#define READER_BUF_SIZE (1 << 16)
+
+/* Type: function reader_init
+ * ----------------------------------
+ * Takes a reader and the stream to read from. The reader reads the
+ * underlying file descriptor directly, so fp should not also be read
+ * through stdio while the reader is in use.
+ */
+void reader_init(line_reader *r, FILE *fp)
+{
+    r->fd = fileno(fp);
+    r->cap = READER_BUF_SIZE;
+    r->buf = malloc(r->cap + 1);
+    assert(r->buf);
+    r->start = r->end = r->scanned = 0;
+    r->eof = false;
+}
+
+/* Type: function reader_fill
+ * ----------------------------------
+ * Makes room after the unreturned bytes and reads more input. The
+ * partial line at the front is slid down to offset 0 first, and the
+ * buffer only doubles when that partial line already fills it. Sets
+ * eof when read returns 0.
+ */
+static void reader_fill(line_reader *r)
+{
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->scanned -= r->start;
+        r->start = 0;
+    }
+    if (r->end == r->cap) {
+        r->cap *= 2;
+        r->buf = realloc(r->buf, r->cap + 1);
+        assert(r->buf);
+    }
+    ssize_t n;
+    do {
+        n = read(r->fd, r->buf + r->end, r->cap - r->end);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) error(1, errno, "read error");
+    if (n == 0) r->eof = true;
+    r->end += n;
+}
+
+/* Type: function reader_next
+ * ----------------------------------
+ * Stores a view of the next line in *line and returns true, or returns
+ * false at end of input. The newline is replaced by a null character and
+ * is not counted in line->len. A final line without a newline is still
+ * returned. Each byte is scanned for a newline only once, even when a
+ * line spans several refills.
+ */
+bool reader_next(line_reader *r, line_view *line)
+{
+    while (true) {
+        char *nl = memchr(r->buf + r->scanned, '\n', r->end - r->scanned);
+        if (nl != NULL) {
+            *nl = '\0';
+            line->ptr = r->buf + r->start;
+            line->len = nl - line->ptr;
+            r->start = r->scanned = nl - r->buf + 1;
+            return true;
+        }
+        r->scanned = r->end;
+        if (r->eof) {
+            if (r->start == r->end) return false;
+            r->buf[r->end] = '\0'; // Room reserved by the + 1 in every allocation
+            line->ptr = r->buf + r->start;
+            line->len = r->end - r->start;
+            r->start = r->end;
+            return true;
+        }
+        reader_fill(r);
+    }
+}
+
+/* Type: function reader_dispose
+ * ----------------------------------
+ * Frees the reader's buffer. Views it returned are no longer valid.
+ */
+void reader_dispose(line_reader *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+}
 
 /* Type: function read_line
  * ----------------------------------
- * Takes pointer to a FILE struct, reading/writing it line-by-line
+ * Takes pointer to a FILE struct, reading it line-by-line
  * and returning a pointer to a dynamically allocated string of the
- * written line. 
+ * line without its newline, or NULL at end of file. Thin wrapper
+ * around a line_reader that is kept between calls for the same
+ * stream and released at EOF; the stream should only be read through
+ * read_line until then.
  */
 char *read_line(FILE *fp)
 {
-    int ch = getc(fp);
-    if (ch == EOF) return NULL;
-    char *line = malloc(MINIMUM_SIZE);
-    assert(line);
-    if (ch == '\n') return line;
-    ungetc(ch, fp);
-    char *end = fgets(line, MINIMUM_SIZE, fp);
-    if (line[strlen(line) - 1] == '\n') return line;
-    if (feof(fp) != 0) return line; // Check for EOF
-    int resizes = 0;
-    char *catch;
-    while (true) {
-        catch = realloc(line, MINIMUM_SIZE * (resizes + 2));
-        assert(catch);
-        line = catch;
-        resizes++;
-        end = fgets(line + (MINIMUM_SIZE * resizes) - (1 * resizes), MINIMUM_SIZE * resizes, fp);
-        if (end[strlen(end) - 1] == '\n') { // Line ends after first newline
-            end[strlen(end) - 1] = '\0'; // Replace newline with null char
-            break;
-        }
+    static line_reader reader;
+    static FILE *reader_fp = NULL;
+    if (reader_fp != fp) {
+        if (reader_fp != NULL) reader_dispose(&reader);
+        reader_init(&reader, fp);
+        reader_fp = fp;
+    }
+    line_view view;
+    if (!reader_next(&reader, &view)) {
+        reader_dispose(&reader);
+        reader_fp = NULL;
+        return NULL;
     }
+    char *line = malloc(view.len + 1);
+    assert(line);
+    memcpy(line, view.ptr, view.len + 1); // Copy includes the null terminator
     return line;
 }
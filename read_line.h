@@ -0,0 +1,34 @@
+#ifndef READ_LINE_H
+#define READ_LINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// A line inside a reader's buffer, without its newline. ptr is null
+// terminated in place, so it can be printed with %s, but it is only
+// valid until the next call on the reader that produced it.
+typedef struct {
+    const char *ptr;
+    size_t len;
+} line_view;
+
+// Buffered line reader. Owns one large buffer that is refilled with
+// read(2); lines are located with memchr and handed out as views into
+// the buffer. The buffer only grows (geometrically) when a single line
+// does not fit in it.
+typedef struct {
+    int fd;
+    char *buf;
+    size_t cap;     // usable bytes; one more is allocated for a terminator
+    size_t start;   // first byte not yet returned
+    size_t end;     // one past the last byte read
+    size_t scanned; // bytes before this offset are known to hold no newline
+    bool eof;
+} line_reader;
+
+void reader_init(line_reader *r, FILE *fp);
+bool reader_next(line_reader *r, line_view *line);
+void reader_dispose(line_reader *r);
+
+#endif
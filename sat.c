@@ -1,16 +1,29 @@
 #include "samples/prototypes.h"
+#include "sat_batch.h"
+#include "stats.h"
+#include <assert.h>
 #include <errno.h>
 #include <error.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STREAM_PAIRS 4096 // Operand pairs handed to the kernel per call
+#define IO_BUF_SIZE (1 << 20) // Bytes per read and per write in stream mode
+#define MAX_TOKEN 80 // Bytes buffered ahead of each operand in text mode; longer ones are read in pieces
+
+long convert_arg(const char *str, long low, long high, const char *argname);
 
 /*
  * signed_max takes the integer bitwidth which specifies the number of bits, and returns the max value for type long in signed representation.
  */
 long signed_max(int bitwidth)
 { 
-    return (1L << (bitwidth - 1)) - 1L; // Create a ones long and left shift it, then subtract one
+    return (long)((1UL << (bitwidth - 1)) - 1UL); // Shift an unsigned one so bitwidth 64 does not shift into the sign bit, then subtract one
 }
 
 /*
@@ -18,21 +31,274 @@ long signed_max(int bitwidth)
  */
 long signed_min(int bitwidth)
 {
-    return -1L << (bitwidth - 1); // Create a negative ones long then shift it by number of bits - 1
+    return -signed_max(bitwidth) - 1L; // Two's complement range is one wider on the negative side
 }
 
 /*
- * sat_add takes two values longs a and b and an int bitwidth and returns the saturated sum. The addition operation conditionally checks for overflow or underflow in the case of both values being both positive or both negative. If one value is negative and one is positive, they'll never be big enough to overflow/underflow.
+ * sat_add takes two values longs a and b and an int bitwidth and returns the saturated sum. The addition operation conditionally checks for overflow or underflow in the case of both values being both positive or both negative. If one value is negative and one is positive, they'll never be big enough to overflow/underflow. The sign mask is built from an unsigned long so widths above 32 bits work, and the sum is taken in unsigned arithmetic so a 64-bit overflow wraps instead of being undefined. sat_batch.c has array versions of this for bulk data.
  */
 long sat_add(long a, long b, int bitwidth)
 {
-    if (((a & (1 << (bitwidth - 1))) == 0) && ((b & (1 << (bitwidth - 1))) == 0)){ // Both values are positive
-         if (((a+b) & (1 << (bitwidth - 1))) != 0) return signed_max(bitwidth);// Sign changes, so just return signed_max
+    unsigned long sign_bit = 1UL << (bitwidth - 1); // Mask for the sign bit at this width
+    long sum = (long)((unsigned long)a + (unsigned long)b);
+    if (((a & sign_bit) == 0) && ((b & sign_bit) == 0)){ // Both values are positive
+         if ((sum & sign_bit) != 0) return signed_max(bitwidth);// Sign changes, so just return signed_max
+    }
+    if (((a & sign_bit) != 0) && ((b & sign_bit) != 0)){ // Both values are negative
+         if ((sum & sign_bit) == 0) return signed_min(bitwidth); // Sign changes to positive, so return signed_min
+    }
+    return sum; // Numbers are not same sign, so return sum
+}
+
+/*
+ * in_stream is a large read buffer over a file descriptor. The byte after the buffered data is always a null sentinel, so the parser can scan a token without checking the buffer end on every character.
+ */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t start, end; // Unconsumed bytes are buf[start..end)
+    bool eof;
+} in_stream;
+
+/*
+ * out_stream collects output in a large buffer and writes it in IO_BUF_SIZE pieces.
+ */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+} out_stream;
+
+/*
+ * fill_stream moves the unconsumed bytes to the front of the buffer and reads more until at least want bytes are buffered or the input ends.
+ */
+static void fill_stream(in_stream *in, size_t want)
+{
+    memmove(in->buf, in->buf + in->start, in->end - in->start);
+    in->end -= in->start;
+    in->start = 0;
+    while (!in->eof && in->end < want) {
+        ssize_t nread = read(in->fd, in->buf + in->end, IO_BUF_SIZE - in->end);
+        if (nread < 0) error(1, errno, "read failed");
+        if (nread == 0) in->eof = true;
+        in->end += nread;
+    }
+    in->buf[in->end] = '\0'; // Sentinel
+}
+
+/*
+ * flush_stream writes out everything buffered in out. Fatal error if the write fails.
+ */
+static void flush_stream(out_stream *out)
+{
+    size_t done = 0;
+    while (done < out->len) {
+        ssize_t nwritten = write(out->fd, out->buf + done, out->len - done);
+        if (nwritten < 0) error(1, errno, "write failed");
+        done += nwritten;
+    }
+    out->len = 0;
+}
+
+/*
+ * put_long appends the decimal form of n and a newline to out. Digits are produced from the end of a small scratch array, then copied in one piece.
+ */
+static void put_long(out_stream *out, long n)
+{
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long mag = n < 0 ? -(unsigned long)n : (unsigned long)n; // Negate as unsigned so LONG_MIN works
+    *--p = '\n';
+    do {
+        *--p = '0' + mag % 10;
+        mag /= 10;
+    } while (mag != 0);
+    if (n < 0) *--p = '-';
+    size_t len = digits + sizeof(digits) - p;
+    if (out->len + len > IO_BUF_SIZE) flush_stream(out);
+    memcpy(out->buf + out->len, p, len);
+    out->len += len;
+}
+
+/*
+ * digit_value returns the value of c as a digit in bases up to 16, or 16 if it is not a digit.
+ */
+static inline unsigned digit_value(unsigned char c)
+{
+    if ((unsigned)(c - '0') < 10) return c - '0';
+    c |= 0x20; // Fold to lower case
+    if ((unsigned)(c - 'a') < 6) return c - 'a' + 10;
+    return 16;
+}
+
+/*
+ * is_space is isspace for the C locale without the locale lookup: space, \t, \n, \v, \f and \r.
+ */
+static inline bool is_space(char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') < 5;
+}
+
+/*
+ * read_operand parses the next whitespace-separated integer from in into *value and returns true, or returns false at the end of input. Accepts the same forms as strtol with base 0 (optional sign, 0x hex, leading-zero octal, decimal) and applies the same range check as convert_arg, without copying the token. A token longer than the buffered look-ahead is scanned across refills, so any number of leading zeros is accepted as strtol accepts it.
+ */
+static bool read_operand(in_stream *in, long *value, long min, long max)
+{
+    while (true) {
+        while (in->start < in->end && is_space(in->buf[in->start])) in->start++;
+        if (in->start < in->end) break;
+        if (in->eof) return false;
+        fill_stream(in, MAX_TOKEN);
+    }
+    if (in->end - in->start < MAX_TOKEN) fill_stream(in, MAX_TOKEN);
+    const char *token = in->buf + in->start;
+    const char *p = token;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') p++;
+    unsigned base = 10;
+    if (p[0] == '0' && (p[1] | 0x20) == 'x' && digit_value(p[2]) < 16) {
+        base = 16;
+        p += 2;
+    } else if (p[0] == '0') {
+        base = 8;
+    }
+    size_t digits = p - token;
+    unsigned long mag = 0;
+    bool overflow = false;
+    bool dropped = false; // Digits past the first MAX_TOKEN bytes were discarded to make room
+    for (unsigned d;; p++) {
+        if (p == in->buf + in->end && !in->eof) { // Token runs past the buffered bytes: read more and keep scanning
+            size_t offset = p - token;
+            if (offset == IO_BUF_SIZE) { // Token fills the buffer; its value is in mag, so keep only a prefix for messages
+                in->end = in->start + MAX_TOKEN;
+                offset = MAX_TOKEN;
+                dropped = true;
+            }
+            fill_stream(in, offset + 1);
+            token = in->buf + in->start;
+            p = token + offset;
+        }
+        if ((d = digit_value(*p)) >= base) break;
+        if (mag > (ULONG_MAX - d) / base) overflow = true;
+        mag = mag * base + d;
     }
-    if (((a & (1 << (bitwidth - 1))) != 0) && ((b & (1 << (bitwidth - 1))) != 0)){ // Both values are negative
-         if (((a+b) & (1 << (bitwidth - 1))) == 0) return signed_min(bitwidth); // Sign changes to positive, so return signed_min
+    size_t len = p - token;
+    bool at_end = p == in->buf + in->end; // Only reached at EOF now
+    if (len == digits || !(at_end || is_space(*p))) {
+        while (*p != '\0' && !is_space(*p)) p++; // Extent of the bad token for the message
+        error(1, 0, "Invalid number '%.*s%s'", dropped ? MAX_TOKEN : (int)(p - token), token, dropped ? "..." : "");
     }
-    return a + b; // Numbers are not same sign, so return sum
+    long n = negative ? (long)(0UL - mag) : (long)mag;
+    if (overflow || mag > (negative ? 0UL - (unsigned long)LONG_MIN : (unsigned long)LONG_MAX) || n < min || n > max)
+        error(1, 0, "Illegal value %.*s%s. Operand must be in range [%ld, %ld]", dropped ? MAX_TOKEN : (int)len, token, dropped ? "..." : "", min, max);
+    in->start += len;
+    *value = n;
+    return true;
+}
+
+/*
+ * stream_text reads whitespace-separated operand pairs from in_fd, saturates the sums STREAM_PAIRS at a time through sat_add_long, and writes one sum per line to out_fd.
+ */
+static void stream_text(int in_fd, int out_fd, int bitwidth)
+{
+    long min = signed_min(bitwidth);
+    long max = signed_max(bitwidth);
+    in_stream in = {in_fd, malloc(IO_BUF_SIZE + 1), 0, 0, false};
+    out_stream out = {out_fd, malloc(IO_BUF_SIZE), 0};
+    long *a = malloc(3 * STREAM_PAIRS * sizeof(long));
+    assert(in.buf && out.buf && a);
+    long *b = a + STREAM_PAIRS, *sum = b + STREAM_PAIRS;
+    bool more = true;
+    while (more) {
+        size_t n = 0;
+        while (n < STREAM_PAIRS && (more = read_operand(&in, &a[n], min, max))) {
+            if (!read_operand(&in, &b[n], min, max)) error(1, 0, "Missing second operand after %ld", a[n]);
+            n++;
+        }
+        sat_add_long(a, b, sum, n, bitwidth);
+        for (size_t i = 0; i < n; i++) put_long(&out, sum[i]);
+    }
+    flush_stream(&out);
+    free(in.buf);
+    free(out.buf);
+    free(a);
+}
+
+/*
+ * read_full reads up to len bytes into buf, retrying short reads, and returns how many were read; fewer than len only at end of input.
+ */
+static size_t read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t nread = read(fd, (char *)buf + done, len - done);
+        if (nread < 0) error(1, errno, "read failed");
+        if (nread == 0) break;
+        done += nread;
+    }
+    return done;
+}
+
+/*
+ * stream_binary is stream_text for raw operands: native-endian 64-bit pairs in, one native-endian 64-bit sum per pair out.
+ */
+static void stream_binary(int in_fd, int out_fd, int bitwidth)
+{
+    long min = signed_min(bitwidth);
+    long max = signed_max(bitwidth);
+    long *pairs = malloc(2 * STREAM_PAIRS * sizeof(long));
+    long *a = malloc(3 * STREAM_PAIRS * sizeof(long));
+    assert(pairs && a);
+    long *b = a + STREAM_PAIRS, *sum = b + STREAM_PAIRS;
+    out_stream out = {out_fd, (char *)sum, 0};
+    size_t total = 0; // Pairs before this batch, for error messages
+    while (true) {
+        size_t nbytes = read_full(in_fd, pairs, 2 * STREAM_PAIRS * sizeof(long));
+        if (nbytes % (2 * sizeof(long)) != 0) error(1, 0, "Truncated input: %zu bytes after pair %zu", nbytes % (2 * sizeof(long)), total + nbytes / (2 * sizeof(long)));
+        size_t n = nbytes / (2 * sizeof(long));
+        bool in_range = true;
+        for (size_t i = 0; i < n; i++) {
+            a[i] = pairs[2 * i];
+            b[i] = pairs[2 * i + 1];
+            in_range &= a[i] >= min && a[i] <= max && b[i] >= min && b[i] <= max; // No branch in the loop
+        }
+        if (!in_range) {
+            for (size_t i = 0; i < n; i++) {
+                if (a[i] < min || a[i] > max || b[i] < min || b[i] > max)
+                    error(1, 0, "Operand out of range [%ld, %ld] in pair %zu", min, max, total + i);
+            }
+        }
+        sat_add_long(a, b, sum, n, bitwidth);
+        out.len = n * sizeof(long);
+        flush_stream(&out);
+        total += n;
+        if (n < STREAM_PAIRS) break;
+    }
+    free(pairs);
+    free(a);
+}
+
+/*
+ * sat_stream runs stream mode from the arguments after --stream: an optional --binary, the bitwidth, and an optional input file (stdin if absent or "-"). Returns the exit status.
+ */
+int sat_stream(int argc, char *argv[])
+{
+    bool binary = argc > 0 && strcmp(argv[0], "--binary") == 0;
+    if (binary) {
+        argc--;
+        argv++;
+    }
+    if (argc < 1 || argc > 2) error(1, 0, "Usage: sat --stream [--binary] bitwidth [file]");
+    int bitwidth = convert_arg(argv[0], 4, sizeof(long)*8, "Bitwidth");
+    int fd = STDIN_FILENO;
+    if (argc == 2 && strcmp(argv[1], "-") != 0) {
+        fd = open(argv[1], O_RDONLY);
+        if (fd < 0) error(1, errno, "cannot open '%s'", argv[1]);
+    }
+    if (binary) stream_binary(fd, STDOUT_FILENO, bitwidth);
+    else stream_text(fd, STDOUT_FILENO, bitwidth);
+    if (fd != STDIN_FILENO) close(fd);
+    return 0;
 }
 
 
@@ -55,10 +321,12 @@ long convert_arg(const char *str, long low, long high, const char *argname)
 }
 
 /*
- * This program sat performs saturating addition by checking for overflow and underflow for a value in signed representation for a given bitwidth. The function returns signed_max for overflow and signed_min for underflow cases, and otherwise returns the correct sum of the signed values.
+ * This program sat performs saturating addition by checking for overflow and underflow for a value in signed representation for a given bitwidth. The function returns signed_max for overflow and signed_min for underflow cases, and otherwise returns the correct sum of the signed values. With --stream it reads operand pairs from stdin or a file and prints one saturated sum per pair.
  */
 int main(int argc, char *argv[])
 {
+    STATS_INIT(&argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "--stream") == 0) return sat_stream(argc - 2, argv + 2); // Bulk mode over stdin or a file
     if (argc < 2) error(1, 0, "Missing argument. Please specify the bitwidth."); // Error handling for not enough arguments
     
     int bitwidth = convert_arg(argv[1], 4, sizeof(long)*8, "Bitwidth"); // Convert user input for bitwidth as stored as the second inputted argument
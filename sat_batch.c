@@ -0,0 +1,548 @@
+#include "sat_batch.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAT_X86 1
+#include <immintrin.h>
+#endif
+
+// The long entry points hand 64-bit work to the int64_t kernels.
+_Static_assert(sizeof(long) == sizeof(int64_t), "sat_batch assumes 64-bit long");
+
+/* Type: macro SCALAR_KERNELS
+ * ----------------------------------
+ * Generates the portable add, sub and multiply-accumulate loops for
+ * one element type. Add and sub detect overflow with the compiler's
+ * checked builtins and pick the bound on the side of a's sign, which
+ * compiles to a conditional move rather than a branch. The
+ * accumulate is done exactly in the wider type WIDE and clamped once.
+ * These also finish the tails that vector kernels leave behind.
+ */
+#define SCALAR_KERNELS(T, WIDE, MIN, MAX, name) \
+static void add_##name##_scalar(const T *a, const T *b, T *out, size_t n) \
+{ \
+    for (size_t i = 0; i < n; i++) { \
+        T sum; \
+        bool over = __builtin_add_overflow(a[i], b[i], &sum); \
+        out[i] = over ? (a[i] < 0 ? MIN : MAX) : sum; \
+    } \
+} \
+static void sub_##name##_scalar(const T *a, const T *b, T *out, size_t n) \
+{ \
+    for (size_t i = 0; i < n; i++) { \
+        T diff; \
+        bool over = __builtin_sub_overflow(a[i], b[i], &diff); \
+        out[i] = over ? (a[i] < 0 ? MIN : MAX) : diff; \
+    } \
+} \
+static void mac_##name##_scalar(T *acc, const T *a, const T *b, size_t n) \
+{ \
+    for (size_t i = 0; i < n; i++) { \
+        WIDE total = (WIDE)acc[i] + (WIDE)a[i] * b[i]; \
+        acc[i] = total < MIN ? MIN : total > MAX ? MAX : total; \
+    } \
+}
+
+SCALAR_KERNELS(int8_t, int32_t, INT8_MIN, INT8_MAX, i8)
+SCALAR_KERNELS(int16_t, int32_t, INT16_MIN, INT16_MAX, i16)
+SCALAR_KERNELS(int32_t, int64_t, INT32_MIN, INT32_MAX, i32)
+SCALAR_KERNELS(int64_t, __int128, INT64_MIN, INT64_MAX, i64)
+
+/* Type: function clamp_long_scalar
+ * ----------------------------------
+ * Portable add (sign 1) or sub (sign -1) for widths below 64 bits,
+ * where in-range operands cannot overflow a long, so saturating is a
+ * clamp of the plain result.
+ */
+static void clamp_long_scalar(const long *a, const long *b, long *out, size_t n, int sign, long min, long max)
+{
+    for (size_t i = 0; i < n; i++) {
+        long r = a[i] + sign * b[i];
+        out[i] = r < min ? min : r > max ? max : r;
+    }
+}
+
+/* Type: function mac_long_scalar
+ * ----------------------------------
+ * Portable multiply-accumulate for any width, exact in 128 bits.
+ */
+static void mac_long_scalar(long *acc, const long *a, const long *b, size_t n, long min, long max)
+{
+    for (size_t i = 0; i < n; i++) {
+        __int128 total = (__int128)acc[i] + (__int128)a[i] * b[i];
+        acc[i] = total < min ? min : total > max ? max : total;
+    }
+}
+
+#ifdef SAT_X86
+/* Type: macro NATIVE_KERNEL
+ * ----------------------------------
+ * Generates a loop around an instruction that saturates by itself
+ * (padds/psubs for 8- and 16-bit lanes). Returns how many elements it
+ * handled; the caller finishes the rest with the scalar kernel.
+ */
+#define NATIVE_KERNEL(fn, T, vec, load, store, op, target_isa) \
+__attribute__((target(target_isa))) \
+static size_t fn(const T *a, const T *b, T *out, size_t n) \
+{ \
+    const size_t step = sizeof(vec) / sizeof(T); \
+    size_t i = 0; \
+    for (; i + step <= n; i += step) \
+        store((vec *)(out + i), op(load((const vec *)(a + i)), load((const vec *)(b + i)))); \
+    return i; \
+}
+
+NATIVE_KERNEL(add_i8_sse2, int8_t, __m128i, _mm_loadu_si128, _mm_storeu_si128, _mm_adds_epi8, "sse2")
+NATIVE_KERNEL(add_i16_sse2, int16_t, __m128i, _mm_loadu_si128, _mm_storeu_si128, _mm_adds_epi16, "sse2")
+NATIVE_KERNEL(sub_i8_sse2, int8_t, __m128i, _mm_loadu_si128, _mm_storeu_si128, _mm_subs_epi8, "sse2")
+NATIVE_KERNEL(sub_i16_sse2, int16_t, __m128i, _mm_loadu_si128, _mm_storeu_si128, _mm_subs_epi16, "sse2")
+NATIVE_KERNEL(add_i8_avx2, int8_t, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_adds_epi8, "avx2")
+NATIVE_KERNEL(add_i16_avx2, int16_t, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_adds_epi16, "avx2")
+NATIVE_KERNEL(sub_i8_avx2, int8_t, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_subs_epi8, "avx2")
+NATIVE_KERNEL(sub_i16_avx2, int16_t, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_subs_epi16, "avx2")
+
+/* Type: function add_i32_avx2
+ * ----------------------------------
+ * There is no saturating instruction for 32-bit lanes, so the sum
+ * wraps and lanes where it overflowed (sign differs from both inputs)
+ * are replaced with INT32_MAX or INT32_MIN, chosen by a's sign.
+ */
+__attribute__((target("avx2")))
+static size_t add_i32_avx2(const int32_t *a, const int32_t *b, int32_t *out, size_t n)
+{
+    const __m256i max = _mm256_set1_epi32(INT32_MAX);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i sum = _mm256_add_epi32(va, vb);
+        __m256i over = _mm256_and_si256(_mm256_xor_si256(va, sum), _mm256_xor_si256(vb, sum));
+        __m256i bound = _mm256_xor_si256(_mm256_srai_epi32(va, 31), max);
+        __m256 pick = _mm256_blendv_ps(_mm256_castsi256_ps(sum), _mm256_castsi256_ps(bound), _mm256_castsi256_ps(over));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_castps_si256(pick));
+    }
+    return i;
+}
+
+/* Type: function sub_i32_avx2
+ * ----------------------------------
+ * As add_i32_avx2; a difference overflows when the operands differ in
+ * sign and the result's sign differs from a's.
+ */
+__attribute__((target("avx2")))
+static size_t sub_i32_avx2(const int32_t *a, const int32_t *b, int32_t *out, size_t n)
+{
+    const __m256i max = _mm256_set1_epi32(INT32_MAX);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i diff = _mm256_sub_epi32(va, vb);
+        __m256i over = _mm256_and_si256(_mm256_xor_si256(va, vb), _mm256_xor_si256(va, diff));
+        __m256i bound = _mm256_xor_si256(_mm256_srai_epi32(va, 31), max);
+        __m256 pick = _mm256_blendv_ps(_mm256_castsi256_ps(diff), _mm256_castsi256_ps(bound), _mm256_castsi256_ps(over));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_castps_si256(pick));
+    }
+    return i;
+}
+
+/* Type: function add_i64_avx2
+ * ----------------------------------
+ * 64-bit version of add_i32_avx2. AVX2 has no 64-bit arithmetic
+ * shift, so a's sign mask comes from a compare against zero.
+ */
+__attribute__((target("avx2")))
+static size_t add_i64_avx2(const int64_t *a, const int64_t *b, int64_t *out, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi64x(INT64_MAX);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i sum = _mm256_add_epi64(va, vb);
+        __m256i over = _mm256_and_si256(_mm256_xor_si256(va, sum), _mm256_xor_si256(vb, sum));
+        __m256i bound = _mm256_xor_si256(_mm256_cmpgt_epi64(zero, va), max);
+        __m256d pick = _mm256_blendv_pd(_mm256_castsi256_pd(sum), _mm256_castsi256_pd(bound), _mm256_castsi256_pd(over));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_castpd_si256(pick));
+    }
+    return i;
+}
+
+/* Type: function sub_i64_avx2
+ * ----------------------------------
+ * 64-bit version of sub_i32_avx2.
+ */
+__attribute__((target("avx2")))
+static size_t sub_i64_avx2(const int64_t *a, const int64_t *b, int64_t *out, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi64x(INT64_MAX);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i diff = _mm256_sub_epi64(va, vb);
+        __m256i over = _mm256_and_si256(_mm256_xor_si256(va, vb), _mm256_xor_si256(va, diff));
+        __m256i bound = _mm256_xor_si256(_mm256_cmpgt_epi64(zero, va), max);
+        __m256d pick = _mm256_blendv_pd(_mm256_castsi256_pd(diff), _mm256_castsi256_pd(bound), _mm256_castsi256_pd(over));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_castpd_si256(pick));
+    }
+    return i;
+}
+
+/* Type: function mac_i8_avx2
+ * ----------------------------------
+ * Widens sixteen lanes to 16 bits, where a product plus the
+ * accumulator cannot overflow, and narrows back with a saturating pack.
+ */
+__attribute__((target("avx2")))
+static size_t mac_i8_avx2(int8_t *acc, const int8_t *a, const int8_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+        __m256i vacc = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(acc + i)));
+        __m256i total = _mm256_add_epi16(vacc, _mm256_mullo_epi16(va, vb));
+        __m128i packed = _mm_packs_epi16(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+        _mm_storeu_si128((__m128i *)(acc + i), packed);
+    }
+    return i;
+}
+
+/* Type: function mac_i16_avx2
+ * ----------------------------------
+ * Forms 32-bit products from the low and high multiply halves, adds
+ * the sign-extended accumulator and narrows with a saturating pack.
+ * The unpacks and the pack both work within 128-bit lanes, so element
+ * order is preserved without a permute.
+ */
+__attribute__((target("avx2")))
+static size_t mac_i16_avx2(int16_t *acc, const int16_t *a, const int16_t *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i vacc = _mm256_loadu_si256((const __m256i *)(acc + i));
+        __m256i lo = _mm256_mullo_epi16(va, vb);
+        __m256i hi = _mm256_mulhi_epi16(va, vb);
+        __m256i sign = _mm256_srai_epi16(vacc, 15);
+        __m256i total0 = _mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), _mm256_unpacklo_epi16(vacc, sign));
+        __m256i total1 = _mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), _mm256_unpackhi_epi16(vacc, sign));
+        _mm256_storeu_si256((__m256i *)(acc + i), _mm256_packs_epi32(total0, total1));
+    }
+    return i;
+}
+
+/* Type: function clamp_epi64
+ * ----------------------------------
+ * Clamps each signed 64-bit lane of x to [min, max].
+ */
+__attribute__((target("avx2")))
+static inline __m256i clamp_epi64(__m256i x, __m256i min, __m256i max)
+{
+    x = _mm256_blendv_epi8(x, max, _mm256_cmpgt_epi64(x, max));
+    return _mm256_blendv_epi8(x, min, _mm256_cmpgt_epi64(min, x));
+}
+
+/* Type: function mac4_epi64
+ * ----------------------------------
+ * acc + a * b for four 64-bit lanes whose a and b values fit in 32
+ * signed bits, clamped to [min, max]. vpmuldq multiplies the low
+ * 32 bits of each lane into an exact 64-bit product.
+ */
+__attribute__((target("avx2")))
+static inline __m256i mac4_epi64(__m256i acc, __m256i a, __m256i b, __m256i min, __m256i max)
+{
+    return clamp_epi64(_mm256_add_epi64(acc, _mm256_mul_epi32(a, b)), min, max);
+}
+
+/* Type: function mac_i32_avx2
+ * ----------------------------------
+ * Sign-extends each half of eight lanes to 64 bits, accumulates with
+ * mac4_epi64 and gathers the low words back into one register.
+ */
+__attribute__((target("avx2")))
+static size_t mac_i32_avx2(int32_t *acc, const int32_t *a, const int32_t *b, size_t n)
+{
+    const __m256i min = _mm256_set1_epi64x(INT32_MIN);
+    const __m256i max = _mm256_set1_epi64x(INT32_MAX);
+    const __m256i low_words = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i half[2];
+        for (int h = 0; h < 2; h++) {
+            size_t k = i + 4 * h;
+            __m256i va = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(a + k)));
+            __m256i vb = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(b + k)));
+            __m256i vacc = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(acc + k)));
+            half[h] = _mm256_permutevar8x32_epi32(mac4_epi64(vacc, va, vb, min, max), low_words);
+        }
+        __m256i total = _mm256_inserti128_si256(half[0], _mm256_castsi256_si128(half[1]), 1);
+        _mm256_storeu_si256((__m256i *)(acc + i), total);
+    }
+    return i;
+}
+
+/* Type: function clamp_long_avx2
+ * ----------------------------------
+ * Vector clamp_long_scalar: plain 64-bit add or sub, then a clamp to
+ * the bitwidth's range.
+ */
+__attribute__((target("avx2")))
+static size_t clamp_long_avx2(const long *a, const long *b, long *out, size_t n, int sign, long min, long max)
+{
+    const __m256i vmin = _mm256_set1_epi64x(min);
+    const __m256i vmax = _mm256_set1_epi64x(max);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i r = sign > 0 ? _mm256_add_epi64(va, vb) : _mm256_sub_epi64(va, vb);
+        _mm256_storeu_si256((__m256i *)(out + i), clamp_epi64(r, vmin, vmax));
+    }
+    return i;
+}
+
+/* Type: function mac_long_avx2
+ * ----------------------------------
+ * Vector multiply-accumulate for widths up to 32 bits, where the
+ * operands fit vpmuldq and the exact total fits 64 bits.
+ */
+__attribute__((target("avx2")))
+static size_t mac_long_avx2(long *acc, const long *a, const long *b, size_t n, long min, long max)
+{
+    const __m256i vmin = _mm256_set1_epi64x(min);
+    const __m256i vmax = _mm256_set1_epi64x(max);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i vacc = _mm256_loadu_si256((const __m256i *)(acc + i));
+        _mm256_storeu_si256((__m256i *)(acc + i), mac4_epi64(vacc, va, vb, vmin, vmax));
+    }
+    return i;
+}
+#endif
+
+static bool have_avx2;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+/* Type: function detect_cpu
+ * ----------------------------------
+ * Records whether the running CPU has AVX2. Called once through
+ * pthread_once.
+ */
+static void detect_cpu(void)
+{
+#ifdef SAT_X86
+    __builtin_cpu_init();
+    have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+/* Type: function use_avx2
+ * ----------------------------------
+ * True when the AVX2 kernels may run.
+ */
+static inline bool use_avx2(void)
+{
+    pthread_once(&cpu_once, detect_cpu);
+    return have_avx2;
+}
+
+/* Type: macro NATIVE_ENTRY
+ * ----------------------------------
+ * Public wrapper for the 8- and 16-bit add and sub: AVX2 when present,
+ * else SSE2 (always there on x86-64), with the scalar kernel finishing
+ * the tail and covering other targets.
+ */
+#ifdef SAT_X86
+#define NATIVE_ENTRY(op, T, name) \
+void sat_##op##_##name(const T *a, const T *b, T *out, size_t n) \
+{ \
+    size_t done = use_avx2() ? op##_##name##_avx2(a, b, out, n) : op##_##name##_sse2(a, b, out, n); \
+    op##_##name##_scalar(a + done, b + done, out + done, n - done); \
+}
+#else
+#define NATIVE_ENTRY(op, T, name) \
+void sat_##op##_##name(const T *a, const T *b, T *out, size_t n) \
+{ \
+    op##_##name##_scalar(a, b, out, n); \
+}
+#endif
+
+/* Type: macro AVX2_ENTRY
+ * ----------------------------------
+ * Public wrapper for kernels that exist only for AVX2: the vector
+ * kernel runs first when available and the scalar one takes the rest.
+ */
+#ifdef SAT_X86
+#define AVX2_ENTRY(op, T, name) \
+void sat_##op##_##name(T *x, const T *a, const T *b, size_t n) \
+{ \
+    size_t done = use_avx2() ? op##_##name##_avx2(x, a, b, n) : 0; \
+    op##_##name##_scalar(x + done, a + done, b + done, n - done); \
+}
+#else
+#define AVX2_ENTRY(op, T, name) \
+void sat_##op##_##name(T *x, const T *a, const T *b, size_t n) \
+{ \
+    op##_##name##_scalar(x, a, b, n); \
+}
+#endif
+
+NATIVE_ENTRY(add, int8_t, i8)
+NATIVE_ENTRY(add, int16_t, i16)
+NATIVE_ENTRY(sub, int8_t, i8)
+NATIVE_ENTRY(sub, int16_t, i16)
+
+/* Type: function sat_add_i32
+ * ----------------------------------
+ * Saturating a[i] + b[i] for 32-bit elements.
+ */
+void sat_add_i32(const int32_t *a, const int32_t *b, int32_t *out, size_t n)
+{
+    size_t done = 0;
+#ifdef SAT_X86
+    if (use_avx2()) done = add_i32_avx2(a, b, out, n);
+#endif
+    add_i32_scalar(a + done, b + done, out + done, n - done);
+}
+
+/* Type: function sat_sub_i32
+ * ----------------------------------
+ * Saturating a[i] - b[i] for 32-bit elements.
+ */
+void sat_sub_i32(const int32_t *a, const int32_t *b, int32_t *out, size_t n)
+{
+    size_t done = 0;
+#ifdef SAT_X86
+    if (use_avx2()) done = sub_i32_avx2(a, b, out, n);
+#endif
+    sub_i32_scalar(a + done, b + done, out + done, n - done);
+}
+
+/* Type: function sat_add_i64
+ * ----------------------------------
+ * Saturating a[i] + b[i] for 64-bit elements.
+ */
+void sat_add_i64(const int64_t *a, const int64_t *b, int64_t *out, size_t n)
+{
+    size_t done = 0;
+#ifdef SAT_X86
+    if (use_avx2()) done = add_i64_avx2(a, b, out, n);
+#endif
+    add_i64_scalar(a + done, b + done, out + done, n - done);
+}
+
+/* Type: function sat_sub_i64
+ * ----------------------------------
+ * Saturating a[i] - b[i] for 64-bit elements.
+ */
+void sat_sub_i64(const int64_t *a, const int64_t *b, int64_t *out, size_t n)
+{
+    size_t done = 0;
+#ifdef SAT_X86
+    if (use_avx2()) done = sub_i64_avx2(a, b, out, n);
+#endif
+    sub_i64_scalar(a + done, b + done, out + done, n - done);
+}
+
+AVX2_ENTRY(mac, int8_t, i8)
+AVX2_ENTRY(mac, int16_t, i16)
+AVX2_ENTRY(mac, int32_t, i32)
+
+/* Type: function sat_mac_i64
+ * ----------------------------------
+ * Saturating acc[i] + a[i] * b[i] for 64-bit elements. There is no
+ * 64x64-bit vector multiply, so this is always the 128-bit scalar loop.
+ */
+void sat_mac_i64(int64_t *acc, const int64_t *a, const int64_t *b, size_t n)
+{
+    mac_i64_scalar(acc, a, b, n);
+}
+
+/* Type: function long_range
+ * ----------------------------------
+ * Signed range of bitwidth, as signed_min and signed_max compute it
+ * but safe at 64 bits.
+ */
+static void long_range(int bitwidth, long *min, long *max)
+{
+    *max = (long)((1UL << (bitwidth - 1)) - 1);
+    *min = -*max - 1;
+}
+
+/* Type: function sat_add_long
+ * ----------------------------------
+ * Array form of sat_add: saturating a[i] + b[i] at any bitwidth from 2
+ * to 64. Full 64-bit widths use the overflow-detecting kernels; narrower
+ * ones cannot overflow a long and only need a clamp.
+ */
+void sat_add_long(const long *a, const long *b, long *out, size_t n, int bitwidth)
+{
+    if (bitwidth == 64) {
+        sat_add_i64((const int64_t *)a, (const int64_t *)b, (int64_t *)out, n);
+        return;
+    }
+    long min, max;
+    long_range(bitwidth, &min, &max);
+    size_t done = 0;
+#ifdef SAT_X86
+    if (use_avx2()) done = clamp_long_avx2(a, b, out, n, 1, min, max);
+#endif
+    clamp_long_scalar(a + done, b + done, out + done, n - done, 1, min, max);
+}
+
+/* Type: function sat_sub_long
+ * ----------------------------------
+ * Saturating a[i] - b[i] at any bitwidth from 2 to 64.
+ */
+void sat_sub_long(const long *a, const long *b, long *out, size_t n, int bitwidth)
+{
+    if (bitwidth == 64) {
+        sat_sub_i64((const int64_t *)a, (const int64_t *)b, (int64_t *)out, n);
+        return;
+    }
+    long min, max;
+    long_range(bitwidth, &min, &max);
+    size_t done = 0;
+#ifdef SAT_X86
+    if (use_avx2()) done = clamp_long_avx2(a, b, out, n, -1, min, max);
+#endif
+    clamp_long_scalar(a + done, b + done, out + done, n - done, -1, min, max);
+}
+
+/* Type: function sat_mac_long
+ * ----------------------------------
+ * Saturating acc[i] + a[i] * b[i] at any bitwidth from 2 to 64. Widths
+ * up to 32 bits run in 64-bit vector lanes; wider ones need the
+ * 128-bit scalar loop.
+ */
+void sat_mac_long(long *acc, const long *a, const long *b, size_t n, int bitwidth)
+{
+    long min, max;
+    long_range(bitwidth, &min, &max);
+    size_t done = 0;
+#ifdef SAT_X86
+    if (bitwidth <= 32 && use_avx2()) done = mac_long_avx2(acc, a, b, n, min, max);
+#endif
+    mac_long_scalar(acc + done, a + done, b + done, n - done, min, max);
+}
+
+/* Type: function sat_kernel_name
+ * ----------------------------------
+ * Name of the widest kernel set in use, for benchmark reports.
+ */
+const char *sat_kernel_name(void)
+{
+#ifdef SAT_X86
+    return use_avx2() ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,33 @@
+#ifndef SAT_BATCH_H
+#define SAT_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Element-wise saturating arithmetic over arrays. out may alias a or b.
+// The multiply-accumulate forms compute acc[i] + a[i] * b[i] exactly and
+// saturate once, rather than saturating the product first.
+void sat_add_i8(const int8_t *a, const int8_t *b, int8_t *out, size_t n);
+void sat_add_i16(const int16_t *a, const int16_t *b, int16_t *out, size_t n);
+void sat_add_i32(const int32_t *a, const int32_t *b, int32_t *out, size_t n);
+void sat_add_i64(const int64_t *a, const int64_t *b, int64_t *out, size_t n);
+
+void sat_sub_i8(const int8_t *a, const int8_t *b, int8_t *out, size_t n);
+void sat_sub_i16(const int16_t *a, const int16_t *b, int16_t *out, size_t n);
+void sat_sub_i32(const int32_t *a, const int32_t *b, int32_t *out, size_t n);
+void sat_sub_i64(const int64_t *a, const int64_t *b, int64_t *out, size_t n);
+
+void sat_mac_i8(int8_t *acc, const int8_t *a, const int8_t *b, size_t n);
+void sat_mac_i16(int16_t *acc, const int16_t *a, const int16_t *b, size_t n);
+void sat_mac_i32(int32_t *acc, const int32_t *a, const int32_t *b, size_t n);
+void sat_mac_i64(int64_t *acc, const int64_t *a, const int64_t *b, size_t n);
+
+// Arbitrary widths from 2 to 64 bits held in longs, as sat_add does.
+// Operands must already lie in the signed range of bitwidth.
+void sat_add_long(const long *a, const long *b, long *out, size_t n, int bitwidth);
+void sat_sub_long(const long *a, const long *b, long *out, size_t n, int bitwidth);
+void sat_mac_long(long *acc, const long *a, const long *b, size_t n, int bitwidth);
+
+const char *sat_kernel_name(void);
+
+#endif
@@ -0,0 +1,219 @@
+#include "samples/prototypes.h"
+#include "rand64.h"
+#include "sat_batch.h"
+#include <assert.h>
+#include <errno.h>
+#include <error.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * sat_batch_test sweeps the array kernels against sat_add and an exact
+ * 128-bit reference: every bitwidth from 2 to 64 for the long forms,
+ * and the four fixed types, for add, sub and multiply-accumulate. Run
+ * it after any change to sat_batch.c or sat_add, on an AVX2 machine:
+ *
+ *   gcc -O2 -c -Dmain=sat_main -Dconvert_arg=sat_convert_arg sat.c
+ *   gcc -O2 -o sat_batch_test sat_batch_test.c sat_batch.c sat.o -lpthread
+ *   ./sat_batch_test
+ *
+ * Operands mix the edges of the range with random values, every length
+ * up to a few vector widths is tried so the scalar tails run, and out
+ * aliases a on every other pass. Then sat --stream is run on text
+ * whose operands straddle its read buffer. Exits nonzero at the first
+ * mismatch.
+ */
+
+#define MAX_N 80
+#define ROUNDS 400
+
+typedef __int128 wide;
+
+int sat_stream(int argc, char *argv[]); // sat.c
+
+static long clamp(wide x, long min, long max)
+{
+    return x < min ? min : x > max ? max : (long)x;
+}
+
+/* Type: function operand
+ * ----------------------------------
+ * A value in [min, max]: an edge of the range (the bounds, zero, one
+ * off each) half the time, otherwise random bits sign-extended from
+ * the width.
+ */
+static long operand(uint64_t *seed, int bitwidth, long min, long max)
+{
+    uint64_t r = next_rand(seed);
+    switch (r % 8) {
+        case 0: return min;
+        case 1: return max;
+        case 2: return 0;
+        case 3: return r & 16 ? min + 1 : max - 1;
+        default: break;
+    }
+    int shift = 64 - bitwidth;
+    return (long)(r << shift) >> shift;
+}
+
+/* Type: function fail
+ * ----------------------------------
+ * Reports the first disagreement and exits.
+ */
+static void fail(const char *what, int bitwidth, size_t i, long a, long b, long acc, long got, long want)
+{
+    error(1, 0, "%s at width %d, element %zu: a %ld, b %ld, acc %ld gave %ld, expected %ld",
+          what, bitwidth, i, a, b, acc, got, want);
+}
+
+/* Type: function sweep_long
+ * ----------------------------------
+ * sat_add_long against sat_add, and sat_sub_long and sat_mac_long
+ * against the exact result clamped to the width.
+ */
+static void sweep_long(int bitwidth, uint64_t *seed)
+{
+    long a[MAX_N], b[MAX_N], out[MAX_N], acc[MAX_N], acc0[MAX_N], a0[MAX_N];
+    long max = (long)((1UL << (bitwidth - 1)) - 1), min = -max - 1;
+    for (int round = 0; round < ROUNDS; round++) {
+        size_t n = round % MAX_N;
+        for (size_t i = 0; i < n; i++) {
+            a[i] = a0[i] = operand(seed, bitwidth, min, max);
+            b[i] = operand(seed, bitwidth, min, max);
+            acc[i] = acc0[i] = operand(seed, bitwidth, min, max);
+        }
+        long *dst = round % 2 ? out : a; // Even rounds write over a; a0 keeps the operands
+        sat_add_long(a, b, dst, n, bitwidth);
+        for (size_t i = 0; i < n; i++) {
+            long want = sat_add(a0[i], b[i], bitwidth);
+            if (dst[i] != want) fail("sat_add_long", bitwidth, i, a0[i], b[i], 0, dst[i], want);
+        }
+        memcpy(a, a0, sizeof(long) * n);
+        sat_sub_long(a, b, dst, n, bitwidth);
+        for (size_t i = 0; i < n; i++) {
+            long want = clamp((wide)a0[i] - b[i], min, max);
+            if (dst[i] != want) fail("sat_sub_long", bitwidth, i, a0[i], b[i], 0, dst[i], want);
+        }
+        memcpy(a, a0, sizeof(long) * n);
+        sat_mac_long(acc, a, b, n, bitwidth);
+        for (size_t i = 0; i < n; i++) {
+            long want = clamp((wide)acc0[i] + (wide)a[i] * b[i], min, max);
+            if (acc[i] != want) fail("sat_mac_long", bitwidth, i, a[i], b[i], acc0[i], acc[i], want);
+        }
+    }
+}
+
+/* Type: macro SWEEP_FIXED
+ * ----------------------------------
+ * Generates the sweep for one fixed element type: add against sat_add
+ * at the type's width, sub and multiply-accumulate against the exact
+ * result clamped to the type.
+ */
+#define SWEEP_FIXED(T, name, bits) \
+static void sweep_##name(uint64_t *seed) \
+{ \
+    T a[MAX_N], b[MAX_N], out[MAX_N], acc[MAX_N], acc0[MAX_N], a0[MAX_N]; \
+    long max = (long)((1UL << (bits - 1)) - 1), min = -max - 1; \
+    for (int round = 0; round < ROUNDS; round++) { \
+        size_t n = round % MAX_N; \
+        for (size_t i = 0; i < n; i++) { \
+            a[i] = a0[i] = operand(seed, bits, min, max); \
+            b[i] = operand(seed, bits, min, max); \
+            acc[i] = acc0[i] = operand(seed, bits, min, max); \
+        } \
+        T *dst = round % 2 ? out : a; \
+        sat_add_##name(a, b, dst, n); \
+        for (size_t i = 0; i < n; i++) { \
+            long want = sat_add(a0[i], b[i], bits); \
+            if (dst[i] != want) fail("sat_add_" #name, bits, i, a0[i], b[i], 0, dst[i], want); \
+        } \
+        memcpy(a, a0, sizeof(T) * n); \
+        sat_sub_##name(a, b, dst, n); \
+        for (size_t i = 0; i < n; i++) { \
+            long want = clamp((wide)a0[i] - b[i], min, max); \
+            if (dst[i] != want) fail("sat_sub_" #name, bits, i, a0[i], b[i], 0, dst[i], want); \
+        } \
+        memcpy(a, a0, sizeof(T) * n); \
+        sat_mac_##name(acc, a, b, n); \
+        for (size_t i = 0; i < n; i++) { \
+            long want = clamp((wide)acc0[i] + (wide)a[i] * b[i], min, max); \
+            if (acc[i] != want) fail("sat_mac_" #name, bits, i, a[i], b[i], acc0[i], acc[i], want); \
+        } \
+    } \
+}
+
+SWEEP_FIXED(int8_t, i8, 8)
+SWEEP_FIXED(int16_t, i16, 16)
+SWEEP_FIXED(int32_t, i32, 32)
+SWEEP_FIXED(int64_t, i64, 64)
+
+/* Type: function stream_case
+ * ----------------------------------
+ * Runs sat --stream 32 on text in a child, with a temporary file as
+ * stdin and another as stdout, and checks it printed want.
+ */
+static void stream_case(const char *what, const char *text, size_t len, const char *want)
+{
+    char in_path[] = "/tmp/sat_streamXXXXXX", out_path[] = "/tmp/sat_streamXXXXXX";
+    int in_fd = mkstemp(in_path), out_fd = mkstemp(out_path);
+    if (in_fd < 0 || out_fd < 0) error(1, errno, "mkstemp failed");
+    unlink(in_path);
+    unlink(out_path);
+    if (write(in_fd, text, len) != (ssize_t)len) error(1, errno, "write failed");
+    lseek(in_fd, 0, SEEK_SET);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in_fd, STDIN_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+        exit(sat_stream(1, (char *[]){"32", NULL}));
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    char got[64] = "";
+    ssize_t nread = pread(out_fd, got, sizeof(got) - 1, 0);
+    if (nread >= 0) got[nread] = '\0';
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || strcmp(got, want) != 0)
+        error(1, 0, "sat --stream on %s printed '%s', expected '%s'", what, got, want);
+    close(in_fd);
+    close(out_fd);
+}
+
+/* Type: function stream_long_tokens
+ * ----------------------------------
+ * Operands longer than sat's look-ahead, one cut by the end of a read,
+ * and one longer than its whole buffer, all of which must parse like
+ * strtol.
+ */
+static void stream_long_tokens(void)
+{
+    size_t big = 3 << 20; // More than sat's 1 MiB input buffer
+    char *text = malloc(big + 256);
+    assert(text);
+    int len = sprintf(text, "%0101d 2\n", 5); // 100 leading zeros
+    stream_case("100 leading zeros", text, len, "7\n");
+    memset(text, ' ', big);
+    len = sprintf(text + (1 << 20) - 90, "%0100d -9", 1); // Straddles the first read
+    stream_case("a token cut by a read", text, (1 << 20) - 90 + len, "-8\n");
+    memset(text, '0', big);
+    sprintf(text + big - 1, "3 -0x%0200x", 10); // 3 MiB of octal zeros, then padded hex
+    stream_case("a token longer than the buffer", text, strlen(text), "-7\n");
+    free(text);
+}
+
+int main(void)
+{
+    uint64_t seed = 41;
+    for (int bitwidth = 2; bitwidth <= 64; bitwidth++) sweep_long(bitwidth, &seed);
+    sweep_i8(&seed);
+    sweep_i16(&seed);
+    sweep_i32(&seed);
+    sweep_i64(&seed);
+    stream_long_tokens();
+    printf("sat_batch: %s kernels match sat_add and the exact reference\n", sat_kernel_name());
+    return 0;
+}
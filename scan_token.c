@@ -1,6 +1,140 @@
+#define _GNU_SOURCE // strchrnul
 #include "samples/prototypes.h"
+#include "scan_token.h"
 #include <string.h>
 #include <stdbool.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAX_SIMD_DELIMS 4 // More than this and the bitmap loop wins
+
+/* Type: function is_delim
+ * ----------------------------------
+ * Returns whether byte ch is in the delimiter set.
+ */
+static inline bool is_delim(const delim_set *set, unsigned char ch)
+{
+    return (set->bits[ch >> 6] >> (ch & 63)) & 1;
+}
+
+/* Type: function delim_set_init
+ * ----------------------------------
+ * Builds the 256-bit membership set for the delimiter string once, so
+ * tokenizing never rescans delimiters per character. The null
+ * character is never a delimiter.
+ */
+void delim_set_init(delim_set *set, const char *delimiters)
+{
+    memset(set->bits, 0, sizeof(set->bits));
+    set->count = 0;
+    for (const unsigned char *d = (const unsigned char *)delimiters; *d != '\0'; d++) {
+        if (!is_delim(set, *d)) set->count++;
+        set->bits[*d >> 6] |= 1ULL << (*d & 63);
+    }
+    set->single = set->count == 1 ? (unsigned char)delimiters[0] : 0;
+}
+
+/* Type: function next_token
+ * ----------------------------------
+ * Zero-copy counterpart to scan_token. Skips leading delimiters in
+ * *p_input, stores a view of the token that follows in *token, and
+ * advances *p_input past it. Returns false when no token remains.
+ */
+bool next_token(const char **p_input, const delim_set *set, token_view *token)
+{
+    const unsigned char *p = (const unsigned char *)*p_input;
+    while (*p != '\0' && is_delim(set, *p)) p++; // Handle leading delimiters
+    const unsigned char *start = p;
+    if (set->single != 0) { // One delimiter: let strchrnul's vectorized scan find it
+        p = (const unsigned char *)strchrnul((const char *)p, set->single);
+    } else {
+        while (*p != '\0' && !is_delim(set, *p)) p++;
+    }
+    *p_input = (const char *)p;
+    if (p == start) return false; // Input is empty
+    token->ptr = (const char *)start;
+    token->len = p - start;
+    return true;
+}
+
+/* Type: function tokenize_all_scalar
+ * ----------------------------------
+ * Bitmap-driven fallback for tokenize_all, used for large delimiter
+ * sets and on targets without SSE2.
+ */
+static size_t tokenize_all_scalar(const char *input, const delim_set *set, token_view *tokens, size_t max_tokens)
+{
+    size_t ntokens = 0;
+    token_view token;
+    while (next_token(&input, set, &token)) {
+        if (ntokens < max_tokens) tokens[ntokens] = token;
+        ntokens++;
+    }
+    return ntokens;
+}
+
+/* Type: function tokenize_all
+ * ----------------------------------
+ * Splits the whole null-terminated input into token views in one pass,
+ * storing up to max_tokens of them. Returns the total number of tokens
+ * in the input, which may exceed max_tokens, so callers can size the
+ * array and retry. With SSE2 and a small delimiter set the input is
+ * classified 16 bytes at a time into a bitmask of delimiter and null
+ * positions, and token edges are found with count-trailing-zeros.
+ * Loads are 16-byte aligned, so reading past the terminator never
+ * crosses into an unmapped page (hence the AddressSanitizer opt-out).
+ */
+__attribute__((no_sanitize_address))
+size_t tokenize_all(const char *input, const delim_set *set, token_view *tokens, size_t max_tokens)
+{
+#ifdef __SSE2__
+    if (set->count == 0 || set->count > MAX_SIMD_DELIMS) return tokenize_all_scalar(input, set, tokens, max_tokens);
+    __m128i delims[MAX_SIMD_DELIMS];
+    int ndelims = 0;
+    for (int ch = 1; ch < 256; ch++) {
+        if (is_delim(set, ch)) delims[ndelims++] = _mm_set1_epi8((char)ch);
+    }
+    const __m128i zero = _mm_setzero_si128();
+    size_t misalign = (uintptr_t)input & 15;
+    const char *block = input - misalign;
+    size_t ntokens = 0;
+    const char *token_start = NULL; // Non-NULL while inside a token
+    unsigned int skip = misalign; // Bytes before input in the first block
+    while (true) {
+        __m128i bytes = _mm_load_si128((const __m128i *)block);
+        unsigned int nul = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero)) >> skip << skip;
+        __m128i hits = _mm_setzero_si128();
+        for (int i = 0; i < ndelims; i++) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, delims[i]));
+        unsigned int stop = (_mm_movemask_epi8(hits) | nul) >> skip << skip; // Bit set where a token cannot continue
+        unsigned int live = ~stop & (0xFFFFu >> skip << skip);       // Bit set where a token byte sits
+        if (nul != 0) live &= (nul & -nul) - 1; // Bytes past the terminator are not input
+        while (true) {
+            if (token_start == NULL) {
+                if (live == 0) break;
+                int pos = __builtin_ctz(live);
+                token_start = block + pos;
+                stop &= ~0u << pos;
+            } else {
+                if (stop == 0) break;
+                int pos = __builtin_ctz(stop);
+                if (ntokens < max_tokens) {
+                    tokens[ntokens].ptr = token_start;
+                    tokens[ntokens].len = block + pos - token_start;
+                }
+                ntokens++;
+                token_start = NULL;
+                live &= ~0u << pos;
+            }
+        }
+        if (nul != 0) return ntokens; // Any open token was closed by the null bit
+        block += 16;
+        skip = 0;
+    }
+#else
+    return tokenize_all_scalar(input, set, tokens, max_tokens);
+#endif
+}
 
 /*
  * This tokenizing function takes a char ** to an input string separated by
@@ -8,23 +142,21 @@
  * char * buf of length size_t buflen. The function then returns true for a
  * successfully written token and false when no token is written. scan-token
  * has functionality to handle overflow cases when a valid token is larger than
- * buflen, splitting the token into validly sized portions.
+ * buflen, splitting the token into validly sized portions. Built on
+ * next_token, so the delimiters are scanned once per call rather than once
+ * per input character.
  */
 bool scan_token(const char **p_input, const char *delimiters, char *buf, size_t buflen)
 {
-    int len_delim = strspn(*p_input, delimiters); // Handle leading delimiters, returns 0 if none
-    *p_input += len_delim;
-    int len_token = strcspn(*p_input, delimiters); // Get length of token
-    if (len_token >= buflen - 1) { // Handling for overflow case
-    	strncpy(buf, *p_input, buflen - 1); // Copy by length of buffer with space for null terminator
-    	buf[buflen] = '\0';
-    	*p_input += buflen - 1;
-    	return true;
-    } else if (len_token != 0) {
-    	strncpy(buf, *p_input, len_token);
-    	buf[len_token] = '\0';
-    	*p_input += len_token;
-    	return true;
+    delim_set set;
+    delim_set_init(&set, delimiters);
+    token_view token;
+    if (!next_token(p_input, &set, &token)) return false; // p_input is empty
+    if (token.len >= buflen - 1) { // Handling for overflow case
+        token.len = buflen - 1; // Leave space for null terminator
+        *p_input = token.ptr + token.len; // Rest of the token comes back on the next call
     }
-    return false; // p_input is empty meaning len_token == 0
-}
\ No newline at end of file
+    memcpy(buf, token.ptr, token.len);
+    buf[token.len] = '\0';
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef SCAN_TOKEN_H
+#define SCAN_TOKEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Set of delimiter bytes, one bit per byte value, so membership is a
+// shift and a mask instead of a scan of the delimiter string.
+typedef struct {
+    uint64_t bits[4];
+    unsigned char single; // The delimiter when there is exactly one, else 0
+    int count;
+} delim_set;
+
+// A token inside the input string. Not null terminated.
+typedef struct {
+    const char *ptr;
+    size_t len;
+} token_view;
+
+void delim_set_init(delim_set *set, const char *delimiters);
+bool next_token(const char **p_input, const delim_set *set, token_view *token);
+size_t tokenize_all(const char *input, const delim_set *set, token_view *tokens, size_t max_tokens);
+
+#endif
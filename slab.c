@@ -0,0 +1,239 @@
+#include "allocator.h"
+#include "slab.h"
+#include <stdint.h>
+#include <string.h>
+
+#define SLAB_SHIFT 12
+#define SLAB_SIZE (1 << SLAB_SHIFT)
+#define ARENA_SLABS 32 // Slabs carved from each mymalloc'd arena; alignment costs at most one
+#define NCLASSES 8
+#define BITMAP_WORDS 8 // Enough for SLAB_SIZE / 8 slots
+#define PAGE_UNUSED 0
+#define PAGE_SLAB 1
+
+// Header at the start of every slab. Its address is the object's
+// address rounded down to SLAB_SIZE, so objects need no header of
+// their own. Set bits in bitmap mark free slots.
+typedef struct slab {
+    struct slab *next, *prev; // Class partial list, or the free slab list
+    unsigned int size;        // Object size of the class
+    unsigned int recip;       // ceil(2^32 / size): slot = offset * recip >> 32
+    unsigned short nslots, nfree;
+    int class_id;             // -1 while on the free slab list
+    uint64_t bitmap[BITMAP_WORDS];
+} slab;
+
+// Objects start past the header, keeping 16-byte alignment.
+#define SLAB_OBJECTS ((sizeof(slab) + 15) & ~(size_t)15)
+
+static const unsigned int class_size[NCLASSES] = {8, 16, 24, 32, 48, 64, 96, 128};
+// Size class for each request size in units of 8 bytes, rounded up.
+static const unsigned char class_of[SLAB_MAX_SIZE / 8 + 1] = {
+    0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7
+};
+
+static slab *partial[NCLASSES]; // Slabs with at least one free slot
+static slab *free_slabs;        // Empty slabs not owned by any class
+static unsigned char *page_map; // PAGE_SLAB for every slab page in the segment
+static uintptr_t first_page;
+static size_t npages;
+
+/* Type: function list_push
+ * ----------------------------------
+ * Pushes s on the front of a doubly linked slab list.
+ */
+static void list_push(slab **list, slab *s)
+{
+    s->prev = NULL;
+    s->next = *list;
+    if (*list != NULL) (*list)->prev = s;
+    *list = s;
+}
+
+static void list_remove(slab **list, slab *s)
+{
+    if (s->prev != NULL) s->prev->next = s->next;
+    else *list = s->next;
+    if (s->next != NULL) s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+/* Type: function slab_of
+ * ----------------------------------
+ * Returns the slab holding ptr, or NULL if ptr came from mymalloc.
+ * Slab pages lie wholly inside arena blocks, so no other block can
+ * share a page with one and the page map answers exactly.
+ */
+static slab *slab_of(const void *ptr)
+{
+    size_t page = ((uintptr_t)ptr >> SLAB_SHIFT) - first_page;
+    if (page >= npages || page_map[page] != PAGE_SLAB) return NULL;
+    return (slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+/* Type: function add_arena
+ * ----------------------------------
+ * Gets ARENA_SLABS aligned slabs from mymalloc in one block, marks
+ * them in the page map and puts them on the free slab list. At most
+ * one slab's worth of the block is lost to alignment. Arenas are never
+ * handed back, but their slabs move freely between size classes.
+ */
+static bool add_arena(void)
+{
+    char *block = mymalloc(ARENA_SLABS * SLAB_SIZE + SLAB_SIZE - 8); // mymalloc aligns to 8
+    if (block == NULL) return false;
+    uintptr_t start = ((uintptr_t)block + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE - 1);
+    for (int i = ARENA_SLABS; i-- > 0; ) {
+        slab *s = (slab *)(start + (uintptr_t)i * SLAB_SIZE);
+        page_map[((uintptr_t)s >> SLAB_SHIFT) - first_page] = PAGE_SLAB;
+        s->class_id = -1;
+        list_push(&free_slabs, s);
+    }
+    return true;
+}
+
+/* Type: function slab_new
+ * ----------------------------------
+ * Takes an empty slab, formats it for class c with every slot free
+ * and makes it the class's first partial slab.
+ */
+static slab *slab_new(int c)
+{
+    if (free_slabs == NULL && !add_arena()) return NULL;
+    slab *s = free_slabs;
+    list_remove(&free_slabs, s);
+    s->class_id = c;
+    s->size = class_size[c];
+    s->recip = (unsigned int)((((uint64_t)1 << 32) + s->size - 1) / s->size);
+    s->nslots = s->nfree = (SLAB_SIZE - SLAB_OBJECTS) / s->size;
+    memset(s->bitmap, 0, sizeof(s->bitmap));
+    for (int i = 0; i < s->nslots / 64; i++) s->bitmap[i] = ~(uint64_t)0;
+    if (s->nslots % 64 != 0) s->bitmap[s->nslots / 64] = ((uint64_t)1 << (s->nslots % 64)) - 1;
+    list_push(&partial[c], s);
+    return s;
+}
+
+/* Type: function slab_init
+ * ----------------------------------
+ * Forgets all slabs and allocates the page map for the segment that
+ * myinit was just given, one byte per page, from the heap itself.
+ */
+bool slab_init(void *segment_start, size_t segment_size)
+{
+    memset(partial, 0, sizeof(partial));
+    free_slabs = NULL;
+    first_page = (uintptr_t)segment_start >> SLAB_SHIFT;
+    npages = (((uintptr_t)segment_start + segment_size + SLAB_SIZE - 1) >> SLAB_SHIFT) - first_page;
+    page_map = mymalloc(npages);
+    if (page_map == NULL) {
+        npages = 0;
+        return false;
+    }
+    memset(page_map, PAGE_UNUSED, npages);
+    return true;
+}
+
+/* Type: function slab_malloc
+ * ----------------------------------
+ * Serves small requests from the first partial slab of their size
+ * class: the first set bitmap bit, found with ctz, is the slot. Falls
+ * back to mymalloc for large or zero-sized requests, and for small
+ * ones if no arena can be had.
+ */
+void *slab_malloc(size_t requestedsz)
+{
+    if (requestedsz == 0 || requestedsz > SLAB_MAX_SIZE || page_map == NULL) return mymalloc(requestedsz);
+    int c = class_of[(requestedsz + 7) >> 3];
+    slab *s = partial[c];
+    if (s == NULL && (s = slab_new(c)) == NULL) return mymalloc(requestedsz);
+    int w = 0;
+    while (s->bitmap[w] == 0) w++; // A partial slab always has a set bit
+    unsigned int slot = w * 64 + __builtin_ctzll(s->bitmap[w]);
+    s->bitmap[w] &= s->bitmap[w] - 1;
+    if (--s->nfree == 0) list_remove(&partial[c], s); // Full slabs sit on no list
+    return (char *)s + SLAB_OBJECTS + (size_t)slot * s->size;
+}
+
+/* Type: function slab_free
+ * ----------------------------------
+ * Returns a slot to its slab. A slab that was full rejoins its class's
+ * partial list; one that becomes empty goes back to the free slab list
+ * unless it is the only partial slab of its class, so a class that
+ * oscillates around one slab does not reformat it every time.
+ */
+void slab_free(void *ptr)
+{
+    if (ptr == NULL) return;
+    slab *s = slab_of(ptr);
+    if (s == NULL) {
+        myfree(ptr);
+        return;
+    }
+    size_t offset = (char *)ptr - ((char *)s + SLAB_OBJECTS);
+    unsigned int slot = (offset * s->recip) >> 32; // Exact for offset < SLAB_SIZE
+    s->bitmap[slot / 64] |= (uint64_t)1 << (slot % 64);
+    if (s->nfree++ == 0) {
+        list_push(&partial[s->class_id], s);
+    } else if (s->nfree == s->nslots && (s->prev != NULL || s->next != NULL)) {
+        list_remove(&partial[s->class_id], s);
+        s->class_id = -1;
+        list_push(&free_slabs, s);
+    }
+}
+
+/* Type: function slab_realloc
+ * ----------------------------------
+ * Resizes a block. A slab object that still fits its class is returned
+ * as is; otherwise it is moved. Blocks from mymalloc are left to
+ * myrealloc, since only the allocator knows their size.
+ */
+void *slab_realloc(void *oldptr, size_t newsz)
+{
+    if (oldptr == NULL) return slab_malloc(newsz);
+    if (newsz == 0) {
+        slab_free(oldptr);
+        return NULL;
+    }
+    slab *s = slab_of(oldptr);
+    if (s == NULL) return myrealloc(oldptr, newsz);
+    if (newsz <= s->size) return oldptr;
+    void *newptr = slab_malloc(newsz);
+    if (newptr == NULL) return NULL;
+    memcpy(newptr, oldptr, s->size);
+    slab_free(oldptr);
+    return newptr;
+}
+
+/* Type: function slab_validate
+ * ----------------------------------
+ * Checks every slab page: its free count against its bitmap, no bits
+ * set past its last slot, and that it is on its class's partial list
+ * exactly when it has free slots. Then validates the underlying heap.
+ */
+bool slab_validate(void)
+{
+    size_t listed = 0, nonfull = 0;
+    for (int c = 0; c < NCLASSES; c++) {
+        for (slab *s = partial[c]; s != NULL; s = s->next) {
+            if (s->class_id != c || s->nfree == 0 || (s->next != NULL && s->next->prev != s)) return false;
+            listed++;
+        }
+    }
+    for (size_t page = 0; page < npages; page++) {
+        if (page_map[page] != PAGE_SLAB) continue;
+        slab *s = (slab *)((first_page + page) << SLAB_SHIFT);
+        if (s->class_id < 0) continue; // On the free slab list
+        if (s->class_id >= NCLASSES || s->size != class_size[s->class_id]) return false;
+        int count = 0;
+        for (int w = 0; w < BITMAP_WORDS; w++) {
+            if (w * 64 + 64 > s->nslots) { // Bits past the last slot must stay clear
+                uint64_t valid = w * 64 >= s->nslots ? 0 : ((uint64_t)1 << (s->nslots - w * 64)) - 1;
+                if (s->bitmap[w] & ~valid) return false;
+            }
+            count += __builtin_popcountll(s->bitmap[w]);
+        }
+        if (count != s->nfree) return false;
+        if (s->nfree != 0) nonfull++;
+    }
+    return listed == nonfull && validate_heap();
+}
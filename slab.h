@@ -0,0 +1,19 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SLAB_MAX_SIZE 128 // Larger requests go straight to mymalloc
+
+// Slab layer in front of mymalloc/myfree/myrealloc for small objects.
+// Requests up to SLAB_MAX_SIZE bytes are served from 4 KiB slabs of one
+// size class each, with no per-object header or minimum block size.
+// slab_init must be called after every myinit, with the same segment.
+bool slab_init(void *segment_start, size_t segment_size);
+void *slab_malloc(size_t requestedsz);
+void slab_free(void *ptr);
+void *slab_realloc(void *oldptr, size_t newsz);
+bool slab_validate(void);
+
+#endif
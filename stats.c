@@ -0,0 +1,324 @@
+#define _GNU_SOURCE // program_invocation_short_name
+#include "stats.h"
+
+#ifdef ENABLE_STATS
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PHASES 16
+
+enum { EV_CYCLES, EV_INSTRUCTIONS, EV_CACHE_MISSES, EV_BRANCH_MISSES, EV_SYSCALLS, NEVENTS };
+
+static const char *const event_names[NEVENTS] = {
+    "cycles", "instructions", "cache misses", "branch misses", "syscalls"
+};
+
+// Time and work spent in one named phase, over all its visits.
+typedef struct {
+    const char *name;
+    uint64_t ns;
+    uint64_t cycles, instructions;
+} phase_rec;
+
+// Totals from /proc/self/io.
+typedef struct {
+    uint64_t rchar, wchar, syscr, syscw;
+} io_counts;
+
+bool stats_enabled;
+static int event_fd[NEVENTS];
+static bool user_only[NEVENTS]; // Fell back to excluding the kernel
+static int open_errno;
+static uint64_t start_ns;
+static io_counts start_io;
+static phase_rec phases[MAX_PHASES];
+static int nphases, current_phase = -1;
+static uint64_t phase_start_ns, phase_start_cycles, phase_start_instructions;
+static stats_counter *counters;
+static uint64_t nmalloc, ncalloc, nrealloc, nfree, alloc_bytes;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Type: function syscall_tracepoint
+ * ----------------------------------
+ * Returns the tracepoint id of raw_syscalls:sys_enter, or -1 if
+ * tracefs is not readable, in which case only read and write syscalls
+ * are counted.
+ */
+static long syscall_tracepoint(void)
+{
+    static const char *const paths[] = {
+        "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+    };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        FILE *fp = fopen(paths[i], "r");
+        if (fp == NULL) continue;
+        long id = -1;
+        if (fscanf(fp, "%ld", &id) != 1) id = -1;
+        fclose(fp);
+        if (id >= 0) return id;
+    }
+    return -1;
+}
+
+/* Type: function open_event
+ * ----------------------------------
+ * Opens one counter for this process and every thread it creates
+ * afterwards. Counters are opened one by one rather than as a group,
+ * because group reads are not supported on inherited counters.
+ * Kernel-side counting is tried first, then user space only for
+ * systems whose perf_event_paranoid forbids it.
+ */
+static int open_event(int ev, unsigned type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && type == PERF_TYPE_HARDWARE) {
+        attr.exclude_kernel = attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        user_only[ev] = fd >= 0;
+    }
+    if (fd < 0 && open_errno == 0) open_errno = errno;
+    return fd;
+}
+
+/* Type: function read_event
+ * ----------------------------------
+ * Current value of a counter, scaled up if the kernel had to multiplex
+ * it. Threads still running contribute only once they exit.
+ */
+static uint64_t read_event(int ev)
+{
+    uint64_t v[3]; // value, time enabled, time running
+    if (event_fd[ev] < 0 || read(event_fd[ev], v, sizeof(v)) != sizeof(v) || v[2] == 0) return 0;
+    return v[2] < v[1] ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+}
+
+static void read_io(io_counts *io)
+{
+    memset(io, 0, sizeof(*io));
+    FILE *fp = fopen("/proc/self/io", "r");
+    if (fp == NULL) return;
+    char key[32];
+    unsigned long long value;
+    while (fscanf(fp, "%31[^:]: %llu ", key, &value) == 2) {
+        if (strcmp(key, "rchar") == 0) io->rchar = value;
+        else if (strcmp(key, "wchar") == 0) io->wchar = value;
+        else if (strcmp(key, "syscr") == 0) io->syscr = value;
+        else if (strcmp(key, "syscw") == 0) io->syscw = value;
+    }
+    fclose(fp);
+}
+
+static double tv_ms(struct timeval tv)
+{
+    return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+/* Type: function report
+ * ----------------------------------
+ * atexit hook that prints the report. It is registered before any
+ * output writer, so it runs after their final flushes and counts them.
+ */
+static void report(void)
+{
+    fflush(stdout); // exit() flushes stdio only after the atexit hooks
+    stats_phase(NULL);
+    uint64_t wall = now_ns() - start_ns;
+    uint64_t counts[NEVENTS];
+    for (int ev = 0; ev < NEVENTS; ev++) counts[ev] = read_event(ev);
+    io_counts io;
+    read_io(&io);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    stats_enabled = false; // The report's own allocations are not counted
+
+    FILE *out = stderr;
+    fprintf(out, "--- %s stats ---\n", program_invocation_short_name);
+    fprintf(out, "wall           %.3f ms\n", wall / 1e6);
+    fprintf(out, "user           %.3f ms\n", tv_ms(usage.ru_utime));
+    fprintf(out, "sys            %.3f ms\n", tv_ms(usage.ru_stime));
+    fprintf(out, "max rss        %ld KiB\n", usage.ru_maxrss);
+    fprintf(out, "ctx switches   %ld voluntary, %ld involuntary\n", usage.ru_nvcsw, usage.ru_nivcsw);
+    for (int ev = 0; ev < NEVENTS; ev++) {
+        if (event_fd[ev] < 0) {
+            if (ev != EV_SYSCALLS) fprintf(out, "%-14s n/a (%s)\n", event_names[ev], strerror(open_errno));
+            continue;
+        }
+        fprintf(out, "%-14s %llu%s", event_names[ev], (unsigned long long)counts[ev], user_only[ev] ? " (user)" : "");
+        if (ev == EV_INSTRUCTIONS && counts[EV_CYCLES] != 0) {
+            fprintf(out, ", %.2f per cycle", (double)counts[ev] / counts[EV_CYCLES]);
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "read           %llu bytes in %llu syscalls\n",
+            (unsigned long long)(io.rchar - start_io.rchar), (unsigned long long)(io.syscr - start_io.syscr));
+    fprintf(out, "written        %llu bytes in %llu syscalls\n",
+            (unsigned long long)(io.wchar - start_io.wchar), (unsigned long long)(io.syscw - start_io.syscw));
+    fprintf(out, "allocations    %llu malloc, %llu calloc, %llu realloc, %llu free, %llu bytes requested\n",
+            (unsigned long long)nmalloc, (unsigned long long)ncalloc, (unsigned long long)nrealloc,
+            (unsigned long long)nfree, (unsigned long long)alloc_bytes);
+    for (int i = 0; i < nphases; i++) {
+        fprintf(out, "phase %-8s %.3f ms", phases[i].name, phases[i].ns / 1e6);
+        if (event_fd[EV_CYCLES] >= 0) {
+            fprintf(out, ", %llu cycles, %llu instructions",
+                    (unsigned long long)phases[i].cycles, (unsigned long long)phases[i].instructions);
+        }
+        fprintf(out, "\n");
+    }
+    for (stats_counter *c = counters; c != NULL; c = c->next) {
+        fprintf(out, "%s: %llu calls, mean %.2f, max %llu\n", c->name, (unsigned long long)c->calls,
+                c->calls ? (double)c->total / c->calls : 0.0, (unsigned long long)c->max);
+    }
+}
+
+/* Type: function stats_start
+ * ----------------------------------
+ * Opens the counters, takes the starting readings and arranges for the
+ * report at exit.
+ */
+static void stats_start(void)
+{
+    event_fd[EV_CYCLES] = open_event(EV_CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    event_fd[EV_INSTRUCTIONS] = open_event(EV_INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    event_fd[EV_CACHE_MISSES] = open_event(EV_CACHE_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    event_fd[EV_BRANCH_MISSES] = open_event(EV_BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    long id = syscall_tracepoint();
+    event_fd[EV_SYSCALLS] = id < 0 ? -1 : open_event(EV_SYSCALLS, PERF_TYPE_TRACEPOINT, id);
+    atexit(report);
+    read_io(&start_io);
+    start_ns = now_ns();
+    stats_enabled = true;
+}
+
+/* Type: function stats_init
+ * ----------------------------------
+ * Removes every --stats from argv (up to a "--"), shifting the rest
+ * down so the tool's own parsing never sees it, and starts collecting
+ * if one was found. Call first thing in main.
+ */
+void stats_init(int *argc, char *argv[])
+{
+    bool found = false;
+    for (int i = 1; i < *argc; ) {
+        if (strcmp(argv[i], "--") == 0) break;
+        if (strcmp(argv[i], "--stats") == 0) {
+            memmove(&argv[i], &argv[i + 1], sizeof(char *) * (*argc - i)); // Includes the NULL terminator
+            (*argc)--;
+            found = true;
+        } else {
+            i++;
+        }
+    }
+    if (found) stats_start();
+}
+
+/* Type: function stats_phase
+ * ----------------------------------
+ * Charges the time and counter deltas since the last switch to the
+ * current phase and makes name current. Phases are matched by name; a
+ * phase past MAX_PHASES is not recorded. Call from one thread only.
+ */
+void stats_phase(const char *name)
+{
+    if (!stats_enabled) return;
+    uint64_t now = now_ns(), cycles = read_event(EV_CYCLES), instructions = read_event(EV_INSTRUCTIONS);
+    if (current_phase >= 0) {
+        phases[current_phase].ns += now - phase_start_ns;
+        phases[current_phase].cycles += cycles - phase_start_cycles;
+        phases[current_phase].instructions += instructions - phase_start_instructions;
+    }
+    current_phase = -1;
+    if (name == NULL) return;
+    for (int i = 0; i < nphases; i++) {
+        if (strcmp(phases[i].name, name) == 0) current_phase = i;
+    }
+    if (current_phase < 0 && nphases < MAX_PHASES) {
+        phases[nphases] = (phase_rec){name, 0, 0, 0};
+        current_phase = nphases++;
+    }
+    phase_start_ns = now_ns();
+    phase_start_cycles = read_event(EV_CYCLES);
+    phase_start_instructions = read_event(EV_INSTRUCTIONS);
+}
+
+/* Type: function stats_record
+ * ----------------------------------
+ * Adds one value to a counter, linking it into the report the first
+ * time. Not thread safe; meant for single-threaded code such as the
+ * heap allocators.
+ */
+void stats_record(stats_counter *c, uint64_t value)
+{
+    if (!c->linked) {
+        c->linked = true;
+        c->next = counters;
+        counters = c;
+    }
+    c->calls++;
+    c->total += value;
+    if (value > c->max) c->max = value;
+}
+
+#ifdef __GLIBC__
+// Counting wrappers around glibc's allocator. Everything still goes to
+// the same heap, so memory from memalign and friends, which are not
+// wrapped, can be freed here as usual.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    if (stats_enabled) {
+        __atomic_fetch_add(&nmalloc, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (stats_enabled) {
+        __atomic_fetch_add(&ncalloc, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&alloc_bytes, nmemb * size, __ATOMIC_RELAXED);
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (stats_enabled) {
+        __atomic_fetch_add(&nrealloc, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (stats_enabled && ptr != NULL) __atomic_fetch_add(&nfree, 1, __ATOMIC_RELAXED);
+    __libc_free(ptr);
+}
+#endif
+#endif
@@ -0,0 +1,47 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Hot-path instrumentation behind a --stats flag. Built with
+// -DENABLE_STATS (and stats.o linked in), STATS_INIT takes --stats off
+// the command line and, if it was there, reports to stderr at exit:
+// wall/user/sys time, hardware counters from perf_event_open, bytes
+// and syscalls from /proc/self/io, allocation counts, and the phases
+// and counters below. Without ENABLE_STATS every macro here expands to
+// nothing, so the tools carry no cost and no link dependency.
+
+#ifdef ENABLE_STATS
+#include <stdbool.h>
+#include <stdint.h>
+
+// Running summary of values recorded at one site, such as how many
+// blocks a malloc call searched.
+typedef struct stats_counter {
+    const char *name;
+    uint64_t calls, total, max;
+    struct stats_counter *next; // Link in the report list once used
+    bool linked;
+} stats_counter;
+
+extern bool stats_enabled;
+
+void stats_init(int *argc, char *argv[]);
+void stats_phase(const char *name);
+void stats_record(stats_counter *c, uint64_t value);
+
+#define STATS_INIT(pargc, argv) stats_init(pargc, argv)
+// Ends the current phase and starts timing the named one; NULL just
+// ends it. Time in a phase accumulates across visits.
+#define STATS_PHASE(name) stats_phase(name)
+#define STATS_COUNTER(var, label) static stats_counter var = {label, 0, 0, 0, NULL, false}
+#define STATS_RECORD(var, value) do { if (stats_enabled) stats_record(&(var), (value)); } while (0)
+// Code that exists only to feed STATS_RECORD, such as a loop counter.
+#define STATS_ONLY(...) __VA_ARGS__
+#else
+#define STATS_INIT(pargc, argv) ((void)0)
+#define STATS_PHASE(name) ((void)0)
+#define STATS_COUNTER(var, label) extern int stats_unused_##var
+#define STATS_RECORD(var, value) ((void)0)
+#define STATS_ONLY(...)
+#endif
+
+#endif
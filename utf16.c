@@ -0,0 +1,312 @@
+#include "utf16.h"
+#include <pthread.h>
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UTF16_X86 1
+#include <immintrin.h>
+#endif
+
+#define ASCII_WORD_MASK 0xFF80FF80FF80FF80ULL // Bits that are zero in four ASCII units
+
+/* Type: function encode_range
+ * ----------------------------------
+ * Scalar conversion of src[*pi..stop) into dst at *pout, advancing
+ * both. Same bit layout as to_utf8, extended with the four-byte form
+ * for surrogate pairs. Runs of four ASCII units are checked and copied
+ * as one 8-byte word. A pair may read one unit past stop, but never
+ * past n. Returns a UTF16_ status; on error *pi is left on the
+ * offending unit.
+ */
+static int encode_range(const uint16_t *src, size_t n, size_t *pi, unsigned char *dst, size_t *pout, size_t stop)
+{
+    size_t i = *pi, out = *pout;
+    int status = UTF16_OK;
+    while (i < stop) {
+        uint64_t word;
+        if (i + 4 <= stop) {
+            memcpy(&word, src + i, 8); // memcpy avoids unaligned loads
+            if ((word & ASCII_WORD_MASK) == 0) {
+                for (int k = 0; k < 4; k++) dst[out + k] = src[i + k];
+                i += 4;
+                out += 4;
+                continue;
+            }
+        }
+        uint32_t cp = src[i];
+        if (cp <= 0x7f) {
+            dst[out++] = cp;
+            i++;
+        } else if (cp <= 0x7ff) {
+            dst[out++] = 0xC0 | cp >> 6;
+            dst[out++] = 0x80 | (cp & 0x3f);
+            i++;
+        } else if (cp < 0xD800 || cp > 0xDFFF) {
+            dst[out++] = 0xE0 | cp >> 12;
+            dst[out++] = 0x80 | ((cp >> 6) & 0x3f);
+            dst[out++] = 0x80 | (cp & 0x3f);
+            i++;
+        } else if (cp > 0xDBFF) {
+            status = UTF16_BAD_SURROGATE; // Low surrogate with no high surrogate before it
+            break;
+        } else if (i + 1 == n) {
+            status = UTF16_TRUNCATED;
+            break;
+        } else {
+            uint32_t low = src[i + 1];
+            if (low < 0xDC00 || low > 0xDFFF) {
+                status = UTF16_BAD_SURROGATE;
+                break;
+            }
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            dst[out++] = 0xF0 | cp >> 18;
+            dst[out++] = 0x80 | ((cp >> 12) & 0x3f);
+            dst[out++] = 0x80 | ((cp >> 6) & 0x3f);
+            dst[out++] = 0x80 | (cp & 0x3f);
+            i += 2;
+        }
+    }
+    *pi = i;
+    *pout = out;
+    return status;
+}
+
+/* Type: function utf16_to_utf8_scalar
+ * ----------------------------------
+ * Portable conversion of n UTF-16 units (host byte order) into dst,
+ * which must hold UTF8_MAX_FROM_UTF16(n) bytes. Always available, and
+ * the reference the vector kernels are checked against.
+ */
+utf16_result utf16_to_utf8_scalar(const uint16_t *src, size_t n, unsigned char *dst)
+{
+    utf16_result res = {0, 0, UTF16_OK};
+    res.status = encode_range(src, n, &res.nread, dst, &res.nwritten, n);
+    return res;
+}
+
+#ifdef UTF16_X86
+// Shuffles that squeeze eight 2-byte lanes down to the bytes actually
+// used, indexed by a bitmask of which lanes hold ASCII (one byte) units.
+static unsigned char pack_shuffle[256][16];
+static unsigned char pack_len[256];
+// Shuffles that spread eight lanes of three-byte sequences over 24
+// output bytes: lead/second bytes come from one register, the last
+// byte from another.
+static unsigned char spread_lead[24];
+static unsigned char spread_last[24];
+
+/* Type: function build_tables
+ * ----------------------------------
+ * Fills the shuffle tables used by the vector kernels. Runs once.
+ */
+static void build_tables(void)
+{
+    for (int mask = 0; mask < 256; mask++) {
+        int len = 0;
+        for (int lane = 0; lane < 8; lane++) {
+            pack_shuffle[mask][len++] = 2 * lane;
+            if (!(mask & (1 << lane))) pack_shuffle[mask][len++] = 2 * lane + 1;
+        }
+        pack_len[mask] = len;
+        for (int k = len; k < 16; k++) pack_shuffle[mask][k] = 0x80; // Zero fill past the end
+    }
+    for (int k = 0; k < 24; k++) {
+        int lane = k / 3, r = k % 3;
+        spread_lead[k] = r < 2 ? 2 * lane + r : 0x80;
+        spread_last[k] = r == 2 ? 2 * lane : 0x80;
+    }
+}
+
+/* Type: function encode_block8
+ * ----------------------------------
+ * Encodes eight units held in one register when they are all one or
+ * two bytes long, or all three bytes long. Stores whole registers, so
+ * up to 24 bytes at d may be written. Returns the number of output
+ * bytes, or -1 if the block mixes lengths or holds surrogates and must
+ * go through encode_range.
+ */
+__attribute__((target("ssse3")))
+static inline int encode_block8(__m128i u, unsigned char *d)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low6 = _mm_set1_epi16(0x3f);
+    const __m128i cont = _mm_set1_epi16(0x80);
+    __m128i top = _mm_and_si128(u, _mm_set1_epi16((short)0xF800));
+    __m128i small = _mm_cmpeq_epi16(top, zero); // Lanes below U+0800
+    int small_bits = _mm_movemask_epi8(small);
+    if (small_bits == 0xFFFF) {
+        __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(u, _mm_set1_epi16((short)0xFF80)), zero);
+        __m128i lead = _mm_or_si128(_mm_srli_epi16(u, 6), _mm_set1_epi16(0xC0));
+        __m128i trail = _mm_or_si128(_mm_and_si128(u, low6), cont);
+        __m128i two = _mm_or_si128(lead, _mm_slli_epi16(trail, 8));
+        __m128i enc = _mm_or_si128(_mm_and_si128(ascii, u), _mm_andnot_si128(ascii, two));
+        int mask = _mm_movemask_epi8(_mm_packs_epi16(ascii, zero)) & 0xFF;
+        __m128i shuf = _mm_loadu_si128((const __m128i *)pack_shuffle[mask]);
+        _mm_storeu_si128((__m128i *)d, _mm_shuffle_epi8(enc, shuf));
+        return pack_len[mask];
+    }
+    __m128i surrogate = _mm_cmpeq_epi16(top, _mm_set1_epi16((short)0xD800));
+    if (small_bits != 0 || _mm_movemask_epi8(surrogate) != 0) return -1;
+    __m128i first = _mm_or_si128(_mm_srli_epi16(u, 12), _mm_set1_epi16(0xE0));
+    __m128i second = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(u, 6), low6), cont);
+    __m128i lead = _mm_or_si128(first, _mm_slli_epi16(second, 8));
+    __m128i last = _mm_or_si128(_mm_and_si128(u, low6), cont);
+    __m128i out0 = _mm_or_si128(_mm_shuffle_epi8(lead, _mm_loadu_si128((const __m128i *)spread_lead)),
+                                _mm_shuffle_epi8(last, _mm_loadu_si128((const __m128i *)spread_last)));
+    __m128i out1 = _mm_or_si128(_mm_shuffle_epi8(lead, _mm_loadl_epi64((const __m128i *)(spread_lead + 16))),
+                                _mm_shuffle_epi8(last, _mm_loadl_epi64((const __m128i *)(spread_last + 16))));
+    _mm_storeu_si128((__m128i *)d, out0);
+    _mm_storel_epi64((__m128i *)(d + 16), out1);
+    return 24;
+}
+
+/* Type: function utf16_to_utf8_ssse3
+ * ----------------------------------
+ * SSSE3 kernel. Sixteen ASCII units are checked with one mask test and
+ * narrowed with a saturating pack; otherwise blocks of eight go
+ * through encode_block8, and blocks it declines are handed to the
+ * scalar path.
+ */
+__attribute__((target("ssse3")))
+static utf16_result utf16_to_utf8_ssse3(const uint16_t *src, size_t n, unsigned char *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i non_ascii = _mm_set1_epi16((short)0xFF80);
+    size_t i = 0, out = 0;
+    int status = UTF16_OK;
+    while (i + 16 <= n) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 8));
+        __m128i high = _mm_and_si128(_mm_or_si128(a, b), non_ascii);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i *)(dst + out), _mm_packus_epi16(a, b));
+            i += 16;
+            out += 16;
+            continue;
+        }
+        int len = encode_block8(a, dst + out);
+        if (len >= 0) {
+            i += 8;
+            out += len;
+        } else {
+            status = encode_range(src, n, &i, dst, &out, i + 8);
+            if (status != UTF16_OK) break;
+        }
+    }
+    if (status == UTF16_OK) status = encode_range(src, n, &i, dst, &out, n);
+    return (utf16_result){i, out, status};
+}
+
+/* Type: function utf16_to_utf8_avx2
+ * ----------------------------------
+ * AVX2 kernel. Thirty-two ASCII units are narrowed per step. Sixteen
+ * units of one- and two-byte characters are encoded across both
+ * 128-bit lanes at once, each lane compacted with its own shuffle from
+ * pack_shuffle and stored back to back. Anything else falls back to
+ * encode_block8 and then to the scalar path.
+ */
+__attribute__((target("avx2")))
+static utf16_result utf16_to_utf8_avx2(const uint16_t *src, size_t n, unsigned char *dst)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i non_ascii = _mm256_set1_epi16((short)0xFF80);
+    size_t i = 0, out = 0;
+    int status = UTF16_OK;
+    while (i + 32 <= n) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 16));
+        if (_mm256_testz_si256(_mm256_or_si256(a, b), non_ascii)) {
+            __m256i packed = _mm256_packus_epi16(a, b); // Lanes come out as a0 b0 a1 b1
+            _mm256_storeu_si256((__m256i *)(dst + out), _mm256_permute4x64_epi64(packed, 0xD8));
+            i += 32;
+            out += 32;
+            continue;
+        }
+        __m256i top = _mm256_and_si256(a, _mm256_set1_epi16((short)0xF800));
+        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(top, zero)) == 0xFFFFFFFFu) {
+            __m256i ascii = _mm256_cmpeq_epi16(_mm256_and_si256(a, non_ascii), zero);
+            __m256i lead = _mm256_or_si256(_mm256_srli_epi16(a, 6), _mm256_set1_epi16(0xC0));
+            __m256i trail = _mm256_or_si256(_mm256_and_si256(a, _mm256_set1_epi16(0x3f)), _mm256_set1_epi16(0x80));
+            __m256i two = _mm256_or_si256(lead, _mm256_slli_epi16(trail, 8));
+            __m256i enc = _mm256_blendv_epi8(two, a, ascii);
+            unsigned mask = _mm256_movemask_epi8(_mm256_packs_epi16(ascii, zero)); // Bits 0-7 and 16-23
+            unsigned lo = mask & 0xFF, hi = (mask >> 16) & 0xFF;
+            __m256i shuf = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)pack_shuffle[lo])),
+                _mm_loadu_si128((const __m128i *)pack_shuffle[hi]), 1);
+            __m256i packed = _mm256_shuffle_epi8(enc, shuf);
+            _mm_storeu_si128((__m128i *)(dst + out), _mm256_castsi256_si128(packed));
+            out += pack_len[lo];
+            _mm_storeu_si128((__m128i *)(dst + out), _mm256_extracti128_si256(packed, 1));
+            out += pack_len[hi];
+            i += 16;
+            continue;
+        }
+        int len = encode_block8(_mm256_castsi256_si128(a), dst + out);
+        if (len >= 0) {
+            i += 8;
+            out += len;
+        } else {
+            _mm256_zeroupper(); // encode_range is legacy SSE; a dirty upper state stalls it
+            status = encode_range(src, n, &i, dst, &out, i + 8);
+            if (status != UTF16_OK) break;
+        }
+    }
+    if (status == UTF16_OK) {
+        _mm256_zeroupper();
+        utf16_result rest = utf16_to_utf8_ssse3(src + i, n - i, dst + out);
+        return (utf16_result){i + rest.nread, out + rest.nwritten, rest.status};
+    }
+    return (utf16_result){i, out, status};
+}
+#endif
+
+typedef utf16_result (*utf16_kernel)(const uint16_t *, size_t, unsigned char *);
+
+static utf16_kernel active_kernel = utf16_to_utf8_scalar;
+static const char *active_name = "scalar";
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/* Type: function select_kernel
+ * ----------------------------------
+ * Picks the widest kernel the running CPU supports. Called once
+ * through pthread_once, so concurrent first calls are safe.
+ */
+static void select_kernel(void)
+{
+#ifdef UTF16_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        build_tables();
+        active_kernel = utf16_to_utf8_ssse3;
+        active_name = "ssse3";
+        if (__builtin_cpu_supports("avx2")) {
+            active_kernel = utf16_to_utf8_avx2;
+            active_name = "avx2";
+        }
+    }
+#endif
+}
+
+/* Type: function utf16_to_utf8
+ * ----------------------------------
+ * Converts n UTF-16 units (host byte order) into UTF-8 in dst, which
+ * must hold UTF8_MAX_FROM_UTF16(n) bytes. Surrogate pairs become
+ * four-byte sequences, so the whole range up to U+10FFFF is covered,
+ * and unpaired surrogates are reported rather than encoded. Uses the
+ * AVX2 or SSSE3 kernel when the CPU has it.
+ */
+utf16_result utf16_to_utf8(const uint16_t *src, size_t n, unsigned char *dst)
+{
+    pthread_once(&kernel_once, select_kernel);
+    return active_kernel(src, n, dst);
+}
+
+/* Type: function utf16_kernel_name
+ * ----------------------------------
+ * Name of the kernel utf16_to_utf8 dispatches to, for benchmark reports.
+ */
+const char *utf16_kernel_name(void)
+{
+    pthread_once(&kernel_once, select_kernel);
+    return active_name;
+}
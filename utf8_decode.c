@@ -0,0 +1,348 @@
+#include "utf8_decode.h"
+#include <pthread.h>
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+#define HIGH_BITS 0x8080808080808080ULL // Bits that are zero in eight ASCII bytes
+
+/* Type: function validate_range
+ * ----------------------------------
+ * Scalar check of s[i..len) as UTF-8, eight ASCII bytes per step where
+ * possible. Each lead byte fixes the sequence length and the allowed
+ * range of the byte after it, which is how overlongs (E0 80..9F,
+ * F0 80..8F), surrogates (ED A0..BF) and values above U+10FFFF
+ * (F4 90..BF) are rejected. Returns the offset of the first bad
+ * sequence, or len, with the outcome in *status.
+ */
+static size_t validate_range(const unsigned char *s, size_t len, size_t i, int *status)
+{
+    while (i < len) {
+        uint64_t word;
+        if (i + 8 <= len) {
+            memcpy(&word, s + i, 8); // memcpy avoids unaligned loads
+            if ((word & HIGH_BITS) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+        size_t need; // Continuation bytes that must follow
+        unsigned char low = 0x80, high = 0xBF; // Allowed range of the second byte
+        if (c < 0xC2) { // Stray continuation, or C0/C1 which only start overlongs
+            *status = UTF8_INVALID;
+            return i;
+        } else if (c < 0xE0) {
+            need = 1;
+        } else if (c < 0xF0) {
+            need = 2;
+            if (c == 0xE0) low = 0xA0;
+            else if (c == 0xED) high = 0x9F;
+        } else if (c < 0xF5) {
+            need = 3;
+            if (c == 0xF0) low = 0x90;
+            else if (c == 0xF4) high = 0x8F;
+        } else {
+            *status = UTF8_INVALID;
+            return i;
+        }
+        for (size_t k = 1; k <= need; k++) {
+            if (i + k == len) {
+                *status = UTF8_TRUNCATED;
+                return i;
+            }
+            unsigned char b = s[i + k];
+            if (k == 1 ? (b < low || b > high) : (b & 0xC0) != 0x80) {
+                *status = UTF8_INVALID;
+                return i;
+            }
+        }
+        i += need + 1;
+    }
+    *status = UTF8_OK;
+    return len;
+}
+
+/* Type: function sequence_start
+ * ----------------------------------
+ * Backs up from offset i to the lead byte of a sequence that may be
+ * unfinished at i, looking at most three bytes back. Used where a
+ * vector pass hands over to validate_range, so the scalar check starts
+ * on a character boundary.
+ */
+static size_t sequence_start(const unsigned char *s, size_t i)
+{
+    for (size_t k = 1; k <= 3 && k <= i; k++) {
+        if (s[i - k] >= 0xC0) return i - k;
+        if (s[i - k] < 0x80) break;
+    }
+    return i;
+}
+
+/* Type: function decode_range
+ * ----------------------------------
+ * Decodes already validated UTF-8 from s[*pi] until the offset reaches
+ * stop, storing code points at dst[*pout] and advancing both. A
+ * sequence may end past stop; validation guarantees it is complete.
+ */
+static void decode_range(const unsigned char *s, size_t *pi, size_t stop, uint32_t *dst, size_t *pout)
+{
+    size_t i = *pi, out = *pout;
+    while (i < stop) {
+        uint64_t word;
+        if (i + 8 <= stop) {
+            memcpy(&word, s + i, 8);
+            if ((word & HIGH_BITS) == 0) {
+                for (int k = 0; k < 8; k++) dst[out + k] = s[i + k];
+                i += 8;
+                out += 8;
+                continue;
+            }
+        }
+        uint32_t c = s[i];
+        if (c < 0x80) {
+            dst[out++] = c;
+            i += 1;
+        } else if (c < 0xE0) {
+            dst[out++] = (c & 0x1f) << 6 | (s[i + 1] & 0x3f);
+            i += 2;
+        } else if (c < 0xF0) {
+            dst[out++] = (c & 0x0f) << 12 | (s[i + 1] & 0x3f) << 6 | (s[i + 2] & 0x3f);
+            i += 3;
+        } else {
+            dst[out++] = (c & 0x07) << 18 | (s[i + 1] & 0x3f) << 12 | (s[i + 2] & 0x3f) << 6 | (s[i + 3] & 0x3f);
+            i += 4;
+        }
+    }
+    *pi = i;
+    *pout = out;
+}
+
+/* Type: function utf8_validate_scalar
+ * ----------------------------------
+ * Portable validator. Returns the length of the longest valid prefix,
+ * which is the offset of the first error, and stores a UTF8_ status in
+ * *status. The reference the vector kernel is checked against, by
+ * utf8_decode_test.c.
+ */
+size_t utf8_validate_scalar(const unsigned char *s, size_t len, int *status)
+{
+    return validate_range(s, len, 0, status);
+}
+
+/* Type: function decode_valid_scalar
+ * ----------------------------------
+ * Decodes len bytes of validated UTF-8 into dst and returns the number
+ * of code points.
+ */
+static size_t decode_valid_scalar(const unsigned char *s, size_t len, uint32_t *dst)
+{
+    size_t i = 0, out = 0;
+    decode_range(s, &i, len, dst, &out);
+    return out;
+}
+
+#ifdef UTF8_X86
+// Error bits of the lookup-table validator. Each table maps a nibble to
+// the set of errors it is compatible with; a pair of adjacent bytes is
+// wrong when all three lookups agree on some error.
+#define TOO_SHORT  (1 << 0) // Lead byte followed by a lead or ASCII byte
+#define TOO_LONG   (1 << 1) // ASCII byte followed by a continuation
+#define OVERLONG_3 (1 << 2) // E0 80..9F
+#define TOO_LARGE  (1 << 3) // F4 90..BF, or F5 and above
+#define SURROGATE  (1 << 4) // ED A0..BF
+#define OVERLONG_2 (1 << 5) // C0 or C1 lead
+#define TOO_LARGE_1000 (1 << 6) // F5 and above followed by 80..8F
+#define OVERLONG_4 (1 << 6) // F0 80..8F
+#define TWO_CONTS  (1 << 7) // Continuation after continuation; fine only as third or fourth byte
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS) // Errors that do not depend on the low nibble
+
+/* Type: macro prev_bytes
+ * ----------------------------------
+ * Shifts the 32-byte block in right by n bytes, filling from the end
+ * of the previous block, so lane k holds the byte n positions before
+ * byte k of the input.
+ */
+#define prev_bytes(in, prev, n) \
+    _mm256_alignr_epi8((in), _mm256_permute2x128_si256((prev), (in), 0x21), 16 - (n))
+
+/* Type: function block_errors
+ * ----------------------------------
+ * Classifies every byte of a 32-byte block against the byte before it
+ * with three 16-entry nibble lookups (high and low nibble of the
+ * previous byte, high nibble of the current one), then checks that
+ * doubled continuations sit exactly where a three- or four-byte lead
+ * two or three bytes back requires them. Nonzero lanes mark errors.
+ */
+__attribute__((target("avx2")))
+static inline __m256i block_errors(__m256i in, __m256i prev)
+{
+    const __m256i byte_1_high = _mm256_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m256i byte_1_low = _mm256_setr_epi8(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+        CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+        CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m256i byte_2_high = _mm256_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i prev1 = prev_bytes(in, prev, 1);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                         _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+    __m256i third = _mm256_subs_epu8(prev_bytes(in, prev, 2), _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(prev_bytes(in, prev, 3), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must_continue, special);
+}
+
+/* Type: function utf8_validate_avx2
+ * ----------------------------------
+ * AVX2 validator. ASCII blocks only need a sign-bit test. Other blocks
+ * go through block_errors with the previous block supplying the bytes
+ * before lane 0. At the first block with an error, and for the tail
+ * shorter than a block, validate_range takes over from the nearest
+ * character boundary so the exact offset and status are reported.
+ */
+__attribute__((target("avx2")))
+static size_t utf8_validate_avx2(const unsigned char *s, size_t len, int *status)
+{
+    __m256i prev = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(s + i));
+        if (_mm256_movemask_epi8(in) != 0 || _mm256_movemask_epi8(prev) != 0) {
+            __m256i err = block_errors(in, prev);
+            if (!_mm256_testz_si256(err, err)) break;
+        }
+        prev = in;
+    }
+    return validate_range(s, len, sequence_start(s, i), status);
+}
+
+/* Type: function decode_valid_avx2
+ * ----------------------------------
+ * Decodes validated UTF-8, widening 32 ASCII bytes at a time to code
+ * points with zero extension. Blocks with multi-byte characters are
+ * decoded by decode_range.
+ */
+__attribute__((target("avx2")))
+static size_t decode_valid_avx2(const unsigned char *s, size_t len, uint32_t *dst)
+{
+    size_t i = 0, out = 0;
+    while (i + 32 <= len) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(s + i));
+        if (_mm256_movemask_epi8(in) == 0) {
+            for (int k = 0; k < 4; k++) {
+                __m128i bytes = _mm_loadl_epi64((const __m128i *)(s + i + 8 * k));
+                _mm256_storeu_si256((__m256i *)(dst + out + 8 * k), _mm256_cvtepu8_epi32(bytes));
+            }
+            i += 32;
+            out += 32;
+        } else {
+            decode_range(s, &i, i + 32, dst, &out);
+        }
+    }
+    decode_range(s, &i, len, dst, &out);
+    return out;
+}
+#endif
+
+static size_t (*active_validate)(const unsigned char *, size_t, int *) = utf8_validate_scalar;
+static size_t (*active_decode)(const unsigned char *, size_t, uint32_t *) = decode_valid_scalar;
+static const char *active_name = "scalar";
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/* Type: function select_kernel
+ * ----------------------------------
+ * Switches to the AVX2 kernels when the running CPU has them. Called
+ * once through pthread_once.
+ */
+static void select_kernel(void)
+{
+#ifdef UTF8_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        active_validate = utf8_validate_avx2;
+        active_decode = decode_valid_avx2;
+        active_name = "avx2";
+    }
+#endif
+}
+
+/* Type: function utf8_validate
+ * ----------------------------------
+ * Checks that s[0..len) is well-formed UTF-8: no stray continuation
+ * bytes, overlong forms, surrogates (U+D800..DFFF), values above
+ * U+10FFFF or sequences cut short. Returns the offset of the first
+ * error, or len, and stores a UTF8_ status in *status. A sequence cut
+ * by the end of the buffer is UTF8_TRUNCATED, so a streaming caller
+ * can carry the last few bytes into its next buffer.
+ */
+size_t utf8_validate(const unsigned char *s, size_t len, int *status)
+{
+    pthread_once(&kernel_once, select_kernel);
+    return active_validate(s, len, status);
+}
+
+/* Type: function utf8_decode
+ * ----------------------------------
+ * Validates s[0..len) and decodes its longest valid prefix into code
+ * points in dst, which must have room for len of them. The result
+ * gives the bytes consumed (the error offset, if any), the code points
+ * written and the validation status.
+ */
+utf8_result utf8_decode(const unsigned char *s, size_t len, uint32_t *dst)
+{
+    utf8_result res;
+    pthread_once(&kernel_once, select_kernel);
+    res.nread = active_validate(s, len, &res.status);
+    res.nwritten = active_decode(s, res.nread, dst);
+    return res;
+}
+
+/* Type: function utf8_kernel_name
+ * ----------------------------------
+ * Name of the kernel in use, for benchmark reports.
+ */
+const char *utf8_kernel_name(void)
+{
+    pthread_once(&kernel_once, select_kernel);
+    return active_name;
+}
@@ -0,0 +1,27 @@
+#ifndef UTF8_DECODE_H
+#define UTF8_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    UTF8_OK,        // Whole input is well formed
+    UTF8_INVALID,   // Bad lead or continuation byte, overlong form, surrogate or value above U+10FFFF
+    UTF8_TRUNCATED  // Input ends partway through an otherwise valid sequence
+};
+
+// Outcome of a decode. nread is the offset of the first byte not
+// decoded, which on error is the start of the offending sequence;
+// nwritten is the number of code points stored before it.
+typedef struct {
+    size_t nread;
+    size_t nwritten;
+    int status;
+} utf8_result;
+
+size_t utf8_validate(const unsigned char *s, size_t len, int *status);
+size_t utf8_validate_scalar(const unsigned char *s, size_t len, int *status);
+utf8_result utf8_decode(const unsigned char *s, size_t len, uint32_t *dst);
+const char *utf8_kernel_name(void);
+
+#endif
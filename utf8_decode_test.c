@@ -0,0 +1,190 @@
+#include "rand64.h"
+#include "utf8_decode.h"
+#include <error.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * utf8_decode_test checks the validator and decoder the dispatcher
+ * picks (AVX2 where the CPU has it) against the scalar validator and
+ * against an independent byte-at-a-time decoder written here. Run it
+ * after any change to utf8_decode.c, on an AVX2 machine:
+ *
+ *   gcc -O2 -o utf8_decode_test utf8_decode_test.c utf8_decode.c -lpthread
+ *   ./utf8_decode_test [iterations]
+ *
+ * It fuzzes mutated mixed-script buffers of every length around the
+ * 32-byte block size, then places every three-byte combination across
+ * a block seam. Exits nonzero at the first disagreement.
+ */
+
+#define MAX_LEN 300
+#define BLOCK 32
+
+/* Type: function ref_decode
+ * ----------------------------------
+ * Reference decoder, straight from the UTF-8 definition: checks each
+ * sequence's lead, length and second-byte range, decodes it into dst
+ * and stops at the first error, which is reported at the start of the
+ * offending sequence.
+ */
+static utf8_result ref_decode(const unsigned char *s, size_t len, uint32_t *dst)
+{
+    utf8_result res = {0, 0, UTF8_OK};
+    while (res.nread < len) {
+        const unsigned char *p = s + res.nread;
+        size_t need, left = len - res.nread;
+        unsigned char lo = 0x80, hi = 0xBF; // Range of the second byte
+        uint32_t cp;
+        if (p[0] < 0x80) {
+            need = 1;
+            cp = p[0];
+        } else if (p[0] >= 0xC2 && p[0] <= 0xDF) {
+            need = 2;
+            cp = p[0] & 0x1F;
+        } else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+            need = 3;
+            cp = p[0] & 0x0F;
+            if (p[0] == 0xE0) lo = 0xA0;
+            if (p[0] == 0xED) hi = 0x9F;
+        } else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+            need = 4;
+            cp = p[0] & 0x07;
+            if (p[0] == 0xF0) lo = 0x90;
+            if (p[0] == 0xF4) hi = 0x8F;
+        } else {
+            res.status = UTF8_INVALID;
+            return res;
+        }
+        for (size_t k = 1; k < need; k++) {
+            if (k == left) {
+                res.status = UTF8_TRUNCATED;
+                return res;
+            }
+            bool ok = k == 1 ? p[k] >= lo && p[k] <= hi : p[k] >= 0x80 && p[k] <= 0xBF;
+            if (!ok) {
+                res.status = UTF8_INVALID;
+                return res;
+            }
+            cp = cp << 6 | (p[k] & 0x3F);
+        }
+        dst[res.nwritten++] = cp;
+        res.nread += need;
+    }
+    return res;
+}
+
+/* Type: function check
+ * ----------------------------------
+ * Runs all three implementations on one buffer and exits with the
+ * buffer in hex if any two disagree.
+ */
+static void check(const unsigned char *s, size_t len)
+{
+    static uint32_t got[MAX_LEN], want[MAX_LEN];
+    int scalar_status, fast_status;
+    size_t scalar = utf8_validate_scalar(s, len, &scalar_status);
+    size_t fast = utf8_validate(s, len, &fast_status);
+    utf8_result ref = ref_decode(s, len, want);
+    utf8_result dec = utf8_decode(s, len, got);
+    bool same = scalar == ref.nread && scalar_status == ref.status
+        && fast == ref.nread && fast_status == ref.status
+        && dec.nread == ref.nread && dec.status == ref.status && dec.nwritten == ref.nwritten
+        && memcmp(got, want, ref.nwritten * sizeof(uint32_t)) == 0;
+    if (same) return;
+    for (size_t i = 0; i < len; i++) fprintf(stderr, "%02x%s", s[i], i + 1 < len ? " " : "\n");
+    error(1, 0, "mismatch on %zu bytes: reference %zu/%d, scalar %zu/%d, %s %zu/%d, decode %zu/%d",
+          len, ref.nread, ref.status, scalar, scalar_status, utf8_kernel_name(), fast, fast_status, dec.nread, dec.status);
+}
+
+/* Type: function random_text
+ * ----------------------------------
+ * Fills s with len bytes of valid text mixing ASCII and two-, three-
+ * and four-byte characters, padding the end with ASCII.
+ */
+static void random_text(unsigned char *s, size_t len, uint64_t *seed)
+{
+    size_t i = 0;
+    while (i < len) {
+        uint64_t r = next_rand(seed);
+        uint32_t cp;
+        switch (r % 4) {
+            case 0: cp = (r >> 8) % 0x80; break;
+            case 1: cp = 0x80 + (r >> 8) % 0x780; break;
+            case 2: cp = 0x800 + (r >> 8) % 0xF800; break;
+            default: cp = 0x10000 + (r >> 8) % 0x100000; break;
+        }
+        if (cp >= 0xD800 && cp <= 0xDFFF) cp -= 0x800;
+        size_t need = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+        if (i + need > len) {
+            s[i++] = 'a';
+            continue;
+        }
+        if (need == 1) {
+            s[i] = cp;
+        } else {
+            for (size_t k = need - 1; k > 0; k--, cp >>= 6) s[i + k] = 0x80 | (cp & 0x3F);
+            s[i] = (0xF00 >> need) | cp;
+        }
+        i += need;
+    }
+}
+
+/* Type: function fuzz
+ * ----------------------------------
+ * Valid buffers of random length, each with a few bytes overwritten by
+ * random bytes or bytes near the edges of the valid ranges, and
+ * sometimes cut short.
+ */
+static void fuzz(long iterations)
+{
+    static const unsigned char edges[] = {
+        0x00, 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC1, 0xC2,
+        0xDF, 0xE0, 0xED, 0xEF, 0xF0, 0xF4, 0xF5, 0xFF
+    };
+    unsigned char s[MAX_LEN];
+    uint64_t seed = 40;
+    for (long iter = 0; iter < iterations; iter++) {
+        size_t len = next_rand(&seed) % MAX_LEN;
+        random_text(s, len, &seed);
+        int nmut = len == 0 ? 0 : next_rand(&seed) % 4;
+        for (int m = 0; m < nmut; m++) {
+            uint64_t r = next_rand(&seed);
+            s[r % len] = (r >> 32) % 2 ? (unsigned char)(r >> 40) : edges[(r >> 40) % sizeof(edges)];
+        }
+        check(s, len);
+        if (len > 0) check(s, len - 1 - next_rand(&seed) % (len < 4 ? len : 4));
+    }
+}
+
+/* Type: function seams
+ * ----------------------------------
+ * Every three-byte combination, in ASCII text, ending on each of the
+ * two bytes after a block boundary, so the kernel's carry from one
+ * block into the next is exercised for every pair and triple.
+ */
+static void seams(void)
+{
+    unsigned char s[2 * BLOCK + 8];
+    for (int end = BLOCK; end <= BLOCK + 1; end++) {
+        for (uint32_t v = 0; v < 1 << 24; v++) {
+            memset(s, 'a', sizeof(s));
+            s[end - 2] = v >> 16;
+            s[end - 1] = v >> 8;
+            s[end] = v;
+            check(s, sizeof(s));
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+    fuzz(iterations);
+    seams();
+    printf("utf8_decode: %s kernel matches scalar and reference\n", utf8_kernel_name());
+    return 0;
+}
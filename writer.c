@@ -0,0 +1,174 @@
+#include "writer.h"
+#include <assert.h>
+#include <errno.h>
+#include <error.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+static writer *open_writers;
+static bool exit_hook_set;
+
+/* Type: function write_fully
+ * ----------------------------------
+ * writev wrapper that retries after short writes and signals. Exits
+ * with an error if the descriptor refuses the data.
+ */
+static void write_fully(int fd, struct iovec *iov, int niov)
+{
+    while (niov > 0) {
+        ssize_t n = writev(fd, iov, niov);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            error(1, errno, "write error");
+        }
+        while (niov > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (niov > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/* Type: function flush_open_writers
+ * ----------------------------------
+ * atexit hook, so output buffered before an error() exit still
+ * appears, as it did with stdio.
+ */
+static void flush_open_writers(void)
+{
+    writer *w = open_writers;
+    open_writers = NULL; // A write error here must not recurse into the hook
+    for (; w != NULL; w = w->next_open) writer_flush(w);
+}
+
+/* Type: function writer_init
+ * ----------------------------------
+ * Sets w up to write to fd, or to collect output in memory when fd is
+ * -1. A writer on a descriptor is flushed at exit until it is
+ * disposed, so it must stay alive until then. Not thread safe; each
+ * thread formats into its own writer.
+ */
+void writer_init(writer *w, int fd)
+{
+    w->fd = fd;
+    w->cap = fd < 0 ? 4096 : WRITER_BUF_SIZE;
+    w->buf = malloc(w->cap);
+    assert(w->buf);
+    w->len = 0;
+    w->next_open = NULL;
+    if (fd < 0) return;
+    w->next_open = open_writers;
+    open_writers = w;
+    if (!exit_hook_set) {
+        atexit(flush_open_writers);
+        exit_hook_set = true;
+    }
+}
+
+/* Type: function writer_flush
+ * ----------------------------------
+ * Writes out everything buffered. Call before anything else writes to
+ * the same descriptor, such as an error message on a shared terminal.
+ */
+void writer_flush(writer *w)
+{
+    if (w->fd < 0 || w->len == 0) return;
+    struct iovec iov = {w->buf, w->len};
+    write_fully(w->fd, &iov, 1);
+    w->len = 0;
+}
+
+/* Type: function writer_spill
+ * ----------------------------------
+ * Slow path of writer_write, for appends that do not fit. A memory
+ * writer doubles its buffer. Otherwise a large append goes out with the
+ * buffer in one writev straight from the caller's memory, and a small
+ * one flushes the buffer and is copied in.
+ */
+void writer_spill(writer *w, const void *data, size_t len)
+{
+    if (w->fd < 0) {
+        while (w->cap - w->len < len || w->len == w->cap) w->cap *= 2;
+        w->buf = realloc(w->buf, w->cap);
+        assert(w->buf);
+    } else if (len >= w->cap / 4) {
+        struct iovec iov[2] = {{w->buf, w->len}, {(void *)data, len}};
+        write_fully(w->fd, iov, 2);
+        w->len = 0;
+        return;
+    } else {
+        writer_flush(w);
+    }
+    if (len == 0) return; // writer_char only wanted room
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+/* Type: function writer_dispose
+ * ----------------------------------
+ * Flushes w, stops flushing it at exit, and frees its buffer.
+ */
+void writer_dispose(writer *w)
+{
+    writer_flush(w);
+    for (writer **p = &open_writers; *p != NULL; p = &(*p)->next_open) {
+        if (*p == w) {
+            *p = w->next_open;
+            break;
+        }
+    }
+    free(w->buf);
+    w->buf = NULL;
+    w->len = w->cap = 0;
+}
+
+/* Type: function format_long
+ * ----------------------------------
+ * Formats n into dst right-aligned in width columns, exactly as
+ * printf("%*ld") would, and returns the length. dst needs room for
+ * width or WRITER_LONG_MAX bytes, whichever is more. Digits are
+ * produced backwards into a scratch buffer with no locale or format
+ * parsing.
+ */
+size_t format_long(char *dst, long n, int width)
+{
+    char digits[WRITER_LONG_MAX];
+    char *p = digits + sizeof(digits);
+    unsigned long mag = n < 0 ? -(unsigned long)n : (unsigned long)n; // Unsigned so LONG_MIN negates safely
+    do {
+        *--p = '0' + mag % 10;
+        mag /= 10;
+    } while (mag != 0);
+    if (n < 0) *--p = '-';
+    size_t len = digits + sizeof(digits) - p;
+    size_t pad = width > 0 && (size_t)width > len ? width - len : 0;
+    memset(dst, ' ', pad);
+    memcpy(dst + pad, p, len);
+    return pad + len;
+}
+
+/* Type: function writer_long
+ * ----------------------------------
+ * Appends n right-aligned in width columns, like "%*ld".
+ */
+void writer_long(writer *w, long n, int width)
+{
+    size_t need = width > WRITER_LONG_MAX ? (size_t)width : WRITER_LONG_MAX;
+    if (w->cap - w->len < need) {
+        char tmp[WRITER_LONG_MAX];
+        if ((size_t)width > sizeof(tmp)) { // Wider than any number; pad separately
+            size_t digits = format_long(tmp, n, 0);
+            for (size_t i = digits; i < (size_t)width; i++) writer_char(w, ' ');
+            writer_write(w, tmp, digits);
+            return;
+        }
+        writer_write(w, tmp, format_long(tmp, n, width));
+        return;
+    }
+    w->len += format_long(w->buf + w->len, n, width);
+}
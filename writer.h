@@ -0,0 +1,68 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#define WRITER_BUF_SIZE (1 << 18)
+#define WRITER_LONG_MAX 24 // Digits and sign of any long, plus slack for a null
+
+// Output buffer in front of a file descriptor. Appends are plain
+// memcpys with no stdio locking or format parsing, and the buffer goes
+// out with write(2) only when it is full, on writer_flush, or at exit.
+// Appends at least a quarter of the buffer long are not copied: the
+// buffer and the caller's bytes go out together with one writev. With
+// fd -1 nothing is ever written and the buffer grows instead, which
+// lets a worker thread format output ahead of its turn.
+typedef struct writer {
+    int fd;
+    char *buf;
+    size_t len, cap;
+    struct writer *next_open; // Writers still to be flushed at exit
+} writer;
+
+void writer_init(writer *w, int fd);
+void writer_flush(writer *w);
+void writer_dispose(writer *w);
+void writer_spill(writer *w, const void *data, size_t len);
+void writer_long(writer *w, long n, int width);
+size_t format_long(char *dst, long n, int width);
+
+/* Type: function writer_write
+ * ----------------------------------
+ * Appends len bytes. The common case, room in the buffer, is inlined.
+ */
+static inline void writer_write(writer *w, const void *data, size_t len)
+{
+    if (w->cap - w->len < len) {
+        writer_spill(w, data, len);
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+static inline void writer_char(writer *w, char c)
+{
+    if (w->len == w->cap) writer_spill(w, NULL, 0);
+    w->buf[w->len++] = c;
+}
+
+/* Type: function writer_text
+ * ----------------------------------
+ * Appends at most len bytes of s, stopping early at a null byte the way
+ * printf's %s and %.*s do, so lines holding a stray NUL come out as
+ * they always have.
+ */
+static inline void writer_text(writer *w, const char *s, size_t len)
+{
+    writer_write(w, s, strnlen(s, len));
+}
+
+static inline void writer_str(writer *w, const char *s)
+{
+    writer_write(w, s, strlen(s));
+}
+
+#endif